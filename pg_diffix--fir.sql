@@ -31,7 +31,7 @@ SECURITY INVOKER SET search_path = '';
 CREATE FUNCTION internal_qual_wrapper(boolean)
 RETURNS boolean
 AS 'MODULE_PATHNAME'
-LANGUAGE C VOLATILE
+LANGUAGE C VOLATILE PARALLEL SAFE
 SECURITY INVOKER SET search_path = '';
 
 /* ----------------------------------------------------------------
@@ -56,6 +56,12 @@ AS $$
 $$
 SECURITY INVOKER SET search_path = '';
 
+CREATE FUNCTION planning_stats(OUT statements bigint, OUT compile_time float8, OUT rewrite_time float8)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE
+SECURITY INVOKER SET search_path = '';
+
 CREATE FUNCTION show_labels()
 RETURNS table(objtype text, objname text, label text)
 LANGUAGE SQL
@@ -110,6 +116,9 @@ CREATE PROCEDURE unmark_table(table_name text)
 AS $$
   BEGIN
     DELETE FROM pg_catalog.pg_seclabel WHERE provider = 'pg_diffix' AND objoid = table_name::regclass::oid;
+
+    -- Going through the label provider invalidates labels cached by other sessions.
+    EXECUTE format('SECURITY LABEL FOR pg_diffix ON TABLE %s IS NULL', table_name::regclass);
   END;
 $$ LANGUAGE plpgsql;
 
@@ -190,6 +199,9 @@ $$ LANGUAGE plpgsql;
  * will be allocated in the aggregation context of the current Agg node. Passing an AnonAggState up
  * (for example from a subquery) outside of the intended scope may result in memory corruption.
  *
+ * During aggregation the state is declared as `internal`, which Postgres requires for serializing
+ * partial states of parallel workers. Only the final function exposes the state as AnonAggState.
+ *
  * See `aggregation/common.h` for more info.
  */
 CREATE TYPE AnonAggState;
@@ -212,40 +224,58 @@ CREATE TYPE AnonAggState (
   LIKE = internal
 );
 
-CREATE FUNCTION anon_agg_state_transfn(AnonAggState, variadic aids "any")
-RETURNS AnonAggState
+CREATE FUNCTION anon_agg_state_transfn(internal, variadic aids "any")
+RETURNS internal
 AS 'MODULE_PATHNAME'
-LANGUAGE C STABLE
+LANGUAGE C STABLE PARALLEL SAFE COST 10
 SECURITY INVOKER SET search_path = '';
 
-CREATE FUNCTION anon_agg_state_transfn(AnonAggState, value "any", variadic aids "any")
-RETURNS AnonAggState
+CREATE FUNCTION anon_agg_state_transfn(internal, value "any", variadic aids "any")
+RETURNS internal
 AS 'MODULE_PATHNAME'
-LANGUAGE C STABLE
+LANGUAGE C STABLE PARALLEL SAFE COST 10
 SECURITY INVOKER SET search_path = '';
 
-CREATE FUNCTION anon_agg_state_transfn(AnonAggState, arg1 "any", arg2 "any", variadic aids "any")
-RETURNS AnonAggState
+CREATE FUNCTION anon_agg_state_transfn(internal, arg1 "any", arg2 "any", variadic aids "any")
+RETURNS internal
 AS 'MODULE_PATHNAME'
-LANGUAGE C STABLE
+LANGUAGE C STABLE PARALLEL SAFE COST 10
 SECURITY INVOKER SET search_path = '';
 
-CREATE FUNCTION anon_agg_state_finalfn(AnonAggState, variadic aids "any")
+CREATE FUNCTION anon_agg_state_finalfn(internal, variadic aids "any")
 RETURNS AnonAggState
 AS 'MODULE_PATHNAME'
-LANGUAGE C STABLE
+LANGUAGE C STABLE PARALLEL SAFE
 SECURITY INVOKER SET search_path = '';
 
-CREATE FUNCTION anon_agg_state_finalfn(AnonAggState, value "any", variadic aids "any")
+CREATE FUNCTION anon_agg_state_finalfn(internal, value "any", variadic aids "any")
 RETURNS AnonAggState
 AS 'MODULE_PATHNAME'
-LANGUAGE C STABLE
+LANGUAGE C STABLE PARALLEL SAFE
 SECURITY INVOKER SET search_path = '';
 
-CREATE FUNCTION anon_agg_state_finalfn(AnonAggState, arg1 "any", arg2 "any", variadic aids "any")
+CREATE FUNCTION anon_agg_state_finalfn(internal, arg1 "any", arg2 "any", variadic aids "any")
 RETURNS AnonAggState
 AS 'MODULE_PATHNAME'
-LANGUAGE C STABLE
+LANGUAGE C STABLE PARALLEL SAFE
+SECURITY INVOKER SET search_path = '';
+
+CREATE FUNCTION anon_agg_state_combinefn(internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE PARALLEL SAFE COST 10
+SECURITY INVOKER SET search_path = '';
+
+CREATE FUNCTION anon_agg_state_serialfn(internal)
+RETURNS bytea
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT PARALLEL SAFE
+SECURITY INVOKER SET search_path = '';
+
+CREATE FUNCTION anon_agg_state_deserialfn(bytea, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT PARALLEL SAFE
 SECURITY INVOKER SET search_path = '';
 
 /* ----------------------------------------------------------------
@@ -284,31 +314,57 @@ CREATE AGGREGATE avg_noise(value "any") (
 CREATE FUNCTION count_histogram_transfn(internal, value "any")
 RETURNS internal
 AS 'MODULE_PATHNAME'
-LANGUAGE C STABLE
+LANGUAGE C STABLE PARALLEL SAFE
 SECURITY INVOKER SET search_path = '';
 
 CREATE FUNCTION count_histogram_transfn(internal, value "any", bin_size bigint)
 RETURNS internal
 AS 'MODULE_PATHNAME'
-LANGUAGE C STABLE
+LANGUAGE C STABLE PARALLEL SAFE
 SECURITY INVOKER SET search_path = '';
 
 CREATE FUNCTION count_histogram_finalfn(internal)
 RETURNS bigint[][]
 AS 'MODULE_PATHNAME'
-LANGUAGE C STABLE
+LANGUAGE C STABLE PARALLEL SAFE
+SECURITY INVOKER SET search_path = '';
+
+CREATE FUNCTION count_histogram_combinefn(internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE PARALLEL SAFE
+SECURITY INVOKER SET search_path = '';
+
+CREATE FUNCTION count_histogram_serialfn(internal)
+RETURNS bytea
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT PARALLEL SAFE
+SECURITY INVOKER SET search_path = '';
+
+CREATE FUNCTION count_histogram_deserialfn(bytea, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT PARALLEL SAFE
 SECURITY INVOKER SET search_path = '';
 
 CREATE AGGREGATE count_histogram(value "any") (
   sfunc = count_histogram_transfn,
   stype = internal,
-  finalfunc = count_histogram_finalfn
+  finalfunc = count_histogram_finalfn,
+  combinefunc = count_histogram_combinefn,
+  serialfunc = count_histogram_serialfn,
+  deserialfunc = count_histogram_deserialfn,
+  parallel = safe
 );
 
 CREATE AGGREGATE count_histogram(value "any", bin_size bigint) (
   sfunc = count_histogram_transfn,
   stype = internal,
-  finalfunc = count_histogram_finalfn
+  finalfunc = count_histogram_finalfn,
+  combinefunc = count_histogram_combinefn,
+  serialfunc = count_histogram_serialfn,
+  deserialfunc = count_histogram_deserialfn,
+  parallel = safe
 );
 
 /* ----------------------------------------------------------------
@@ -324,82 +380,122 @@ CREATE AGGREGATE count_histogram(value "any", bin_size bigint) (
 
 CREATE AGGREGATE low_count(variadic aids "any") (
   sfunc = anon_agg_state_transfn,
-  stype = AnonAggState,
+  stype = internal,
   finalfunc = anon_agg_state_finalfn,
   finalfunc_extra = true,
-  finalfunc_modify = read_write
+  finalfunc_modify = read_write,
+  combinefunc = anon_agg_state_combinefn,
+  serialfunc = anon_agg_state_serialfn,
+  deserialfunc = anon_agg_state_deserialfn,
+  parallel = safe
 );
 
 CREATE AGGREGATE anon_count_distinct(value "any", variadic aids "any") (
   sfunc = anon_agg_state_transfn,
-  stype = AnonAggState,
+  stype = internal,
   finalfunc = anon_agg_state_finalfn,
   finalfunc_extra = true,
-  finalfunc_modify = read_write
+  finalfunc_modify = read_write,
+  combinefunc = anon_agg_state_combinefn,
+  serialfunc = anon_agg_state_serialfn,
+  deserialfunc = anon_agg_state_deserialfn,
+  parallel = safe
 );
 
 CREATE AGGREGATE anon_count_star(variadic aids "any") (
   sfunc = anon_agg_state_transfn,
-  stype = AnonAggState,
+  stype = internal,
   finalfunc = anon_agg_state_finalfn,
   finalfunc_extra = true,
-  finalfunc_modify = read_write
+  finalfunc_modify = read_write,
+  combinefunc = anon_agg_state_combinefn,
+  serialfunc = anon_agg_state_serialfn,
+  deserialfunc = anon_agg_state_deserialfn,
+  parallel = safe
 );
 
 CREATE AGGREGATE anon_count_value(value "any", variadic aids "any") (
   sfunc = anon_agg_state_transfn,
-  stype = AnonAggState,
+  stype = internal,
   finalfunc = anon_agg_state_finalfn,
   finalfunc_extra = true,
-  finalfunc_modify = read_write
+  finalfunc_modify = read_write,
+  combinefunc = anon_agg_state_combinefn,
+  serialfunc = anon_agg_state_serialfn,
+  deserialfunc = anon_agg_state_deserialfn,
+  parallel = safe
 );
 
 CREATE AGGREGATE anon_sum(value "any", variadic aids "any") (
   sfunc = anon_agg_state_transfn,
-  stype = AnonAggState,
+  stype = internal,
   finalfunc = anon_agg_state_finalfn,
   finalfunc_extra = true,
-  finalfunc_modify = read_write
+  finalfunc_modify = read_write,
+  combinefunc = anon_agg_state_combinefn,
+  serialfunc = anon_agg_state_serialfn,
+  deserialfunc = anon_agg_state_deserialfn,
+  parallel = safe
 );
 
 CREATE AGGREGATE anon_count_histogram(aid_index integer, bin_size bigint, variadic aids "any") (
   sfunc = anon_agg_state_transfn,
-  stype = AnonAggState,
+  stype = internal,
   finalfunc = anon_agg_state_finalfn,
   finalfunc_extra = true,
-  finalfunc_modify = read_write
+  finalfunc_modify = read_write,
+  combinefunc = anon_agg_state_combinefn,
+  serialfunc = anon_agg_state_serialfn,
+  deserialfunc = anon_agg_state_deserialfn,
+  parallel = safe
 );
 
 CREATE AGGREGATE anon_count_distinct_noise(value "any", variadic aids "any") (
   sfunc = anon_agg_state_transfn,
-  stype = AnonAggState,
+  stype = internal,
   finalfunc = anon_agg_state_finalfn,
   finalfunc_extra = true,
-  finalfunc_modify = read_write
+  finalfunc_modify = read_write,
+  combinefunc = anon_agg_state_combinefn,
+  serialfunc = anon_agg_state_serialfn,
+  deserialfunc = anon_agg_state_deserialfn,
+  parallel = safe
 );
 
 CREATE AGGREGATE anon_count_star_noise(variadic aids "any") (
   sfunc = anon_agg_state_transfn,
-  stype = AnonAggState,
+  stype = internal,
   finalfunc = anon_agg_state_finalfn,
   finalfunc_extra = true,
-  finalfunc_modify = read_write
+  finalfunc_modify = read_write,
+  combinefunc = anon_agg_state_combinefn,
+  serialfunc = anon_agg_state_serialfn,
+  deserialfunc = anon_agg_state_deserialfn,
+  parallel = safe
 );
 
 CREATE AGGREGATE anon_count_value_noise(value "any", variadic aids "any") (
   sfunc = anon_agg_state_transfn,
-  stype = AnonAggState,
+  stype = internal,
   finalfunc = anon_agg_state_finalfn,
   finalfunc_extra = true,
-  finalfunc_modify = read_write
+  finalfunc_modify = read_write,
+  combinefunc = anon_agg_state_combinefn,
+  serialfunc = anon_agg_state_serialfn,
+  deserialfunc = anon_agg_state_deserialfn,
+  parallel = safe
 );
 
 CREATE AGGREGATE anon_sum_noise(value "any", variadic aids "any") (
   sfunc = anon_agg_state_transfn,
-  stype = AnonAggState,
+  stype = internal,
   finalfunc = anon_agg_state_finalfn,
   finalfunc_extra = true,
-  finalfunc_modify = read_write
+  finalfunc_modify = read_write,
+  combinefunc = anon_agg_state_combinefn,
+  serialfunc = anon_agg_state_serialfn,
+  deserialfunc = anon_agg_state_deserialfn,
+  parallel = safe
 );
 
 /* ----------------------------------------------------------------
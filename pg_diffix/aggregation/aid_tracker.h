@@ -1,6 +1,8 @@
 #ifndef PG_DIFFIX_AID_TRACKER_H
 #define PG_DIFFIX_AID_TRACKER_H
 
+#include "lib/stringinfo.h"
+
 #include "pg_diffix/aggregation/aid.h"
 #include "pg_diffix/aggregation/common.h"
 #include "pg_diffix/aggregation/noise.h"
@@ -61,4 +63,14 @@ static inline uint32 aid_tracker_naids(const AidTrackerState *state)
  */
 extern void aid_tracker_merge(AidTrackerState *dst_tracker, const AidTrackerState *src_tracker);
 
+/*
+ * Appends all AIDs of the tracker to the buffer.
+ */
+extern void aid_tracker_serialize(const AidTrackerState *state, StringInfo buf);
+
+/*
+ * Adds all serialized AIDs to the tracker.
+ */
+extern void aid_tracker_deserialize(AidTrackerState *state, StringInfo buf);
+
 #endif /* PG_DIFFIX_AID_TRACKER_H */
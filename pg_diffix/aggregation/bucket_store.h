@@ -0,0 +1,144 @@
+#ifndef PG_DIFFIX_BUCKET_STORE_H
+#define PG_DIFFIX_BUCKET_STORE_H
+
+#include "lib/stringinfo.h"
+#include "storage/buffile.h"
+
+#include "pg_diffix/aggregation/common.h"
+
+/*
+ * Append-only storage for buckets gathered by a BucketScan.
+ *
+ * Buckets are laid out as fixed-size records in large chunks, with the values and null flags
+ * stored inline after the `Bucket` header. This avoids separate allocations per bucket and
+ * keeps sequential iteration over all buckets cache friendly.
+ * Pointers to stored buckets remain valid until the store is spilled.
+ *
+ * A store can be spilled to a temporary file, after which all of its buckets, the ones
+ * appended so far and the ones written later, live only on disk. Nothing is kept in memory
+ * per spilled bucket. Spilled buckets are read back one at a time, in the order they were added,
+ * and changed by rewriting the whole file into a new one, which replaces the old file.
+ *
+ * Code which has to work with both kinds of stores iterates with `bucket_store_rewind` and
+ * `bucket_store_next`, and loads states of the buckets it needs with `bucket_store_load_states`.
+ */
+typedef struct BucketStore
+{
+  MemoryContext memory_context;  /* Where the store and its files live */
+  MemoryContext chunk_context;   /* Where chunks are allocated */
+  BucketDescriptor *bucket_desc; /* Describes the stored buckets */
+  Size record_size;              /* Size of a single bucket record */
+  int num_buckets;               /* Number of stored buckets */
+  int num_chunks;                /* Number of allocated chunks */
+  int max_chunks;                /* Capacity of `chunks` array */
+  char **chunks;                 /* Arrays of bucket records */
+  BufFile *spill_file;           /* All buckets once spilled, or NULL if they are kept in memory */
+  BufFile *rewrite_file;         /* Receives rewritten buckets, NULL unless rewriting */
+  Size label_size;               /* Serialized size of the labels of spilled buckets */
+  int read_position;             /* Index of the next bucket returned by `bucket_store_next` */
+  MemoryContext read_context;    /* Holds the last bucket read from the spill file */
+  Bucket *read_bucket;           /* Last bucket read from the spill file */
+  StringInfoData read_buf;       /* Record of `read_bucket`, positioned at its states */
+  StringInfoData write_buf;      /* Record being written */
+} BucketStore;
+
+#define BUCKET_STORE_CHUNK_BITS 10
+#define BUCKET_STORE_CHUNK_SIZE (1 << BUCKET_STORE_CHUNK_BITS)
+
+/*
+ * Creates an empty store for buckets described by `bucket_desc`.
+ * Buckets kept in memory are allocated in `chunk_context`, which the caller may reset once the store is spilled.
+ */
+extern BucketStore *create_bucket_store(MemoryContext memory_context, MemoryContext chunk_context,
+                                        BucketDescriptor *bucket_desc);
+
+/*
+ * Closes the spill files, if any. Memory is released with the store's memory contexts.
+ */
+extern void destroy_bucket_store(BucketStore *store);
+
+/*
+ * Appends a bucket with all values zeroed and not NULL. Caller fills the values.
+ * Only valid before the store is spilled.
+ */
+extern Bucket *bucket_store_append(BucketStore *store);
+
+/*
+ * Writes all buckets to the spill file. Buckets added afterwards go straight to the file.
+ * Memory of the buckets is not released, the caller is expected to reset the chunk context.
+ */
+extern void bucket_store_spill(BucketStore *store);
+
+/*
+ * Appends a bucket to the spill file. Values are serialized, so the bucket can live anywhere.
+ */
+extern void bucket_store_write(BucketStore *store, Bucket *bucket);
+
+/*
+ * Positions the store before its first bucket.
+ */
+extern void bucket_store_rewind(BucketStore *store);
+
+/*
+ * Returns the next bucket, or NULL after the last one.
+ * Buckets read from the spill file have no states until `bucket_store_load_states` is called,
+ * and are released by the next call.
+ */
+extern Bucket *bucket_store_next(BucketStore *store);
+
+/*
+ * Restores the states of the bucket last returned by `bucket_store_next`, at most once per bucket.
+ * Does nothing for buckets which are in memory.
+ */
+extern void bucket_store_load_states(BucketStore *store, Bucket *bucket);
+
+/*
+ * Starts rewriting a spilled store. Buckets are read from the start of the old file with
+ * `bucket_store_next` and each one, changed or not, is passed to `bucket_store_rewrite`.
+ */
+extern void bucket_store_begin_rewrite(BucketStore *store);
+
+/*
+ * Writes the next bucket of a rewrite. Its states must be loaded.
+ */
+extern void bucket_store_rewrite(BucketStore *store, Bucket *bucket);
+
+/*
+ * Replaces the old spill file with the rewritten one, releasing the space of the old one.
+ */
+extern void bucket_store_end_rewrite(BucketStore *store);
+
+/*
+ * Appends the anonymizing aggregator states of the bucket to the buffer.
+ * Only the owners of shared states are written.
+ */
+extern void serialize_bucket_states(Bucket *bucket, BucketDescriptor *bucket_desc, StringInfo buf);
+
+/*
+ * Restores states written by `serialize_bucket_states` in the given memory context.
+ */
+extern void deserialize_bucket_states(Bucket *bucket, BucketDescriptor *bucket_desc, StringInfo buf,
+                                      MemoryContext context);
+
+static inline int bucket_store_size(const BucketStore *store)
+{
+  return store->num_buckets;
+}
+
+static inline bool bucket_store_spilled(const BucketStore *store)
+{
+  return store->spill_file != NULL;
+}
+
+/*
+ * Returns the bucket at the given index. Only valid for buckets kept in memory.
+ */
+static inline Bucket *bucket_store_get(const BucketStore *store, int index)
+{
+  Assert(!bucket_store_spilled(store));
+  Assert(index >= 0 && index < store->num_buckets);
+  char *chunk = store->chunks[index >> BUCKET_STORE_CHUNK_BITS];
+  return (Bucket *)(chunk + (index & (BUCKET_STORE_CHUNK_SIZE - 1)) * store->record_size);
+}
+
+#endif /* PG_DIFFIX_BUCKET_STORE_H */
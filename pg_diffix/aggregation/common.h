@@ -2,7 +2,9 @@
 #define PG_DIFFIX_COMMON_H
 
 #include "access/attnum.h"
+#include "lib/stringinfo.h"
 #include "nodes/pg_list.h"
+#include "nodes/plannodes.h"
 #include "nodes/primnodes.h"
 
 #include "pg_diffix/aggregation/noise.h"
@@ -23,13 +25,17 @@
  *   - Advance the aggregator state for the given input tuple.
  *     Argument at index 0 should be ignored because it is managed by the wrapper function.
  *   - Switch to the state's memory context when attaching data to the state.
- *     If moving any input Datums to the state, they must be copied first with `datumCopy`.
+ *     If moving any input Datums to the state, they must be copied first with `datumCopy`
+ *     (or interned, see interner.h).
  *
  * The `finalize` function derives the final value (of type `final_type`) of the aggregator.
  * Temporary and return data should not be allocated in the state's memory context but in
  * the current memory context which is shorter lived. See below for information about memory.
  * Because state might be borrowed from another aggregator, `finalize` must be idempotent,
  * meaning multiple executions against the same state have to return the same result.
+ * Aggregators sharing a state may memoize the intermediate result of finalization in the state,
+ * so that paired value and noise outputs are computed once. Such results must be discarded
+ * by `transition`, `merge` and `deserialize`.
  *
  * The `explain` function returns a human-readable representation of the aggregator state.
  * As with `finalize`, the current memory context should be used for temporary and return values.
@@ -40,8 +46,15 @@
  *
  *     agg2(args2) -> merge_to -> agg1(args1) == agg(args1 ++ args2)
  *
- * Both states are known to live in the same memory context. Temporary data should be allocated
- * in the current memory context (not state's).
+ * Source state may live in a shorter lived memory context than destination state, so any data
+ * moved to the destination must be copied. Temporary data should be allocated in the current
+ * memory context (not state's).
+ *
+ * The `serialize` and `deserialize` functions are used to pass partial states between
+ * parallel workers and the leader. `serialize` appends the contents of the state to the buffer.
+ * `deserialize` restores those contents into an empty state, which was created with the same
+ * ArgsDescriptor as the serialized one. BucketScan also uses them to spill states to disk,
+ * so a deserialized state must behave exactly like the original one.
  *
  * Memory contexts:
  *
@@ -57,7 +70,7 @@
  *
  * The following pseudocode illustrates how often each context is reset:
  *
- *   bucket_context = new context or NULL if no BucketScan parent
+ *   bucket_context = new context or NULL if no BucketScan parent or it leaves states to the Agg
  *   outer_context  = new context
  *   inner_context  = new context
  *
@@ -101,6 +114,13 @@ typedef struct ArgsDescriptor
  */
 extern ArgsDescriptor *build_args_desc(Aggref *aggref);
 
+/*
+ * Aggregates of a Finalize Agg combine partial states and have those as their only argument.
+ * Returns the matching Aggref from the Partial Agg below, which has the original arguments.
+ * Other aggregates are returned as-is.
+ */
+extern Aggref *find_partial_aggref(Plan *agg_plan, Aggref *aggref);
+
 typedef struct AnonAggFuncs AnonAggFuncs;
 typedef struct AnonAggState AnonAggState;
 
@@ -149,8 +169,24 @@ typedef struct AnonymizationContext
   AttrNumber *grouping_cols;  /* Array of indices into the target list for the grouping columns */
   int grouping_cols_count;    /* Count of grouping columns */
   bool expand_buckets;        /* True if buckets have to be expanded for this query */
+  int num_grouping_sets;      /* Number of grouping sets, 0 if query has no GROUPING SETS */
+  int *grouping_set_ids;      /* Per grouping set, GROUPING() of all grouping columns */
+  seed_t *grouping_set_seeds; /* Per grouping set, static part of bucket seed */
+  AttrNumber grouping_id_col; /* Index into the target list for the GROUPING() of all grouping columns */
+  List *seed_materials;       /* Seed materials of grouping columns and filters, if they reference parameters */
+  List *param_labels;         /* Filtering parameters, hashed into base labels once their values are known */
+  List *param_bucket_exprs;   /* Bucket expressions verified once their parameter values are known */
 } AnonymizationContext;
 
+/*
+ * GROUPING() of all grouping columns identifies a grouping set.
+ * The bit of a column is set if it is not grouped by the set, the first column being the most significant.
+ */
+static inline bool is_grouped_column(int grouping_set_id, int column, int num_columns)
+{
+  return (grouping_set_id & (1 << (num_columns - 1 - column))) == 0;
+}
+
 typedef struct BucketDescriptor
 {
   MemoryContext bucket_context;                 /* Memory context where buckets live */
@@ -175,6 +211,8 @@ typedef struct Bucket
   bool *is_null;  /* Attribute at index is null? */
   bool low_count; /* Has low count AIDs? */
   bool merged;    /* Was merged to some other bucket? */
+  bool has_seed;  /* Was `seed` computed? */
+  seed_t seed;    /* Noise layer seed, computed on first use by `compute_bucket_seed` */
 } Bucket;
 
 struct AnonAggFuncs
@@ -197,6 +235,12 @@ struct AnonAggFuncs
   /* Merge source aggregation state to destination state. */
   void (*merge)(AnonAggState *dst_state, const AnonAggState *src_state);
 
+  /* Appends the binary representation of the state to the buffer. */
+  void (*serialize)(const AnonAggState *state, StringInfo buf);
+
+  /* Restores the contents of an empty state from the buffer. */
+  void (*deserialize)(AnonAggState *state, StringInfo buf);
+
   /*
    * Returns a string representation of the aggregator state.
    * The string should be allocated in the current (not state's) memory context.
@@ -1,6 +1,7 @@
 #ifndef PG_DIFFIX_CONTRIBUTION_TRACKER_H
 #define PG_DIFFIX_CONTRIBUTION_TRACKER_H
 
+#include "lib/stringinfo.h"
 #include "nodes/pg_list.h"
 
 #include "pg_diffix/aggregation/aid.h"
@@ -95,6 +96,16 @@ extern ContributionTrackerState *contribution_tracker_new(
     MapAidFunc aid_mapper,
     const ContributionDescriptor *contribution_descriptor);
 
+/*
+ * Appends the contributions of all tracked AIDs to the buffer.
+ */
+extern void contribution_tracker_serialize(const ContributionTrackerState *state, StringInfo buf);
+
+/*
+ * Replays serialized contributions into an empty tracker.
+ */
+extern void contribution_tracker_deserialize(ContributionTrackerState *state, StringInfo buf);
+
 extern void add_top_contributor(
     const ContributionDescriptor *descriptor,
     Contributors *top_contributors,
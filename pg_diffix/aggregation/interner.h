@@ -0,0 +1,24 @@
+#ifndef PG_DIFFIX_INTERNER_H
+#define PG_DIFFIX_INTERNER_H
+
+#include "utils/palloc.h"
+
+/*
+ * Query-scoped storage for by-reference values.
+ * Every distinct byte sequence is stored only once, meaning that interned values
+ * can be compared for equality by comparing their pointers.
+ */
+typedef struct DatumInterner DatumInterner;
+
+/*
+ * Creates an empty interner which allocates values in the given memory context.
+ */
+extern DatumInterner *create_datum_interner(MemoryContext memory_context);
+
+/*
+ * Returns the interned copy of the given value. By-value types are returned as is.
+ * The returned value lives as long as the interner's memory context.
+ */
+extern Datum intern_datum(DatumInterner *interner, Datum value, bool typbyval, int16 typlen);
+
+#endif /* PG_DIFFIX_INTERNER_H */
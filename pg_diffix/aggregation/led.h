@@ -1,8 +1,24 @@
 #ifndef PG_DIFFIX_LED_H
 #define PG_DIFFIX_LED_H
 
+#include "storage/dsm.h"
+#include "storage/shm_toc.h"
+
+#include "pg_diffix/aggregation/bucket_store.h"
 #include "pg_diffix/aggregation/common.h"
 
-extern void led_hook(List *buckets, BucketDescriptor *bucket_desc);
+typedef struct LedResult
+{
+  int buckets_merged; /* Number of low count buckets merged into siblings */
+  int total_merges;   /* Number of merges, a bucket may be merged into multiple siblings */
+} LedResult;
+
+extern LedResult led_hook(BucketStore *buckets, BucketDescriptor *bucket_desc);
+
+/*
+ * Entry point of parallel workers searching for LED siblings.
+ * Must be exported, workers look it up by name in the extension library.
+ */
+extern PGDLLEXPORT void led_parallel_worker_main(dsm_segment *seg, shm_toc *toc);
 
 #endif /* PG_DIFFIX_LED_H */
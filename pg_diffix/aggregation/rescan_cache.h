@@ -0,0 +1,59 @@
+#ifndef PG_DIFFIX_RESCAN_CACHE_H
+#define PG_DIFFIX_RESCAN_CACHE_H
+
+#include "nodes/bitmapset.h"
+#include "nodes/execnodes.h"
+
+/*
+ * Bounded LRU cache of result tuples of a parameterized plan node, keyed by the values of its parameters.
+ *
+ * Each scan either replays the results cached for the current parameter values, or records the
+ * results while they are produced. Only scans which run to completion are cached. When the
+ * cache grows over its size limit, least recently used results are evicted. Results which do not
+ * fit in the cache on their own are not recorded.
+ */
+typedef struct RescanCache RescanCache;
+
+/*
+ * Creates an empty cache for results described by `result_desc`, keyed by the given PARAM_EXEC ids.
+ */
+extern RescanCache *create_rescan_cache(EState *estate, Bitmapset *params, TupleDesc result_desc, Size max_size);
+
+/*
+ * Ends the current scan. Results recorded so far are discarded if the scan did not complete.
+ */
+extern void rescan_cache_reset(RescanCache *cache);
+
+/*
+ * Returns true if a scan was started since the last reset.
+ */
+extern bool rescan_cache_started(RescanCache *cache);
+
+/*
+ * Starts a scan for the current parameter values.
+ * Returns true if results are cached and should be replayed with `rescan_cache_next`.
+ * Otherwise, results are expected to be recorded with `rescan_cache_record`.
+ */
+extern bool rescan_cache_begin(RescanCache *cache, ExprContext *econtext);
+
+/*
+ * Returns true if the current scan is replayed from the cache.
+ */
+extern bool rescan_cache_replaying(RescanCache *cache);
+
+/*
+ * Returns the next cached result tuple, or NULL if all results were replayed.
+ */
+extern TupleTableSlot *rescan_cache_next(RescanCache *cache);
+
+/*
+ * Adds a copy of the result tuple to the results of the current scan.
+ */
+extern void rescan_cache_record(RescanCache *cache, TupleTableSlot *slot);
+
+/*
+ * Marks the results of the current scan as complete, making them available for replay.
+ */
+extern void rescan_cache_complete(RescanCache *cache);
+
+#endif /* PG_DIFFIX_RESCAN_CACHE_H */
@@ -1,10 +1,13 @@
 #ifndef PG_DIFFIX_STAR_BUCKET_H
 #define PG_DIFFIX_STAR_BUCKET_H
 
-#include "nodes/pg_list.h"
-
+#include "pg_diffix/aggregation/bucket_store.h"
 #include "pg_diffix/aggregation/common.h"
 
-extern Bucket *star_bucket_hook(List *buckets, BucketDescriptor *bucket_desc);
+/*
+ * Merges low count buckets into the star bucket and returns it, or NULL if it has to be suppressed.
+ * The number of merged buckets is stored in `buckets_merged`.
+ */
+extern Bucket *star_bucket_hook(BucketStore *buckets, BucketDescriptor *bucket_desc, int *buckets_merged);
 
 #endif /* PG_DIFFIX_STAR_BUCKET_H */
@@ -2,6 +2,7 @@
 #define PG_DIFFIX_AUTH_H
 
 #include "access/attnum.h"
+#include "nodes/bitmapset.h"
 
 extern void auth_init(void);
 
@@ -39,6 +40,11 @@ extern bool is_personal_relation(Oid relation_oid);
  */
 extern bool is_aid_column(Oid relation_oid, AttrNumber attnum);
 
+/*
+ * Returns the numbers of the columns labeled as AIDs.
+ */
+extern Bitmapset *get_aid_columns(Oid relation_oid);
+
 /*
  * Returns true if the column has been labeled as not filterable, false otherwise.
  */
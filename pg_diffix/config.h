@@ -28,6 +28,9 @@ typedef struct DiffixConfig
 
   bool compute_suppress_bin;
   char *text_label_for_suppress_bin;
+
+  int led_parallel_workers;
+  int led_parallel_min_buckets;
 } DiffixConfig;
 
 /*
@@ -26,7 +26,7 @@ extern bool is_stable_expression(Node *node);
 
 /*
  * Fills `type`, `value` and `isnull` with what the stable expression `node` holds.
- * `bound_params` must be provided, since `node` might be a `Param` node.
+ * `bound_params` must be provided if `node` is a `Param` node.
  */
 extern void get_stable_expression_value(Node *node, ParamListInfo bound_params, Oid *type, Datum *value, bool *isnull);
 
@@ -15,9 +15,9 @@ typedef struct AnonQueryLinks AnonQueryLinks;
 
 /*
  * Transforms subqueries accessing personal relations into anonymizing subqueries.
- * Returned data is used during plan rewrite.
+ * Returned data is used during plan rewrite. Returns NULL if the query needs no anonymization.
  */
-extern AnonQueryLinks *compile_query(Query *query, List *personal_relations, ParamListInfo bound_params);
+extern AnonQueryLinks *compile_query(Query *query);
 
 /*
  * Calls `rewrite_plan` for each item in a list of Plan nodes.
@@ -30,8 +30,14 @@ extern void rewrite_plan_list(List *plans, AnonQueryLinks *links);
 extern Plan *rewrite_plan(Plan *plan, AnonQueryLinks *links);
 
 /*
- * Returns the noise layer seed for the current bucket.
+ * Completes the anonymization parameters which depend on values of query parameters.
+ * Plans are reusable for any parameter values, so this is done when the plan is executed.
  */
-seed_t compute_bucket_seed(const Bucket *bucket, const BucketDescriptor *bucket_desc);
+extern void bind_anonymization_params(AnonymizationContext *anon_context, ParamListInfo bound_params);
+
+/*
+ * Returns the noise layer seed for the current bucket. The seed is cached in the bucket.
+ */
+seed_t compute_bucket_seed(Bucket *bucket, const BucketDescriptor *bucket_desc);
 
 #endif /* PG_DIFFIX_ANONYMIZATION_H */
@@ -0,0 +1,13 @@
+#ifndef PG_DIFFIX_COSTS_H
+#define PG_DIFFIX_COSTS_H
+
+#include "nodes/pathnodes.h"
+
+/*
+ * Adds the costs of anonymizing aggregates to the grouping paths of `grouped_rel`.
+ * Costs grow with the number of AID instances and with the number of distinct AIDs
+ * and counted values per bucket, which are estimated from the statistics of `input_rel`.
+ */
+extern void cost_anonymizing_aggregation(PlannerInfo *root, RelOptInfo *input_rel, RelOptInfo *grouped_rel);
+
+#endif /* PG_DIFFIX_COSTS_H */
@@ -26,14 +26,15 @@ typedef struct PersonalRelation
   List *aid_columns; /* AID columns in relation (of type AidColumn) */
 } PersonalRelation;
 
-extern List *gather_personal_relations(Query *query);
+/*
+ * Returns the data of a personal relation, or NULL if the relation is not personal.
+ * Relations found earlier are reused from `relations`, newly found ones are appended to it.
+ */
+extern PersonalRelation *find_personal_relation(Oid rel_oid, List **relations);
 
-static inline bool involves_personal_relations(Query *query)
-{
-  List *personal_relations = gather_personal_relations(query);
-  bool result = personal_relations != NIL;
-  list_free(personal_relations);
-  return result;
-}
+/*
+ * Returns true if the query or any of its subqueries references a personal relation.
+ */
+extern bool involves_personal_relations(Query *query);
 
 #endif /* PG_DIFFIX_RELATION_H */
@@ -15,19 +15,39 @@ extern void verify_utility_command(Node *utility_stmt);
  */
 extern void verify_explain_options(ExplainStmt *explain);
 
+/*
+ * Expressions defining the buckets of an anonymizing query.
+ * They are collected once and shared by validation and compilation.
+ */
+typedef struct BucketExpressions
+{
+  List *grouping_exprs;   /* Expressions of grouping clauses, in clause order */
+  List *filtering_exprs;  /* Left sides of equalities in pre-anonymization filters */
+  List *filtering_values; /* Right sides of equalities in pre-anonymization filters */
+} BucketExpressions;
+
 /*
  * Verifies that a query matches current anonymization restrictions and limitations.
  * If requirements are not met, an error is reported and execution is halted.
+ * Fills the filtering expressions of `bucket_exprs`.
  *
  * Some part of verification is up to `verify_bucket_expressions`.
  */
-extern void verify_anonymization_requirements(Query *query);
+extern void verify_anonymization_requirements(Query *query, BucketExpressions *bucket_exprs);
 
 /*
- * Verifies restrictions on bucket expressions, operates on an anonymizing query.
+ * Verifies restrictions on the grouping expressions of an anonymizing query.
  * If requirements are not met, an error is reported and execution is halted.
+ *
+ * Returns the expressions whose verification depends on parameter values,
+ * which are verified by `verify_param_bucket_expressions` once the values are known.
+ */
+extern List *verify_bucket_expressions(BucketExpressions *bucket_exprs);
+
+/*
+ * Verifies bucket expressions returned by `verify_bucket_expressions` for the given parameter values.
  */
-extern void verify_bucket_expressions(Query *query, ParamListInfo bound_params);
+extern void verify_param_bucket_expressions(List *exprs, ParamListInfo bound_params);
 
 /*
  * Returns `true` if the given list of `RangeTblEntry` from `ExecutorCheckPerms` does not access `pg_catalog`
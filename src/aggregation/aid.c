@@ -20,8 +20,9 @@ static aid_t make_int8_aid(Datum datum)
 
 static aid_t make_text_aid(Datum datum)
 {
-  char *str = TextDatumGetCString(datum);
-  return hash_bytes((unsigned char *)str, strlen(str));
+  /* Text has no embedded zeros, so hashing its contents equals hashing its C string. */
+  text *str = DatumGetTextPP(datum);
+  return hash_bytes((unsigned char *)VARDATA_ANY(str), VARSIZE_ANY_EXHDR(str));
 }
 
 MapAidFunc get_aid_mapper(Oid aid_type)
@@ -1,5 +1,7 @@
 #include "postgres.h"
 
+#include "libpq/pqformat.h"
+
 #include "pg_diffix/aggregation/aid_tracker.h"
 #include "pg_diffix/utils.h"
 
@@ -39,3 +41,21 @@ void aid_tracker_merge(AidTrackerState *dst_tracker, const AidTrackerState *src_
     aid_tracker_update(dst_tracker, entry->aid);
   }
 }
+
+void aid_tracker_serialize(const AidTrackerState *state, StringInfo buf)
+{
+  pq_sendint32(buf, state->aid_set->members);
+
+  AidTrackerHashEntry *entry;
+  foreach_entry(entry, state->aid_set, AidTracker)
+  {
+    pq_sendint64(buf, entry->aid);
+  }
+}
+
+void aid_tracker_deserialize(AidTrackerState *state, StringInfo buf)
+{
+  uint32 num_aids = pq_getmsgint(buf, sizeof(uint32));
+  for (uint32 i = 0; i < num_aids; i++)
+    aid_tracker_update(state, (aid_t)pq_getmsgint64(buf));
+}
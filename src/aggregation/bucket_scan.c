@@ -1,5 +1,10 @@
 #include "postgres.h"
 
+#include "access/sysattr.h"
+#include "access/tsmapi.h"
+#include "catalog/pg_proc.h"
+#include "commands/explain.h"
+#include "executor/instrument.h"
 #include "executor/tuptable.h"
 #include "miscadmin.h"
 #include "nodes/execnodes.h"
@@ -9,14 +14,20 @@
 #include "optimizer/cost.h"
 #include "optimizer/optimizer.h"
 #include "optimizer/tlist.h"
+#include "portability/instr_time.h"
 #include "utils/datum.h"
+#include "utils/lsyscache.h"
 
 #include "pg_diffix/aggregation/bucket_scan.h"
+#include "pg_diffix/aggregation/bucket_store.h"
 #include "pg_diffix/aggregation/common.h"
+#include "pg_diffix/aggregation/interner.h"
 #include "pg_diffix/aggregation/led.h"
+#include "pg_diffix/aggregation/rescan_cache.h"
 #include "pg_diffix/aggregation/star_bucket.h"
 #include "pg_diffix/config.h"
 #include "pg_diffix/oid_cache.h"
+#include "pg_diffix/query/anonymization.h"
 #include "pg_diffix/utils.h"
 
 /*-------------------------------------------------------------------------
@@ -47,6 +58,37 @@
  *   unfinalized until after cross-bucket processing completes. Once we're ready to emit tuples,
  *   we move labels and finalized aggregates to the scan slot. Expressions of the Agg node are
  *   moved to the BucketScan and label/aggregate references are rewritten to INDEX_VARs.
+ *   Aggregates referenced by the qual are finalized first, the others only for buckets which pass it.
+ *
+ *   Streaming:
+ *
+ *   If no cross-bucket processing can happen (see `needs_cross_bucket_hooks`), buckets are not
+ *   materialized. Each bucket is finalized and emitted as soon as the Agg produces it.
+ *   Aggregator states then live in the Agg's own memory, which stays valid until the Agg
+ *   is called again.
+ *
+ *   Memory:
+ *
+ *   Below a sorted Agg, states are created directly in bucket memory. Below a hashed Agg,
+ *   they are created in the Agg's memory, so that its memory accounting (and spilling) sees them,
+ *   and copied to bucket memory when gathered. Once bucket memory exceeds `work_mem`, all buckets
+ *   are spilled to disk, together with their labels, and further buckets are written straight
+ *   to disk (see bucket_store.h). Cross-bucket processing then reads them back sequentially.
+ *   States of each aggregator kind are kept in their own memory context, so that EXPLAIN ANALYZE
+ *   can break the peak memory usage down by aggregator.
+ *
+ *   Grouping sets:
+ *
+ *   With GROUPING SETS, the Agg also exports the GROUPING() of all grouping columns, which identifies
+ *   the set of a bucket, followed by any other GROUPING() calls of the query. Buckets of each set
+ *   are gathered separately and hold only the labels grouped by their set, so that seeds,
+ *   LED and the star bucket treat them as if the query grouped by only those labels.
+ *
+ *   Rescans:
+ *
+ *   A BucketScan which depends on outer parameters (e.g. below a nested loop or a LATERAL join)
+ *   is rescanned whenever they change. Its results are cached by parameter values, so scans
+ *   with previously seen values replay the cached tuples instead of aggregating again.
  *
  *-------------------------------------------------------------------------
  */
@@ -59,6 +101,7 @@ typedef struct BucketScanData
   int num_aggs;                      /* Number of aggregates in child Agg */
   int low_count_index;               /* Index of low count aggregate */
   int count_star_index;              /* Index of anonymizing count(*) aggregate */
+  bool streaming;                    /* Emit buckets as they are produced by child Agg? */
 } BucketScanData;
 
 #define BUCKET_SCAN_DATA_NAME CppAsString(BucketScanData)
@@ -72,56 +115,264 @@ static inline BucketScanData *get_plan_data(BucketScan *plan)
   return linitial(plan->custom_private);
 }
 
+/* Kinds of anonymizing aggregators. States of each kind are kept in their own memory context. */
+typedef enum AggKind
+{
+  AGG_KIND_COUNT = 0,
+  AGG_KIND_COUNT_DISTINCT,
+  AGG_KIND_SUM,
+  AGG_KIND_LOW_COUNT,
+  AGG_KIND_COUNT_HISTOGRAM,
+  NUM_AGG_KINDS
+} AggKind;
+
+static const char *const AGG_KIND_NAMES[NUM_AGG_KINDS] = {
+    "count",
+    "count distinct",
+    "sum",
+    "low count",
+    "count histogram",
+};
+
+static AggKind get_agg_kind(const AnonAggFuncs *agg_funcs)
+{
+  if (agg_funcs == &g_count_distinct_funcs || agg_funcs == &g_count_distinct_noise_funcs)
+    return AGG_KIND_COUNT_DISTINCT;
+  else if (agg_funcs == &g_sum_funcs || agg_funcs == &g_sum_noise_funcs)
+    return AGG_KIND_SUM;
+  else if (agg_funcs == &g_low_count_funcs)
+    return AGG_KIND_LOW_COUNT;
+  else if (agg_funcs == &g_count_histogram_funcs)
+    return AGG_KIND_COUNT_HISTOGRAM;
+  else
+    return AGG_KIND_COUNT;
+}
+
+/* Execution statistics, reported by EXPLAIN ANALYZE. */
+typedef struct BucketScanStats
+{
+  int64 buckets;                       /* Buckets received from child plan */
+  int64 low_count_buckets;             /* Buckets which were low count when received */
+  int led_merged_buckets;              /* Low count buckets merged into siblings by LED */
+  int led_merges;                      /* Merges done by LED */
+  int star_merged_buckets;             /* Low count buckets merged into the star bucket */
+  int spilled_buckets;                 /* Buckets with states spilled to disk */
+  Size peak_memory;                    /* Peak memory allocated in bucket context */
+  Size agg_peak_memory[NUM_AGG_KINDS]; /* Peak memory allocated for states of each aggregator kind */
+  instr_time gathering_time;           /* Time spent gathering buckets, including child plan */
+  instr_time led_time;                 /* Time spent in LED */
+  instr_time star_bucket_time;         /* Time spent computing the star bucket */
+  instr_time finalize_time;            /* Time spent finalizing aggregates */
+  int64 cache_hits;                    /* Scans replayed from the rescan cache */
+  int64 cache_misses;                  /* Scans executed for parameter values missing from the rescan cache */
+} BucketScanStats;
+
+/*
+ * Buckets of a single grouping set. Without GROUPING SETS, the scan has a single set
+ * which uses the scan descriptor.
+ */
+typedef struct GroupingSetState
+{
+  int grouping_set_id;               /* GROUPING() of all grouping columns for buckets of this set */
+  BucketDescriptor *bucket_desc;     /* Labels grouped by the set, followed by aggregates */
+  AnonymizationContext anon_context; /* Anonymization config with the seed of this set */
+  int *scan_atts;                    /* Scan slot attribute of each bucket attribute, NULL if identical */
+  Datum *grouping_values;            /* Results of GROUPING() calls, which are the same for all buckets of the set */
+  bool has_grouping_values;          /* Were `grouping_values` received from the child plan? */
+  BucketStore *buckets;              /* Buckets gathered from child plan */
+  Bucket *star_bucket;               /* Star bucket, or NULL if it was not computed or is not emitted */
+} GroupingSetState;
+
+static inline int scan_att_index(GroupingSetState *grouping_set, int index)
+{
+  return grouping_set->scan_atts != NULL ? grouping_set->scan_atts[index] : index;
+}
+
 /* Executor node */
 typedef struct BucketScanState
 {
   CustomScanState css;
-  MemoryContext bucket_context;  /* Buckets and aggregates are allocated in this context */
-  BucketDescriptor *bucket_desc; /* Bucket metadata */
-  List *buckets;                 /* List of buckets gathered from child plan */
-  int64 repeat_previous_bucket;  /* If greater than zero, previous bucket will be emitted again */
-  int next_bucket_index;         /* Next bucket to emit, starting from 0 if there is a star bucket, from 1 otherwise */
-  bool input_done;               /* Is the list of buckets populated? */
+  AnonymizationContext anon_context;         /* Anonymization config with parameter values of this execution */
+  MemoryContext bucket_context;              /* Buckets and aggregates are allocated in this context */
+  MemoryContext data_context;                /* Labels and interned values of buckets kept in memory */
+  MemoryContext agg_contexts[NUM_AGG_KINDS]; /* States of buckets kept in memory by aggregator kind, created on first use */
+  BucketDescriptor *bucket_desc;             /* Bucket metadata */
+  bool *qual_atts;                           /* Attributes which are finalized before evaluating the qual */
+  DatumInterner *interner;                   /* Interned by-reference values shared by all buckets */
+  GroupingSetState *grouping_sets;           /* Buckets of each grouping set */
+  int num_grouping_sets;                     /* Number of grouping sets, 1 if query has no GROUPING SETS */
+  int grouping_id_index;                     /* Scan attribute identifying the grouping set, -1 if query has no GROUPING SETS */
+  int current_grouping_set;                  /* Grouping set of next bucket to emit */
+  int64 repeat_previous_bucket;              /* If greater than zero, previous bucket will be emitted again */
+  int next_bucket_index;                     /* Next bucket of current grouping set to emit, -1 stands for the star bucket */
+  bool input_done;                           /* Is the list of buckets populated? */
+  bool streaming;                            /* Are buckets emitted as they are produced by child Agg? */
+  Bucket streamed_bucket;                    /* Current bucket when streaming, points to child's data */
+  bool agg_owns_states;                      /* Are states created in child Agg's memory instead of bucket memory? */
+  bool spilling;                             /* Are gathered buckets spilled to disk? */
+  MemoryContext spill_context;               /* States of the bucket being gathered if spilling states created in bucket memory */
+  RescanCache *rescan_cache;                 /* Results of previous scans by parameter values, NULL if not parameterized */
+  BucketScanStats stats;                     /* Execution statistics */
 } BucketScanState;
 
-static inline bool has_star_bucket(BucketScanState *bucket_state)
+static inline int first_bucket_index(GroupingSetState *grouping_set)
+{
+  return grouping_set->star_bucket != NULL ? -1 : 0;
+}
+
+/* Starts emitting buckets of the given grouping set. */
+static inline void start_grouping_set_emission(BucketScanState *bucket_state, int grouping_set_index)
 {
-  Assert(bucket_state->buckets != NIL);
-  return linitial(bucket_state->buckets) != NULL;
+  GroupingSetState *grouping_set = &bucket_state->grouping_sets[grouping_set_index];
+  bucket_state->current_grouping_set = grouping_set_index;
+  bucket_state->next_bucket_index = first_bucket_index(grouping_set);
+  bucket_store_rewind(grouping_set->buckets);
+}
+
+/* Starts emitting buckets from the first grouping set. */
+static inline void restart_emission(BucketScanState *bucket_state)
+{
+  start_grouping_set_emission(bucket_state, 0);
+  bucket_state->repeat_previous_bucket = 0;
+}
+
+/* Timing is collected only if requested by EXPLAIN ANALYZE. */
+static inline bool track_timing(BucketScanState *bucket_state)
+{
+  Instrumentation *instrument = bucket_state->css.ss.ps.instrument;
+  return instrument != NULL && instrument->need_timer;
+}
+
+static inline void accum_elapsed_time(instr_time *total, instr_time start_time)
+{
+  instr_time end_time;
+  INSTR_TIME_SET_CURRENT(end_time);
+  INSTR_TIME_ACCUM_DIFF(*total, end_time, start_time);
+}
+
+static inline void update_peak_memory(BucketScanState *bucket_state)
+{
+  BucketScanStats *stats = &bucket_state->stats;
+  Size memory = MemoryContextMemAllocated(bucket_state->bucket_context, true);
+  stats->peak_memory = Max(stats->peak_memory, memory);
+
+  for (int i = 0; i < NUM_AGG_KINDS; i++)
+  {
+    if (bucket_state->agg_contexts[i] == NULL)
+      continue;
+
+    Size agg_memory = MemoryContextMemAllocated(bucket_state->agg_contexts[i], true);
+    stats->agg_peak_memory[i] = Max(stats->agg_peak_memory[i], agg_memory);
+  }
+}
+
+/* Returns the memory context for states of the given aggregator which are kept in bucket memory. */
+static MemoryContext get_agg_context(BucketScanState *bucket_state, const AnonAggFuncs *agg_funcs)
+{
+  AggKind kind = get_agg_kind(agg_funcs);
+  if (bucket_state->agg_contexts[kind] == NULL)
+  {
+    bucket_state->agg_contexts[kind] = AllocSetContextCreate(bucket_state->bucket_context,
+                                                             "BucketScan aggregator context",
+                                                             ALLOCSET_DEFAULT_SIZES);
+    MemoryContextSetIdentifier(bucket_state->agg_contexts[kind], AGG_KIND_NAMES[kind]);
+  }
+
+  return bucket_state->agg_contexts[kind];
+}
+
+/* Releases the states of all buckets kept in memory. Contexts live on, for the states created later. */
+static void reset_agg_contexts(BucketScanState *bucket_state)
+{
+  for (int i = 0; i < NUM_AGG_KINDS; i++)
+  {
+    if (bucket_state->agg_contexts[i] != NULL)
+      MemoryContextReset(bucket_state->agg_contexts[i]);
+  }
+}
+
+/* Streamed buckets and the star bucket are not part of the bucket store. */
+static inline bool is_stored_bucket(BucketScanState *bucket_state, GroupingSetState *grouping_set, Bucket *bucket)
+{
+  return !bucket_state->streaming && bucket != grouping_set->star_bucket;
 }
 
 /* State of currently executing bucket scan. */
 static BucketScanState *g_current_bucket_scan = NULL;
 
-MemoryContext get_current_bucket_context(void);
-bool aggref_shares_state(Aggref *aggref);
+MemoryContext get_current_bucket_context(const AnonAggFuncs *agg_funcs);
+MemoryContext get_current_bucket_agg_context(const AnonAggFuncs *agg_funcs);
+DatumInterner *get_current_bucket_interner(MemoryContext state_context);
+BucketDescriptor *get_current_bucket_descriptor(void);
 
-/* Used by common.c to locate the bucket memory context. */
-MemoryContext get_current_bucket_context(void)
+/*
+ * Used by common.c to locate the bucket memory context.
+ * Returns NULL if states should be created in the Agg's memory.
+ */
+MemoryContext get_current_bucket_context(const AnonAggFuncs *agg_funcs)
 {
-  return g_current_bucket_scan != NULL
-             ? g_current_bucket_scan->bucket_context
-             : NULL;
+  if (g_current_bucket_scan == NULL || g_current_bucket_scan->agg_owns_states)
+    return NULL;
+
+  if (g_current_bucket_scan->spill_context != NULL)
+    return g_current_bucket_scan->spill_context;
+
+  return get_agg_context(g_current_bucket_scan, agg_funcs);
 }
 
-/* Used by common.c to check if an agg has redirected state. */
-bool aggref_shares_state(Aggref *aggref)
+/*
+ * Used by star_bucket.c to keep the states of the star bucket with the stored states of the same aggregator.
+ * Returns NULL outside of a bucket scan.
+ */
+MemoryContext get_current_bucket_agg_context(const AnonAggFuncs *agg_funcs)
 {
   if (g_current_bucket_scan == NULL)
-    return false;
+    return NULL;
 
-  BucketDescriptor *bucket_desc = g_current_bucket_scan->bucket_desc;
-  int num_atts = bucket_num_atts(bucket_desc);
-  for (int i = bucket_desc->num_labels; i < num_atts; i++)
+  return get_agg_context(g_current_bucket_scan, agg_funcs);
+}
+
+/*
+ * Used by aggregators to share by-reference values across buckets.
+ * Returns NULL for states in the Agg's memory, whose values have to count towards the Agg's memory limit,
+ * and for states of spilled buckets, which must not keep anything in memory.
+ */
+DatumInterner *get_current_bucket_interner(MemoryContext state_context)
+{
+  if (g_current_bucket_scan == NULL)
+    return NULL;
+
+  if (state_context == g_current_bucket_scan->bucket_context)
+    return g_current_bucket_scan->interner;
+
+  for (int i = 0; i < NUM_AGG_KINDS; i++)
   {
-    BucketAttribute *att = &bucket_desc->attrs[i];
-    /* We use reference comparison to pinpoint exact position of aggregate. */
-    if (att->agg.aggref == aggref)
-      return i != att->agg.redirect_to;
+    if (state_context == g_current_bucket_scan->agg_contexts[i])
+      return g_current_bucket_scan->interner;
   }
 
-  /* This should not happen, but we can't guarantee that the Aggref was not copied somewhere. */
-  return false;
+  return NULL;
+}
+
+/* Used by common.c to check if an agg has redirected state. */
+BucketDescriptor *get_current_bucket_descriptor(void)
+{
+  return g_current_bucket_scan != NULL
+             ? g_current_bucket_scan->bucket_desc
+             : NULL;
+}
+
+/*
+ * Returns true if buckets can be changed by cross-bucket processing (LED or the suppress bin),
+ * meaning that all buckets have to be gathered before any of them is emitted.
+ */
+static bool needs_cross_bucket_hooks(int low_count_index, int num_labels)
+{
+  if (low_count_index == -1)
+    return false;
+
+  /* LED needs at least 3 labels, see `led_hook`. */
+  return num_labels > 2 || g_config.compute_suppress_bin;
 }
 
 /*-------------------------------------------------------------------------
@@ -129,6 +380,163 @@ bool aggref_shares_state(Aggref *aggref)
  *-------------------------------------------------------------------------
  */
 
+static bool volatile_func_checker(Oid func_id, void *context)
+{
+  /* The HAVING wrapper is volatile only to keep the planner from pushing the qual down. */
+  return func_id != g_oid_cache.internal_qual_wrapper && func_volatile(func_id) == PROVOLATILE_VOLATILE;
+}
+
+static bool contain_volatile_exprs_walker(Node *node, void *context)
+{
+  if (node == NULL)
+    return false;
+
+  if (check_functions_in_node(node, volatile_func_checker, context))
+    return true;
+
+  if (IsA(node, NextValueExpr))
+    return true;
+
+  return expression_tree_walker(node, contain_volatile_exprs_walker, context);
+}
+
+/*
+ * Like `contain_volatile_functions`, except that the HAVING wrapper of anonymizing queries is not volatile.
+ */
+static bool contain_volatile_exprs(Node *node)
+{
+  return contain_volatile_exprs_walker(node, NULL);
+}
+
+/*
+ * Returns true if any expression in the plan tree can return different results for the same parameters.
+ * Node types not listed below may hold expressions this does not know about, so they count as volatile.
+ * `context` is the BucketScan at the root of the walk.
+ */
+static bool has_volatile_functions_walker(PlanState *plan_state, void *context)
+{
+  Plan *plan = plan_state->plan;
+
+  if (contain_volatile_exprs((Node *)plan->targetlist) || contain_volatile_exprs((Node *)plan->qual))
+    return true;
+
+  List *exprs = NIL; /* Expressions of the node other than target list and qual. */
+
+  switch (nodeTag(plan))
+  {
+  case T_SeqScan:
+  case T_SubqueryScan:
+  case T_CteScan:
+  case T_WorkTableScan:
+  case T_Material:
+  case T_Sort:
+  case T_IncrementalSort:
+  case T_Hash:
+  case T_Unique:
+  case T_Append:
+  case T_MergeAppend:
+  case T_Gather:
+  case T_GatherMerge:
+  case T_Agg:
+  case T_Group:
+  case T_SetOp:
+  case T_ProjectSet:
+    break;
+  case T_CustomScan:
+    /* Other custom scans are unknown. */
+    if (plan_state != context)
+      return true;
+    break;
+  case T_SampleScan:
+  {
+    TableSampleClause *tablesample = ((SampleScan *)plan)->tablesample;
+    /* Without REPEATABLE, each scan returns a different sample. */
+    if (tablesample->repeatable == NULL || !GetTsmRoutine(tablesample->tsmhandler)->repeatable_across_scans)
+      return true;
+    exprs = list_make2(tablesample->args, tablesample->repeatable);
+    break;
+  }
+  case T_IndexScan:
+    exprs = list_make2(((IndexScan *)plan)->indexqualorig, ((IndexScan *)plan)->indexorderbyorig);
+    break;
+  case T_IndexOnlyScan:
+    exprs = list_make2(((IndexOnlyScan *)plan)->indexqual, ((IndexOnlyScan *)plan)->indexorderby);
+    break;
+  case T_BitmapIndexScan:
+    exprs = list_make1(((BitmapIndexScan *)plan)->indexqualorig);
+    break;
+  case T_BitmapHeapScan:
+    exprs = list_make1(((BitmapHeapScan *)plan)->bitmapqualorig);
+    break;
+  case T_BitmapAnd:
+  case T_BitmapOr:
+    break;
+  case T_TidScan:
+    exprs = list_make1(((TidScan *)plan)->tidquals);
+    break;
+#if PG_VERSION_NUM >= 140000
+  case T_TidRangeScan:
+    exprs = list_make1(((TidRangeScan *)plan)->tidrangequals);
+    break;
+  case T_Memoize:
+    exprs = list_make1(((Memoize *)plan)->param_exprs);
+    break;
+#endif
+  case T_FunctionScan:
+    exprs = list_make1(((FunctionScan *)plan)->functions);
+    break;
+  case T_ValuesScan:
+    exprs = list_make1(((ValuesScan *)plan)->values_lists);
+    break;
+  case T_Result:
+    exprs = list_make1(((Result *)plan)->resconstantqual);
+    break;
+  case T_Limit:
+    exprs = list_make2(((Limit *)plan)->limitOffset, ((Limit *)plan)->limitCount);
+    break;
+  case T_WindowAgg:
+    exprs = list_make2(((WindowAgg *)plan)->startOffset, ((WindowAgg *)plan)->endOffset);
+    break;
+  case T_NestLoop:
+    exprs = list_make1(((Join *)plan)->joinqual);
+    break;
+  case T_MergeJoin:
+    exprs = list_make2(((Join *)plan)->joinqual, ((MergeJoin *)plan)->mergeclauses);
+    break;
+  case T_HashJoin:
+    exprs = list_make2(((Join *)plan)->joinqual, ((HashJoin *)plan)->hashclauses);
+    break;
+  default:
+    return true;
+  }
+
+  bool volatile_exprs = contain_volatile_exprs((Node *)exprs);
+  list_free(exprs);
+  if (volatile_exprs)
+    return true;
+
+  return planstate_tree_walker(plan_state, has_volatile_functions_walker, context);
+}
+
+/*
+ * Compares argument expressions of aggregates. Descriptors are built from partial aggregates
+ * when combining, so this works for both regular and Finalize Agg nodes.
+ */
+static bool equal_args(const ArgsDescriptor *args_desc1, const ArgsDescriptor *args_desc2)
+{
+  if (args_desc1->num_args != args_desc2->num_args)
+    return false;
+
+  /* Argument at index 0 is the agg state. */
+  for (int i = 1; i < args_desc1->num_args; i++)
+  {
+    if (!equal(args_desc1->args[i].expr, args_desc2->args[i].expr))
+      return false;
+  }
+
+  return true;
+}
+
 /*
  * Returns true if aggregates can share the same agg state.
  * This is possible when args, initial state, transition, and merge functions are identical.
@@ -141,11 +549,11 @@ static bool can_share_agg_state(BucketAttribute *agg1, BucketAttribute *agg2)
   return funcs1->create_state == funcs2->create_state &&
          funcs1->transition == funcs2->transition &&
          funcs1->merge == funcs2->merge &&
-         equal(agg1->agg.aggref->args, agg2->agg.aggref->args);
+         equal_args(agg1->agg.args_desc, agg2->agg.args_desc);
 }
 
 /*
- * Populates `bucket_desc` field with type metadata.
+ * Populates `bucket_desc` field with type metadata and `qual_atts` with attributes needed by the qual.
  */
 static void init_bucket_descriptor(BucketScanState *bucket_state)
 {
@@ -156,12 +564,13 @@ static void init_bucket_descriptor(BucketScanState *bucket_state)
 
   BucketDescriptor *bucket_desc = palloc0(sizeof(BucketDescriptor) + num_atts * sizeof(BucketAttribute));
   bucket_desc->bucket_context = bucket_state->bucket_context;
-  bucket_desc->anon_context = &plan_data->anon_context;
+  bucket_desc->anon_context = &bucket_state->anon_context;
   bucket_desc->low_count_index = plan_data->low_count_index;
   bucket_desc->num_labels = plan_data->num_labels;
   bucket_desc->num_aggs = plan_data->num_aggs;
 
-  List *outer_tlist = outerPlan(plan)->targetlist;
+  Plan *agg_plan = outerPlan(plan);
+  List *outer_tlist = agg_plan->targetlist;
   TupleDesc outer_tupdesc = outerPlanState(bucket_state)->ps_ResultTupleDesc;
 
   for (int i = 0; i < num_atts; i++)
@@ -180,7 +589,7 @@ static void init_bucket_descriptor(BucketScanState *bucket_state)
       agg_funcs = find_agg_funcs(aggref->aggfnoid);
       att->agg.aggref = aggref;
       att->agg.funcs = agg_funcs;
-      att->agg.args_desc = build_args_desc(aggref);
+      att->agg.args_desc = build_args_desc(find_partial_aggref(agg_plan, aggref));
       att->agg.redirect_to = i; /* Pointing to itself means state is not shared. */
       att->tag = agg_funcs != NULL ? BUCKET_ANON_AGG : BUCKET_REGULAR_AGG;
     }
@@ -216,6 +625,94 @@ static void init_bucket_descriptor(BucketScanState *bucket_state)
   }
 
   bucket_state->bucket_desc = bucket_desc;
+
+  /* Labels are always available to the qual, aggregates only if it references them. */
+  Bitmapset *qual_attnos = NULL;
+  pull_varattnos((Node *)plan->scan.plan.qual, INDEX_VAR, &qual_attnos);
+
+  bucket_state->qual_atts = palloc(num_atts * sizeof(bool));
+  for (int i = 0; i < num_atts; i++)
+    bucket_state->qual_atts[i] = i < plan_data->num_labels ||
+                                 bms_is_member(i + 1 - FirstLowInvalidHeapAttributeNumber, qual_attnos);
+}
+
+/*
+ * Populates `grouping_sets`. Set descriptors have the labels grouped by the set followed by
+ * the aggregates of the scan descriptor. Buckets of the empty set are global, which are never low count.
+ */
+static void init_grouping_sets(BucketScanState *bucket_state)
+{
+  AnonymizationContext *anon_context = &bucket_state->anon_context;
+  BucketDescriptor *scan_desc = bucket_state->bucket_desc;
+
+  if (anon_context->num_grouping_sets == 0)
+  {
+    bucket_state->grouping_sets = palloc0(sizeof(GroupingSetState));
+    bucket_state->grouping_sets[0].bucket_desc = scan_desc;
+    bucket_state->num_grouping_sets = 1;
+    bucket_state->grouping_id_index = -1;
+    return;
+  }
+
+  int num_columns = anon_context->grouping_cols_count;
+  int num_sets = anon_context->num_grouping_sets;
+  int num_grouping_values = scan_desc->num_labels - num_columns;
+
+  bucket_state->grouping_sets = palloc0(num_sets * sizeof(GroupingSetState));
+  bucket_state->num_grouping_sets = num_sets;
+  bucket_state->grouping_id_index = num_columns; /* GROUPING() of all columns comes right after the labels. */
+
+  for (int i = 0; i < num_sets; i++)
+  {
+    GroupingSetState *grouping_set = &bucket_state->grouping_sets[i];
+    int grouping_set_id = anon_context->grouping_set_ids[i];
+
+    int num_labels = 0;
+    for (int column = 0; column < num_columns; column++)
+    {
+      if (is_grouped_column(grouping_set_id, column, num_columns))
+        num_labels++;
+    }
+
+    int num_atts = num_labels + scan_desc->num_aggs;
+    int *scan_atts = palloc(num_atts * sizeof(int));
+    int att_index = 0;
+    for (int column = 0; column < num_columns; column++)
+    {
+      if (is_grouped_column(grouping_set_id, column, num_columns))
+        scan_atts[att_index++] = column;
+    }
+    for (int scan_index = scan_desc->num_labels; scan_index < bucket_num_atts(scan_desc); scan_index++)
+      scan_atts[att_index++] = scan_index;
+
+    grouping_set->anon_context = *anon_context;
+    grouping_set->anon_context.sql_seed = anon_context->grouping_set_seeds[i];
+
+    /* Aggregates move closer to the start of the bucket by the number of labels not grouped by the set. */
+    int agg_shift = scan_desc->num_labels - num_labels;
+
+    BucketDescriptor *bucket_desc = palloc0(sizeof(BucketDescriptor) + num_atts * sizeof(BucketAttribute));
+    bucket_desc->bucket_context = scan_desc->bucket_context;
+    bucket_desc->anon_context = &grouping_set->anon_context;
+    bucket_desc->low_count_index = num_labels > 0 && scan_desc->low_count_index != -1
+                                       ? scan_desc->low_count_index - agg_shift
+                                       : -1;
+    bucket_desc->num_labels = num_labels;
+    bucket_desc->num_aggs = scan_desc->num_aggs;
+
+    for (int j = 0; j < num_atts; j++)
+    {
+      bucket_desc->attrs[j] = scan_desc->attrs[scan_atts[j]];
+      if (j >= num_labels)
+        bucket_desc->attrs[j].agg.redirect_to -= agg_shift;
+    }
+
+    grouping_set->grouping_set_id = grouping_set_id;
+    grouping_set->bucket_desc = bucket_desc;
+    grouping_set->scan_atts = scan_atts;
+    grouping_set->grouping_values = palloc0(num_grouping_values * sizeof(Datum));
+    grouping_set->has_grouping_values = false;
+  }
 }
 
 static void bucket_begin_scan(CustomScanState *css, EState *estate, int eflags)
@@ -230,17 +727,114 @@ static void bucket_begin_scan(CustomScanState *css, EState *estate, int eflags)
     FAILWITH("Cannot BACKWARD or MARK/RESTORE a BucketScan.");
 
   bucket_state->bucket_context = AllocSetContextCreate(estate->es_query_cxt, "BucketScan context", ALLOCSET_DEFAULT_SIZES);
-  bucket_state->buckets = NIL;
+  bucket_state->data_context = NULL;
+  memset(bucket_state->agg_contexts, 0, sizeof(bucket_state->agg_contexts));
+  bucket_state->interner = NULL;
+  bucket_state->current_grouping_set = 0;
   bucket_state->repeat_previous_bucket = 0;
-  bucket_state->next_bucket_index = 1;
+  bucket_state->next_bucket_index = 0;
   bucket_state->input_done = false;
 
+  /* Settings may have changed since planning. */
+  BucketScanData *plan_data = get_plan_data(plan);
+  bucket_state->streaming = plan_data->streaming &&
+                            !needs_cross_bucket_hooks(plan_data->low_count_index, plan_data->num_labels);
+
+  /*
+   * Sorted aggregation creates states of the next bucket only after the current one was emitted,
+   * so states can be created directly in bucket memory. Hashed aggregation keeps all groups alive
+   * until the hash table is emitted. Its states are created in the Agg's memory, where they count
+   * towards the Agg's memory limit, and are copied to bucket memory (or spilled) when gathered.
+   */
+  Agg *agg = (Agg *)outerPlan(plan);
+  bool sorted_agg = (agg->aggstrategy == AGG_PLAIN || agg->aggstrategy == AGG_SORTED) && agg->groupingSets == NIL;
+  bucket_state->agg_owns_states = bucket_state->streaming || !sorted_agg;
+  bucket_state->spilling = false;
+  bucket_state->spill_context = NULL;
+  memset(&bucket_state->stats, 0, sizeof(BucketScanStats));
+
+  /* Plans can be reused for different parameter values, so the config is completed for each execution. */
+  bucket_state->anon_context = plan_data->anon_context;
+  if (!(eflags & EXEC_FLAG_EXPLAIN_ONLY))
+    bind_anonymization_params(&bucket_state->anon_context, estate->es_param_list_info);
+
   /* Initialize child plan. */
   outerPlanState(bucket_state) = ExecInitNode(outerPlan(plan), estate, eflags);
 
   /* Requires an initialized outerPlanState. */
   init_bucket_descriptor(bucket_state);
+  init_grouping_sets(bucket_state);
   css->ss.ps.ps_ExprContext->ecxt_scantuple = css->ss.ss_ScanTupleSlot;
+
+  /* Results can be reused only if they depend on nothing but the parameter values. */
+  bucket_state->rescan_cache = NULL;
+  Bitmapset *params = plan->scan.plan.extParam;
+  if (params != NULL && !(eflags & EXEC_FLAG_EXPLAIN_ONLY) && !has_volatile_functions_walker(&css->ss.ps, &css->ss.ps))
+    bucket_state->rescan_cache = create_rescan_cache(estate, params, ExecGetResultType(&css->ss.ps), work_mem * 1024L);
+}
+
+/* Merging into an empty state copies all data to bucket memory. */
+static Datum copy_agg_state(Datum value, BucketAttribute *att, MemoryContext bucket_context)
+{
+  AnonAggState *state = create_anon_agg_state(att->agg.funcs, bucket_context, att->agg.args_desc);
+  att->agg.funcs->merge(state, (AnonAggState *)DatumGetPointer(value));
+  return PointerGetDatum(state);
+}
+
+/*
+ * Moves all buckets gathered so far to disk and releases their memory.
+ * Interned values are released too, the labels of spilled buckets are compared by their bytes.
+ */
+static void start_spilling(BucketScanState *bucket_state)
+{
+  update_peak_memory(bucket_state);
+
+  for (int i = 0; i < bucket_state->num_grouping_sets; i++)
+    bucket_store_spill(bucket_state->grouping_sets[i].buckets);
+
+  MemoryContextReset(bucket_state->data_context);
+  reset_agg_contexts(bucket_state);
+  bucket_state->interner = NULL;
+  bucket_state->spilling = true;
+
+  /* States of the following buckets are released as soon as they are spilled. */
+  if (!bucket_state->agg_owns_states)
+    bucket_state->spill_context = AllocSetContextCreate(bucket_state->bucket_context,
+                                                        "BucketScan spill context",
+                                                        ALLOCSET_DEFAULT_SIZES);
+}
+
+/*
+ * Returns the grouping set of a bucket produced by the child plan.
+ */
+static GroupingSetState *find_grouping_set(BucketScanState *bucket_state, TupleTableSlot *outer_slot)
+{
+  if (bucket_state->grouping_id_index == -1)
+    return &bucket_state->grouping_sets[0];
+
+  Assert(!outer_slot->tts_isnull[bucket_state->grouping_id_index]);
+  int grouping_set_id = DatumGetInt32(outer_slot->tts_values[bucket_state->grouping_id_index]);
+
+  for (int i = 0; i < bucket_state->num_grouping_sets; i++)
+  {
+    GroupingSetState *grouping_set = &bucket_state->grouping_sets[i];
+    if (grouping_set->grouping_set_id != grouping_set_id)
+      continue;
+
+    if (!grouping_set->has_grouping_values)
+    {
+      /* GROUPING() results are integers, so they can be kept without copying. */
+      int num_labels = bucket_state->bucket_desc->num_labels;
+      for (int j = bucket_state->grouping_id_index; j < num_labels; j++)
+        grouping_set->grouping_values[j - bucket_state->grouping_id_index] = outer_slot->tts_values[j];
+      grouping_set->has_grouping_values = true;
+    }
+
+    return grouping_set;
+  }
+
+  FAILWITH("Unexpected grouping set in child plan output.");
+  return NULL;
 }
 
 static void fill_bucket_list(BucketScanState *bucket_state)
@@ -252,13 +846,18 @@ static void fill_bucket_list(BucketScanState *bucket_state)
   PlanState *outer_plan_state = outerPlanState(bucket_state);
 
   MemoryContext bucket_context = bucket_state->bucket_context;
-  BucketDescriptor *bucket_desc = bucket_state->bucket_desc;
-  int num_atts = bucket_num_atts(bucket_desc);
-  int low_count_index = bucket_desc->low_count_index;
+  MemoryContext data_context = bucket_state->data_context = AllocSetContextCreate(bucket_context,
+                                                                                  "BucketScan data context",
+                                                                                  ALLOCSET_DEFAULT_SIZES);
 
-  MemoryContext old_context = MemoryContextSwitchTo(bucket_context);
-  List *buckets = list_make1(NULL); /* First item is reserved for star bucket. */
-  MemoryContextSwitchTo(old_context);
+  /* Labels and distinct values are interned, so equal values share the same pointer. */
+  bucket_state->interner = create_datum_interner(data_context);
+
+  for (int i = 0; i < bucket_state->num_grouping_sets; i++)
+  {
+    GroupingSetState *grouping_set = &bucket_state->grouping_sets[i];
+    grouping_set->buckets = create_bucket_store(bucket_context, data_context, grouping_set->bucket_desc);
+  }
 
   for (;;)
   {
@@ -270,98 +869,223 @@ static void fill_bucket_list(BucketScanState *bucket_state)
     if (TupIsNull(outer_slot))
       break; /* EOF */
 
-    /* Make sure data is safe for copying. */
-    ExecMaterializeSlot(outer_slot);
+    /* Values are copied or interned below, so the slot does not need to be materialized. */
     slot_getallattrs(outer_slot);
 
-    /* Buckets are allocated in longer lived memory. */
-    old_context = MemoryContextSwitchTo(bucket_context);
-    Bucket *bucket = palloc0(sizeof(Bucket));
-    bucket->values = palloc0(num_atts * sizeof(Datum));
-    bucket->is_null = palloc0(num_atts * sizeof(bool));
+    GroupingSetState *grouping_set = find_grouping_set(bucket_state, outer_slot);
+    BucketDescriptor *bucket_desc = grouping_set->bucket_desc;
+    BucketStore *buckets = grouping_set->buckets;
+    int num_atts = bucket_num_atts(bucket_desc);
+
+    MemoryContext old_context;
+    Bucket *bucket;
+    Bucket spilled_bucket = {0};
 
-    for (int i = 0; i < num_atts; i++)
+    if (bucket_state->spilling)
     {
-      if (outer_slot->tts_isnull[i])
-        bucket->is_null[i] = true;
-      else
-        bucket->values[i] = datumCopy(outer_slot->tts_values[i],
-                                      bucket_desc->attrs[i].typ_byval,
-                                      bucket_desc->attrs[i].typ_len);
+      /* Spilled buckets are serialized straight from the child's slot. */
+      old_context = MemoryContextSwitchTo(per_tuple_memory);
+      bucket = &spilled_bucket;
+      bucket->values = palloc(num_atts * sizeof(Datum));
+      bucket->is_null = palloc(num_atts * sizeof(bool));
+
+      for (int i = 0; i < num_atts; i++)
+      {
+        int scan_index = scan_att_index(grouping_set, i);
+        bucket->values[i] = outer_slot->tts_values[scan_index];
+        bucket->is_null[i] = outer_slot->tts_isnull[scan_index];
+      }
     }
+    else
+    {
+      /* Buckets are allocated in longer lived memory. */
+      old_context = MemoryContextSwitchTo(data_context);
+      bucket = bucket_store_append(buckets);
 
-    buckets = lappend(buckets, bucket);
+      for (int i = 0; i < num_atts; i++)
+      {
+        BucketAttribute *att = &bucket_desc->attrs[i];
+        int scan_index = scan_att_index(grouping_set, i);
+        if (outer_slot->tts_isnull[scan_index])
+          bucket->is_null[i] = true;
+        else if (att->tag == BUCKET_LABEL)
+          bucket->values[i] = intern_datum(bucket_state->interner, outer_slot->tts_values[scan_index], att->typ_byval, att->typ_len);
+        else if (att->tag == BUCKET_ANON_AGG && i == att->agg.redirect_to && bucket_state->agg_owns_states)
+          bucket->values[i] = copy_agg_state(outer_slot->tts_values[scan_index], att, get_agg_context(bucket_state, att->agg.funcs));
+        else
+          bucket->values[i] = datumCopy(outer_slot->tts_values[scan_index], att->typ_byval, att->typ_len);
+      }
+    }
 
     /*
      * If the aggregate is missing, we consider buckets high-count.
      * This can happen with global aggregation or non-anonymizing queries.
      */
-    if (low_count_index != -1)
+    if (bucket_desc->low_count_index != -1)
     {
       /* Switch to tuple memory to evaluate low count. */
       MemoryContextSwitchTo(per_tuple_memory);
       bucket->low_count = eval_low_count(bucket, bucket_desc);
-      MemoryContextReset(per_tuple_memory);
     }
 
     MemoryContextSwitchTo(old_context);
+
+    bucket_state->stats.buckets++;
+    if (bucket->low_count)
+      bucket_state->stats.low_count_buckets++;
+
+    if (bucket_state->spilling)
+    {
+      /* States owned by the Agg are serialized directly, they will be released by the Agg. */
+      bucket_store_write(buckets, bucket);
+      if (bucket_state->spill_context != NULL)
+        MemoryContextReset(bucket_state->spill_context);
+    }
+    else if (MemoryContextMemAllocated(bucket_context, true) > work_mem * 1024L)
+    {
+      start_spilling(bucket_state);
+    }
+
+    MemoryContextReset(per_tuple_memory);
   }
 
-  bucket_state->buckets = buckets;
   bucket_state->input_done = true;
+  for (int i = 0; i < bucket_state->num_grouping_sets; i++)
+  {
+    BucketStore *buckets = bucket_state->grouping_sets[i].buckets;
+    if (bucket_store_spilled(buckets))
+      bucket_state->stats.spilled_buckets += bucket_store_size(buckets);
+  }
+  update_peak_memory(bucket_state);
 
   /* Restore previous bucket scan context. */
   g_current_bucket_scan = old_bucket_scan;
 }
 
-static void run_hooks(BucketScanState *bucket_state)
+static void run_grouping_set_hooks(BucketScanState *bucket_state, GroupingSetState *grouping_set)
 {
-  BucketDescriptor *bucket_desc = bucket_state->bucket_desc;
+  BucketDescriptor *bucket_desc = grouping_set->bucket_desc;
   bool has_low_count_agg = bucket_desc->low_count_index != -1;
   if (!has_low_count_agg)
     return;
 
-  led_hook(bucket_state->buckets, bucket_desc);
+  BucketScanStats *stats = &bucket_state->stats;
+  bool timing = track_timing(bucket_state);
+  instr_time start_time;
+
+  if (timing)
+    INSTR_TIME_SET_CURRENT(start_time);
+
+  LedResult led_result = led_hook(grouping_set->buckets, bucket_desc);
+  stats->led_merged_buckets += led_result.buckets_merged;
+  stats->led_merges += led_result.total_merges;
+
+  if (timing)
+    accum_elapsed_time(&stats->led_time, start_time);
 
   Bucket *star_bucket = NULL;
   if (g_config.compute_suppress_bin)
-    star_bucket = star_bucket_hook(bucket_state->buckets, bucket_desc);
+  {
+    if (timing)
+      INSTR_TIME_SET_CURRENT(start_time);
+
+    int star_merged_buckets = 0;
+    star_bucket = star_bucket_hook(grouping_set->buckets, bucket_desc, &star_merged_buckets);
+    if (star_bucket != NULL)
+      stats->star_merged_buckets += star_merged_buckets;
+
+    if (timing)
+      accum_elapsed_time(&stats->star_bucket_time, start_time);
+  }
+
+  grouping_set->star_bucket = star_bucket; /* Included in output if not NULL. */
+}
+
+static void run_hooks(BucketScanState *bucket_state)
+{
+  /* Merged states keep using the interner of this scan. */
+  BucketScanState *old_bucket_scan = g_current_bucket_scan;
+  g_current_bucket_scan = bucket_state;
+
+  for (int i = 0; i < bucket_state->num_grouping_sets; i++)
+    run_grouping_set_hooks(bucket_state, &bucket_state->grouping_sets[i]);
+
+  g_current_bucket_scan = old_bucket_scan;
+
+  update_peak_memory(bucket_state);
+
+  restart_emission(bucket_state);
+}
+
+/*
+ * Sets labels not grouped by the set to NULL and fills in the results of GROUPING() calls.
+ */
+static void fill_grouping_set_labels(BucketScanState *bucket_state, GroupingSetState *grouping_set,
+                                     Datum *values, bool *is_null)
+{
+  int grouping_id_index = bucket_state->grouping_id_index;
+  int num_labels = bucket_state->bucket_desc->num_labels;
 
-  if (star_bucket != NULL)
+  for (int i = 0; i < grouping_id_index; i++)
   {
-    list_head(bucket_state->buckets)->ptr_value = star_bucket;
-    bucket_state->next_bucket_index = 0; /* Include star bucket in output. */
+    values[i] = (Datum)0;
+    is_null[i] = true;
+  }
+
+  for (int i = grouping_id_index; i < num_labels; i++)
+  {
+    values[i] = grouping_set->grouping_values[i - grouping_id_index];
+    is_null[i] = false;
   }
 }
 
 /*
  * Moves bucket data to scan slot.
  * Aggregates are finalized in per tuple memory context.
+ * Only attributes where `qual_atts` equals `qual_phase` are finalized. The qual phase runs first
+ * and sets the other attributes to NULL, which are then filled in if the bucket passes the qual.
  */
-static void finalize_bucket(Bucket *bucket, BucketDescriptor *bucket_desc, ExprContext *econtext)
+static void finalize_bucket(BucketScanState *bucket_state, GroupingSetState *grouping_set, Bucket *bucket,
+                            bool qual_phase)
 {
+  ExprContext *econtext = bucket_state->css.ss.ps.ps_ExprContext;
+  const bool *qual_atts = bucket_state->qual_atts;
+  BucketDescriptor *bucket_desc = grouping_set->bucket_desc;
+
   MemoryContext old_context = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
 
   TupleTableSlot *scan_slot = econtext->ecxt_scantuple;
   Datum *values = scan_slot->tts_values;
   bool *is_null = scan_slot->tts_isnull;
 
+  if (qual_phase && grouping_set->scan_atts != NULL)
+    fill_grouping_set_labels(bucket_state, grouping_set, values, is_null);
+
   int num_atts = bucket_num_atts(bucket_desc);
   for (int i = 0; i < num_atts; i++)
   {
     BucketAttribute *att = &bucket_desc->attrs[i];
-    if (att->tag == BUCKET_ANON_AGG)
+    int scan_index = scan_att_index(grouping_set, i);
+    if (qual_atts[scan_index] != qual_phase)
+    {
+      if (qual_phase)
+      {
+        values[scan_index] = (Datum)0;
+        is_null[scan_index] = true;
+      }
+    }
+    else if (att->tag == BUCKET_ANON_AGG)
     {
       int state_source_index = att->agg.redirect_to; /* If shared, points to some other non-NULL state. */
       AnonAggState *agg_state = (AnonAggState *)DatumGetPointer(bucket->values[state_source_index]);
       Assert(agg_state != NULL);
-      is_null[i] = false;
-      values[i] = att->agg.funcs->finalize(agg_state, bucket, bucket_desc, &is_null[i]);
+      is_null[scan_index] = false;
+      values[scan_index] = att->agg.funcs->finalize(agg_state, bucket, bucket_desc, &is_null[scan_index]);
     }
     else
     {
-      values[i] = bucket->values[i];
-      is_null[i] = bucket->is_null[i];
+      values[scan_index] = bucket->values[i];
+      is_null[scan_index] = bucket->is_null[i];
     }
   }
 
@@ -369,7 +1093,89 @@ static void finalize_bucket(Bucket *bucket, BucketDescriptor *bucket_desc, ExprC
 
   /* Mark slot as ready. */
   scan_slot->tts_flags &= ~TTS_FLAG_EMPTY;
-  scan_slot->tts_nvalid = num_atts;
+  scan_slot->tts_nvalid = bucket_num_atts(bucket_state->bucket_desc);
+}
+
+static void accum_finalize_time(BucketScanState *bucket_state, bool timing, instr_time start_time)
+{
+  if (timing)
+    accum_elapsed_time(&bucket_state->stats.finalize_time, start_time);
+}
+
+/*
+ * Returns the next bucket to emit and stores its grouping set in `grouping_set`.
+ * Grouping sets are emitted one after the other, each starting with its star bucket.
+ */
+static Bucket *next_materialized_bucket(BucketScanState *bucket_state, GroupingSetState **grouping_set)
+{
+  while (bucket_state->current_grouping_set < bucket_state->num_grouping_sets)
+  {
+    GroupingSetState *current_set = &bucket_state->grouping_sets[bucket_state->current_grouping_set];
+    int bucket_index = bucket_state->next_bucket_index;
+    *grouping_set = current_set;
+
+    if (bucket_index == -1)
+    {
+      bucket_state->next_bucket_index++;
+      return current_set->star_bucket;
+    }
+
+    Bucket *bucket = bucket_store_next(current_set->buckets);
+    if (bucket != NULL)
+    {
+      bucket_state->next_bucket_index++;
+      return bucket;
+    }
+
+    /* Move on to the next grouping set. */
+    if (bucket_state->current_grouping_set + 1 < bucket_state->num_grouping_sets)
+      start_grouping_set_emission(bucket_state, bucket_state->current_grouping_set + 1);
+    else
+      bucket_state->current_grouping_set++;
+  }
+
+  return NULL; /* EOF */
+}
+
+/*
+ * Pulls the next bucket from the child plan without copying it.
+ * Its data stays valid until the child plan is called again.
+ */
+static Bucket *next_streamed_bucket(BucketScanState *bucket_state)
+{
+  BucketScanState *old_bucket_scan = g_current_bucket_scan;
+  g_current_bucket_scan = bucket_state;
+  TupleTableSlot *outer_slot = ExecProcNode(outerPlanState(bucket_state));
+  g_current_bucket_scan = old_bucket_scan;
+
+  if (TupIsNull(outer_slot))
+    return NULL; /* EOF */
+
+  slot_getallattrs(outer_slot);
+
+  Bucket *bucket = &bucket_state->streamed_bucket;
+  bucket->values = outer_slot->tts_values;
+  bucket->is_null = outer_slot->tts_isnull;
+  bucket->low_count = false;
+  bucket->merged = false;
+  bucket->has_seed = false;
+  bucket_state->stats.buckets++;
+
+  BucketDescriptor *bucket_desc = bucket_state->bucket_desc;
+  if (bucket_desc->low_count_index != -1)
+  {
+    /* Switch to tuple memory to evaluate low count. */
+    MemoryContext per_tuple_memory = bucket_state->css.ss.ps.ps_ExprContext->ecxt_per_tuple_memory;
+    MemoryContext old_context = MemoryContextSwitchTo(per_tuple_memory);
+    bucket->low_count = eval_low_count(bucket, bucket_desc);
+    MemoryContextSwitchTo(old_context);
+    MemoryContextReset(per_tuple_memory);
+
+    if (bucket->low_count)
+      bucket_state->stats.low_count_buckets++;
+  }
+
+  return bucket;
 }
 
 static int64 scan_slot_get_int64(ExprContext *econtext, int index)
@@ -381,13 +1187,23 @@ static int64 scan_slot_get_int64(ExprContext *econtext, int index)
     return DatumGetInt64(scan_slot->tts_values[index]);
 }
 
-static TupleTableSlot *bucket_exec_scan(CustomScanState *css)
+static TupleTableSlot *next_result(CustomScanState *css)
 {
   BucketScanState *bucket_state = (BucketScanState *)css;
 
-  if (!bucket_state->input_done)
+  bool timing = track_timing(bucket_state);
+  instr_time start_time;
+
+  if (!bucket_state->streaming && !bucket_state->input_done)
   {
+    if (timing)
+      INSTR_TIME_SET_CURRENT(start_time);
+
     fill_bucket_list(bucket_state);
+
+    if (timing)
+      accum_elapsed_time(&bucket_state->stats.gathering_time, start_time);
+
     run_hooks(bucket_state);
   }
 
@@ -411,30 +1227,45 @@ static TupleTableSlot *bucket_exec_scan(CustomScanState *css)
 
   BucketScan *plan = (BucketScan *)bucket_state->css.ss.ps.plan;
   BucketScanData *plan_data = get_plan_data(plan);
-  BucketDescriptor *bucket_desc = bucket_state->bucket_desc;
   ExprContext *econtext = css->ss.ps.ps_ExprContext;
   ExprState *qual = css->ss.ps.qual;
 
-  List *buckets = bucket_state->buckets;
-  int num_buckets = list_length(buckets);
-
   for (;;)
   {
     CHECK_FOR_INTERRUPTS();
 
-    if (bucket_state->next_bucket_index >= num_buckets)
+    GroupingSetState *grouping_set = &bucket_state->grouping_sets[0];
+    Bucket *bucket = bucket_state->streaming
+                         ? next_streamed_bucket(bucket_state)
+                         : next_materialized_bucket(bucket_state, &grouping_set);
+
+    if (bucket == NULL)
       return NULL; /* EOF */
 
-    Bucket *bucket = list_nth(buckets, bucket_state->next_bucket_index++);
     if (bucket->low_count || bucket->merged)
       continue; /* We can skip bucket without further evaluation. */
 
     ResetExprContext(econtext);
-    finalize_bucket(bucket, bucket_desc, econtext);
+
+    if (timing)
+      INSTR_TIME_SET_CURRENT(start_time);
+
+    /* States of spilled buckets are restored only for buckets which are not skipped. */
+    if (is_stored_bucket(bucket_state, grouping_set, bucket))
+      bucket_store_load_states(grouping_set->buckets, bucket);
+
+    finalize_bucket(bucket_state, grouping_set, bucket, true);
+    accum_finalize_time(bucket_state, timing, start_time);
 
     /* We do not reset after qual because some values in scan tuple are owned by econtext. */
     if (ExecQual(qual, econtext))
     {
+      if (timing)
+        INSTR_TIME_SET_CURRENT(start_time);
+
+      finalize_bucket(bucket_state, grouping_set, bucket, false);
+      accum_finalize_time(bucket_state, timing, start_time);
+
       if (plan_data->anon_context.expand_buckets)
       {
         int64 bucket_repeat_count = scan_slot_get_int64(econtext, plan_data->count_star_index);
@@ -451,10 +1282,53 @@ static TupleTableSlot *bucket_exec_scan(CustomScanState *css)
   }
 }
 
+static TupleTableSlot *bucket_exec_scan(CustomScanState *css)
+{
+  BucketScanState *bucket_state = (BucketScanState *)css;
+  RescanCache *rescan_cache = bucket_state->rescan_cache;
+
+  if (rescan_cache == NULL)
+    return next_result(css);
+
+  /* Parameter values are known only once the first tuple is requested. */
+  if (!rescan_cache_started(rescan_cache))
+  {
+    if (rescan_cache_begin(rescan_cache, css->ss.ps.ps_ExprContext))
+      bucket_state->stats.cache_hits++;
+    else
+      bucket_state->stats.cache_misses++;
+  }
+
+  if (rescan_cache_replaying(rescan_cache))
+    return rescan_cache_next(rescan_cache);
+
+  TupleTableSlot *slot = next_result(css);
+  if (TupIsNull(slot))
+    rescan_cache_complete(rescan_cache);
+  else
+    rescan_cache_record(rescan_cache, slot);
+
+  return slot;
+}
+
+static void destroy_grouping_set_stores(BucketScanState *bucket_state)
+{
+  for (int i = 0; i < bucket_state->num_grouping_sets; i++)
+  {
+    GroupingSetState *grouping_set = &bucket_state->grouping_sets[i];
+    if (grouping_set->buckets != NULL)
+      destroy_bucket_store(grouping_set->buckets);
+    grouping_set->buckets = NULL;
+    grouping_set->star_bucket = NULL;
+  }
+}
+
 static void bucket_end_scan(CustomScanState *css)
 {
   BucketScanState *bucket_state = (BucketScanState *)css;
 
+  destroy_grouping_set_stores(bucket_state);
+
   MemoryContextDelete(bucket_state->bucket_context);
   bucket_state->bucket_context = NULL;
 
@@ -467,6 +1341,18 @@ static void bucket_rescan(CustomScanState *css)
   BucketScanState *bucket_state = (BucketScanState *)css;
   PlanState *outer_plan = outerPlanState(css);
 
+  if (bucket_state->rescan_cache != NULL)
+    rescan_cache_reset(bucket_state->rescan_cache);
+
+  if (bucket_state->streaming)
+  {
+    /* Nothing is materialized, the child plan has to produce all buckets again. */
+    bucket_state->repeat_previous_bucket = 0;
+    if (outer_plan->chgParam == NULL)
+      ExecReScan(outer_plan);
+    return;
+  }
+
   /* Buckets not materialized yet, nothing to do. */
   if (!bucket_state->input_done)
     return;
@@ -474,9 +1360,15 @@ static void bucket_rescan(CustomScanState *css)
   if (outer_plan->chgParam != NULL)
   {
     /* We are forced to re-scan input. */
+    destroy_grouping_set_stores(bucket_state);
     MemoryContextReset(bucket_state->bucket_context); /* Frees all existing buckets. */
-    bucket_state->buckets = NIL;
-    bucket_state->next_bucket_index = 1;
+    bucket_state->data_context = NULL;
+    memset(bucket_state->agg_contexts, 0, sizeof(bucket_state->agg_contexts));
+    bucket_state->interner = NULL;
+    bucket_state->spilling = false;
+    bucket_state->spill_context = NULL;
+    bucket_state->current_grouping_set = 0;
+    bucket_state->next_bucket_index = 0;
     bucket_state->repeat_previous_bucket = 0;
     bucket_state->input_done = false;
     /* Child plan will be re-scanned by first ExecProcNode, so no need to do it here. */
@@ -484,13 +1376,83 @@ static void bucket_rescan(CustomScanState *css)
   else
   {
     /* Re-scan existing buckets. */
-    bucket_state->next_bucket_index = has_star_bucket(bucket_state) ? 0 : 1;
-    bucket_state->repeat_previous_bucket = 0;
+    restart_emission(bucket_state);
+  }
+}
+
+static List *list_shared_states(BucketDescriptor *bucket_desc)
+{
+  List *shared_states = NIL;
+
+  int num_atts = bucket_num_atts(bucket_desc);
+  for (int i = bucket_desc->num_labels; i < num_atts; i++)
+  {
+    BucketAttribute *att = &bucket_desc->attrs[i];
+    if (att->tag == BUCKET_ANON_AGG && att->agg.redirect_to != i)
+    {
+      BucketAttribute *owner_att = &bucket_desc->attrs[att->agg.redirect_to];
+      shared_states = lappend(shared_states,
+                              psprintf("%s -> %s",
+                                       get_func_name(att->agg.aggref->aggfnoid),
+                                       get_func_name(owner_att->agg.aggref->aggfnoid)));
+    }
   }
+
+  return shared_states;
 }
 
 static void bucket_explain_scan(CustomScanState *node, List *ancestors, ExplainState *es)
 {
+  BucketScanState *bucket_state = (BucketScanState *)node;
+  BucketScanStats *stats = &bucket_state->stats;
+
+  /* Statistics are available only after execution. */
+  if (!es->analyze)
+    return;
+
+  ExplainPropertyBool("Streaming", bucket_state->streaming, es);
+  if (bucket_state->grouping_id_index != -1)
+    ExplainPropertyInteger("Grouping Sets", NULL, bucket_state->num_grouping_sets, es);
+  ExplainPropertyInteger("Buckets", NULL, stats->buckets, es);
+  ExplainPropertyInteger("Low Count Buckets", NULL, stats->low_count_buckets, es);
+
+  if (bucket_state->rescan_cache != NULL)
+  {
+    ExplainPropertyInteger("Cache Hits", NULL, stats->cache_hits, es);
+    ExplainPropertyInteger("Cache Misses", NULL, stats->cache_misses, es);
+  }
+
+  if (!bucket_state->streaming)
+  {
+    ExplainPropertyInteger("LED Merged Buckets", NULL, stats->led_merged_buckets, es);
+    ExplainPropertyInteger("LED Merges", NULL, stats->led_merges, es);
+    ExplainPropertyInteger("Star Bucket Merged Buckets", NULL, stats->star_merged_buckets, es);
+    ExplainPropertyInteger("Spilled Buckets", NULL, stats->spilled_buckets, es);
+    ExplainPropertyInteger("Peak Memory Usage", "kB", (stats->peak_memory + 1023) / 1024, es);
+
+    /* Only kinds which had states in bucket memory are listed. */
+    for (int i = 0; i < NUM_AGG_KINDS; i++)
+    {
+      if (stats->agg_peak_memory[i] > 0)
+        ExplainPropertyInteger(psprintf("Peak Memory Usage (%s)", AGG_KIND_NAMES[i]), "kB",
+                               (stats->agg_peak_memory[i] + 1023) / 1024, es);
+    }
+  }
+
+  if (track_timing(bucket_state))
+  {
+    if (!bucket_state->streaming)
+    {
+      ExplainPropertyFloat("Gathering Time", "ms", INSTR_TIME_GET_MILLISEC(stats->gathering_time), 3, es);
+      ExplainPropertyFloat("LED Time", "ms", INSTR_TIME_GET_MILLISEC(stats->led_time), 3, es);
+      ExplainPropertyFloat("Star Bucket Time", "ms", INSTR_TIME_GET_MILLISEC(stats->star_bucket_time), 3, es);
+    }
+    ExplainPropertyFloat("Finalization Time", "ms", INSTR_TIME_GET_MILLISEC(stats->finalize_time), 3, es);
+  }
+
+  List *shared_states = list_shared_states(bucket_state->bucket_desc);
+  if (shared_states != NIL)
+    ExplainPropertyList("Shared States", shared_states, es);
 }
 
 static const CustomExecMethods BucketScanExecMethods = {
@@ -556,18 +1518,35 @@ static bool gather_aggrefs_walker(Node *node, List **aggrefs)
   return expression_tree_walker(node, gather_aggrefs_walker, aggrefs);
 }
 
+static bool gather_grouping_funcs_walker(Node *node, List **grouping_funcs)
+{
+  if (node == NULL)
+    return false;
+
+  if (IsA(node, GroupingFunc))
+  {
+    *grouping_funcs = list_append_unique(*grouping_funcs, node); /* Uses node equals to compare. */
+    return false;
+  }
+
+  return expression_tree_walker(node, gather_grouping_funcs_walker, grouping_funcs);
+}
+
 /*
  * Returns a new target list for Agg without any projections.
  * First entries are grouping labels, followed by aggregate expressions.
+ * With GROUPING SETS, labels are followed by the GROUPING() of all grouping columns
+ * and any other GROUPING() calls of the query. These count as labels in `num_labels`.
  */
-static List *flatten_agg_tlist(Agg *agg, AttrNumber *grouping_cols, int num_labels)
+static List *flatten_agg_tlist(Agg *agg, AnonymizationContext *anon_context, int *num_labels)
 {
   List *child_tlist = outerPlan(agg)->targetlist;
   List *orig_agg_tlist = agg->plan.targetlist;
   List *flat_agg_tlist = NIL;
+  AttrNumber *grouping_cols = anon_context->grouping_cols;
 
   /* Add grouping labels to target list. */
-  for (int i = 0; i < num_labels; i++)
+  for (int i = 0; i < anon_context->grouping_cols_count; i++)
   {
     TargetEntry *label_tle = list_nth_node(TargetEntry, orig_agg_tlist, grouping_cols[i] - 1);
     Assert(label_tle->resno == grouping_cols[i]);
@@ -595,6 +1574,30 @@ static List *flatten_agg_tlist(Agg *agg, AttrNumber *grouping_cols, int num_labe
     flat_agg_tlist = lappend(flat_agg_tlist, label_target_entry);
   }
 
+  if (anon_context->num_grouping_sets > 0)
+  {
+    /* The grouping set identifier always comes first. */
+    TargetEntry *grouping_id_tle = list_nth_node(TargetEntry, orig_agg_tlist, anon_context->grouping_id_col - 1);
+    List *grouping_funcs = list_make1(castNode(GroupingFunc, grouping_id_tle->expr));
+    gather_grouping_funcs_walker((Node *)agg->plan.targetlist, &grouping_funcs);
+    gather_grouping_funcs_walker((Node *)agg->plan.qual, &grouping_funcs);
+
+    ListCell *cell;
+    foreach (cell, grouping_funcs)
+    {
+      Expr *grouping_func = (Expr *)lfirst(cell);
+      TargetEntry *grouping_target_entry = makeTargetEntry(grouping_func, list_length(flat_agg_tlist) + 1, NULL, false);
+      TargetEntry *orig_target_entry = tlist_member(grouping_func, orig_agg_tlist);
+
+      if (orig_target_entry != NULL)
+        grouping_target_entry->resname = orig_target_entry->resname;
+
+      flat_agg_tlist = lappend(flat_agg_tlist, grouping_target_entry);
+    }
+  }
+
+  *num_labels = list_length(flat_agg_tlist);
+
   /* Add aggregates to target list. */
   List *aggrefs = NIL;
   gather_aggrefs_walker((Node *)agg->plan.targetlist, &aggrefs);
@@ -604,7 +1607,7 @@ static List *flatten_agg_tlist(Agg *agg, AttrNumber *grouping_cols, int num_labe
   for (int i = 0; i < num_aggrefs; i++)
   {
     Aggref *aggref = list_nth_node(Aggref, aggrefs, i);
-    TargetEntry *agg_target_entry = makeTargetEntry((Expr *)aggref, num_labels + i + 1, NULL, false);
+    TargetEntry *agg_target_entry = makeTargetEntry((Expr *)aggref, *num_labels + i + 1, NULL, false);
     TargetEntry *orig_target_entry = tlist_member((Expr *)aggref, orig_agg_tlist);
 
     if (orig_target_entry != NULL)
@@ -620,6 +1623,7 @@ typedef struct RewriteProjectionContext
 {
   List *flat_agg_tlist;
   int num_labels;
+  Plan *agg_plan;
 } RewriteProjectionContext;
 
 /*
@@ -649,13 +1653,21 @@ static Node *rewrite_projection_mutator(Node *node, RewriteProjectionContext *co
     int32 final_typmod;
     Oid final_collid;
 
-    ArgsDescriptor *args_desc = build_args_desc(aggref);
+    ArgsDescriptor *args_desc = build_args_desc(find_partial_aggref(context->agg_plan, aggref));
     agg_funcs->final_type(args_desc, &final_type, &final_typmod, &final_collid);
     pfree(args_desc);
 
     return (Node *)makeVar(INDEX_VAR, agg_tle->resno, final_type, final_typmod, final_collid, 0);
   }
 
+  if (IsA(node, GroupingFunc))
+  {
+    /* Results of GROUPING() are exported by Agg as labels. */
+    TargetEntry *grouping_tle = tlist_member((Expr *)node, context->flat_agg_tlist);
+    Assert(grouping_tle != NULL);
+    return (Node *)makeVarFromTargetEntry(INDEX_VAR, grouping_tle);
+  }
+
   if (IsA(node, Var))
   {
     Var *var = (Var *)node;
@@ -728,7 +1740,7 @@ static int find_agg_index(List *tlist, Oid fnoid)
  * except for anonymized aggregates, which are finalized at this stage.
  * Anonymized aggregates of Agg are updated to have AnonAggState return type.
  */
-static List *make_scan_tlist(List *flat_agg_tlist, int num_labels, int num_aggs)
+static List *make_scan_tlist(Plan *agg_plan, List *flat_agg_tlist, int num_labels, int num_aggs)
 {
   int num_atts = num_labels + num_aggs;
   List *scan_tlist = NIL;
@@ -745,7 +1757,7 @@ static List *make_scan_tlist(List *flat_agg_tlist, int num_labels, int num_aggs)
       if (agg_funcs != NULL)
       {
         /* In index slot's entry we store final type. */
-        ArgsDescriptor *args_desc = build_args_desc(aggref);
+        ArgsDescriptor *args_desc = build_args_desc(find_partial_aggref(agg_plan, aggref));
         agg_funcs->final_type(args_desc, &var->vartype, &var->vartypmod, &var->varcollid);
         pfree(args_desc);
 
@@ -778,12 +1790,13 @@ Plan *make_bucket_scan(Plan *left_tree, AnonymizationContext *anon_context)
   bucket_scan->custom_private = list_make1(plan_data);
   plan_data->extensible.extnodename = BUCKET_SCAN_DATA_NAME;
   plan_data->anon_context = *anon_context; /* Copy by value to avoid managing another custom node. */
-  int num_labels = plan_data->num_labels = anon_context->grouping_cols_count;
 
   /* Lift projection and qual up. */
   Agg *agg = (Agg *)left_tree;
-  List *flat_agg_tlist = flatten_agg_tlist(agg, anon_context->grouping_cols, anon_context->grouping_cols_count);
-  RewriteProjectionContext context = {flat_agg_tlist, num_labels};
+  int num_labels;
+  List *flat_agg_tlist = flatten_agg_tlist(agg, anon_context, &num_labels);
+  plan_data->num_labels = num_labels;
+  RewriteProjectionContext context = {flat_agg_tlist, num_labels, left_tree};
   plan->targetlist = project_agg_tlist(agg->plan.targetlist, &context);
   plan->qual = project_agg_qual(agg->plan.qual, &context);
   outerPlan(plan) = left_tree;
@@ -794,12 +1807,16 @@ Plan *make_bucket_scan(Plan *left_tree, AnonymizationContext *anon_context)
   int num_aggs = plan_data->num_aggs = list_length(flat_agg_tlist) - num_labels;
   plan_data->low_count_index = find_agg_index(flat_agg_tlist, g_oid_cache.low_count);
   plan_data->count_star_index = find_agg_index(flat_agg_tlist, g_oid_cache.anon_count_star);
-  bucket_scan->custom_scan_tlist = make_scan_tlist(flat_agg_tlist, num_labels, num_aggs);
+  bucket_scan->custom_scan_tlist = make_scan_tlist(left_tree, flat_agg_tlist, num_labels, num_aggs);
+  /* Buckets of different grouping sets are interleaved, so they can't be processed while streaming. */
+  int num_grouping_cols = anon_context->grouping_cols_count;
+  plan_data->streaming = anon_context->num_grouping_sets == 0 &&
+                         !needs_cross_bucket_hooks(plan_data->low_count_index, num_grouping_cols);
 
   if (anon_context->expand_buckets && plan_data->count_star_index == -1)
     FAILWITH("Cannot expand buckets with no anonymized COUNT(*) in scope.");
 
-  /* Estimate cost. */
+  /* Estimate cost. The work of anonymizing aggregates, finalization included, is charged to the Agg paths (see costs.c). */
   double rows = left_tree->plan_rows;
   Cost gather_cost = rows * cpu_tuple_cost;
   Cost led_cost = 0;
@@ -808,10 +1825,11 @@ Plan *make_bucket_scan(Plan *left_tree, AnonymizationContext *anon_context)
 
   if (plan_data->low_count_index != -1)
   {
-    if (num_labels > 2)
+    if (num_grouping_cols > 2)
     {
-      Cost led_table_cost = num_labels * rows * cpu_tuple_cost;
-      Cost led_loop_cost = rows * cpu_tuple_cost;
+      /* Every bucket is inserted in one table per label, hashing all other labels. */
+      Cost led_table_cost = num_grouping_cols * rows * (cpu_tuple_cost + num_grouping_cols * cpu_operator_cost);
+      Cost led_loop_cost = num_grouping_cols * rows * cpu_operator_cost;
       led_cost = led_table_cost + led_loop_cost;
     }
 
@@ -819,8 +1837,17 @@ Plan *make_bucket_scan(Plan *left_tree, AnonymizationContext *anon_context)
       star_bucket_cost = rows * cpu_tuple_cost;
   }
 
-  plan->startup_cost = left_tree->total_cost + gather_cost + led_cost + star_bucket_cost;
-  plan->total_cost = plan->startup_cost + finalization_cost;
+  if (plan_data->streaming)
+  {
+    /* Buckets are finalized one by one as the child produces them. */
+    plan->startup_cost = left_tree->startup_cost;
+    plan->total_cost = left_tree->total_cost + finalization_cost;
+  }
+  else
+  {
+    plan->startup_cost = left_tree->total_cost + gather_cost + led_cost + star_bucket_cost;
+    plan->total_cost = plan->startup_cost + finalization_cost;
+  }
   plan->plan_rows = left_tree->plan_rows;
   plan->plan_width = left_tree->plan_width;
 
@@ -863,6 +1890,16 @@ bool is_bucket_scan(Plan *plan)
       appendStringInfo(str, " %d", node->fldname[i]);           \
   } while (0)
 
+#define WRITE_INT_ARRAY(fldname, len) WRITE_ATTRNUMBER_ARRAY(fldname, len)
+
+#define WRITE_SEED_ARRAY(fldname, len)                                 \
+  do                                                                   \
+  {                                                                    \
+    appendStringInfoString(str, " :" CppAsString(fldname) " ");        \
+    for (int i = 0; i < len; i++)                                      \
+      appendStringInfo(str, " %" INT64_MODIFIER "x", node->fldname[i]); \
+  } while (0)
+
 #define booltostr(x) ((x) ? "true" : "false")
 
 #define COPY_SCALAR_FIELD(fldname) \
@@ -891,12 +1928,23 @@ static void bucket_scan_data_copy(ExtensibleNode *dst_node, const ExtensibleNode
   COPY_SCALAR_FIELD(num_aggs);
   COPY_SCALAR_FIELD(low_count_index);
   COPY_SCALAR_FIELD(count_star_index);
+  COPY_SCALAR_FIELD(streaming);
 
   int grouping_cols_size = sizeof(src->anon_context.grouping_cols[0]) * src->anon_context.grouping_cols_count;
   COPY_POINTER_FIELD(anon_context.grouping_cols, grouping_cols_size);
   COPY_SCALAR_FIELD(anon_context.grouping_cols_count);
   COPY_SCALAR_FIELD(anon_context.sql_seed);
+  dst->anon_context.base_labels_hash_set = list_copy(src->anon_context.base_labels_hash_set);
   COPY_SCALAR_FIELD(anon_context.expand_buckets);
+
+  int num_grouping_sets = src->anon_context.num_grouping_sets;
+  COPY_SCALAR_FIELD(anon_context.num_grouping_sets);
+  COPY_POINTER_FIELD(anon_context.grouping_set_ids, sizeof(int) * num_grouping_sets);
+  COPY_POINTER_FIELD(anon_context.grouping_set_seeds, sizeof(seed_t) * num_grouping_sets);
+  COPY_SCALAR_FIELD(anon_context.grouping_id_col);
+  COPY_NODE_FIELD(anon_context.seed_materials);
+  COPY_NODE_FIELD(anon_context.param_labels);
+  COPY_NODE_FIELD(anon_context.param_bucket_exprs);
 }
 
 static bool bucket_scan_data_equal(const ExtensibleNode *a, const ExtensibleNode *b)
@@ -913,10 +1961,17 @@ static void bucket_scan_data_out(struct StringInfoData *str, const ExtensibleNod
   WRITE_INT_FIELD(num_aggs);
   WRITE_INT_FIELD(low_count_index);
   WRITE_INT_FIELD(count_star_index);
+  WRITE_BOOL_FIELD(streaming);
 
   WRITE_SEED_FIELD(anon_context.sql_seed);
   WRITE_ATTRNUMBER_ARRAY(anon_context.grouping_cols, node->anon_context.grouping_cols_count);
   WRITE_BOOL_FIELD(anon_context.expand_buckets);
+  WRITE_INT_ARRAY(anon_context.grouping_set_ids, node->anon_context.num_grouping_sets);
+  WRITE_SEED_ARRAY(anon_context.grouping_set_seeds, node->anon_context.num_grouping_sets);
+  WRITE_INT_FIELD(anon_context.grouping_id_col);
+  WRITE_NODE_FIELD(anon_context.seed_materials);
+  WRITE_NODE_FIELD(anon_context.param_labels);
+  WRITE_NODE_FIELD(anon_context.param_bucket_exprs);
 }
 
 static void bucket_scan_data_read(ExtensibleNode *node)
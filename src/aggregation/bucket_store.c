@@ -0,0 +1,306 @@
+#include "postgres.h"
+
+#include "libpq/pqformat.h"
+#include "utils/datum.h"
+#include "utils/memutils.h"
+
+#include "pg_diffix/aggregation/bucket_store.h"
+#include "pg_diffix/utils.h"
+
+/*
+ * Record layout in memory: | Bucket | values[num_atts] | is_null[num_atts] | padding |
+ *
+ * Record layout on disk: | size | flags | labels and other values | states |
+ * Values other than states are written with `datumSerialize`, in attribute order.
+ * States are written last by the serialize functions of their aggregators.
+ */
+
+#define SPILLED_LOW_COUNT 0x01
+#define SPILLED_MERGED 0x02
+
+static inline Size values_offset(void)
+{
+  return MAXALIGN(sizeof(Bucket));
+}
+
+static inline Size is_null_offset(int num_atts)
+{
+  return values_offset() + num_atts * sizeof(Datum);
+}
+
+/* Only the owners of shared states are spilled, redirected attributes are written as values. */
+static inline bool owns_agg_state(BucketDescriptor *bucket_desc, int index)
+{
+  BucketAttribute *att = &bucket_desc->attrs[index];
+  return att->tag == BUCKET_ANON_AGG && att->agg.redirect_to == index;
+}
+
+BucketStore *create_bucket_store(MemoryContext memory_context, MemoryContext chunk_context,
+                                 BucketDescriptor *bucket_desc)
+{
+  int num_atts = bucket_num_atts(bucket_desc);
+  BucketStore *store = MemoryContextAllocZero(memory_context, sizeof(BucketStore));
+  store->memory_context = memory_context;
+  store->chunk_context = chunk_context;
+  store->bucket_desc = bucket_desc;
+  store->record_size = MAXALIGN(is_null_offset(num_atts) + num_atts * sizeof(bool));
+  store->max_chunks = 16;
+  store->chunks = MemoryContextAlloc(chunk_context, store->max_chunks * sizeof(char *));
+  return store;
+}
+
+void destroy_bucket_store(BucketStore *store)
+{
+  /* Closing a temporary file deletes it. */
+  if (store->spill_file != NULL)
+  {
+    BufFileClose(store->spill_file);
+    store->spill_file = NULL;
+  }
+
+  if (store->rewrite_file != NULL)
+  {
+    BufFileClose(store->rewrite_file);
+    store->rewrite_file = NULL;
+  }
+}
+
+static void add_chunk(BucketStore *store)
+{
+  if (store->num_chunks == store->max_chunks)
+  {
+    store->max_chunks *= 2;
+    store->chunks = repalloc(store->chunks, store->max_chunks * sizeof(char *));
+  }
+
+  store->chunks[store->num_chunks++] = MemoryContextAllocHuge(
+      store->chunk_context,
+      BUCKET_STORE_CHUNK_SIZE * store->record_size);
+}
+
+Bucket *bucket_store_append(BucketStore *store)
+{
+  Assert(!bucket_store_spilled(store));
+
+  if (store->num_buckets == store->num_chunks * BUCKET_STORE_CHUNK_SIZE)
+    add_chunk(store);
+
+  Bucket *bucket = bucket_store_get(store, store->num_buckets++);
+  memset(bucket, 0, store->record_size);
+  bucket->values = (Datum *)((char *)bucket + values_offset());
+  bucket->is_null = (bool *)((char *)bucket + is_null_offset(bucket_num_atts(store->bucket_desc)));
+  return bucket;
+}
+
+void serialize_bucket_states(Bucket *bucket, BucketDescriptor *bucket_desc, StringInfo buf)
+{
+  int num_atts = bucket_num_atts(bucket_desc);
+  for (int i = bucket_desc->num_labels; i < num_atts; i++)
+  {
+    if (owns_agg_state(bucket_desc, i))
+    {
+      AnonAggState *state = (AnonAggState *)DatumGetPointer(bucket->values[i]);
+      Assert(state != NULL);
+      state->agg_funcs->serialize(state, buf);
+    }
+  }
+}
+
+void deserialize_bucket_states(Bucket *bucket, BucketDescriptor *bucket_desc, StringInfo buf,
+                               MemoryContext context)
+{
+  MemoryContext old_context = MemoryContextSwitchTo(context);
+
+  int num_atts = bucket_num_atts(bucket_desc);
+  for (int i = bucket_desc->num_labels; i < num_atts; i++)
+  {
+    if (owns_agg_state(bucket_desc, i))
+    {
+      BucketAttribute *att = &bucket_desc->attrs[i];
+      AnonAggState *state = create_anon_agg_state(att->agg.funcs, context, att->agg.args_desc);
+      att->agg.funcs->deserialize(state, buf);
+      bucket->values[i] = PointerGetDatum(state);
+      bucket->is_null[i] = false;
+    }
+  }
+
+  MemoryContextSwitchTo(old_context);
+}
+
+static void append_value(StringInfo buf, Datum value, bool is_null, BucketAttribute *att)
+{
+  Size size = datumEstimateSpace(value, is_null, att->typ_byval, att->typ_len);
+  enlargeStringInfo(buf, size);
+
+  char *start_address = buf->data + buf->len;
+  datumSerialize(value, is_null, att->typ_byval, att->typ_len, &start_address);
+  buf->len += size;
+  buf->data[buf->len] = '\0';
+}
+
+/*
+ * Writes the bucket to the end of the given file and returns the size of its serialized labels.
+ */
+static Size write_record(BucketStore *store, BufFile *file, Bucket *bucket)
+{
+  BucketDescriptor *bucket_desc = store->bucket_desc;
+  int num_labels = bucket_desc->num_labels;
+  int num_atts = bucket_num_atts(bucket_desc);
+
+  StringInfo buf = &store->write_buf;
+  resetStringInfo(buf);
+
+  appendStringInfoChar(buf, (bucket->low_count ? SPILLED_LOW_COUNT : 0) | (bucket->merged ? SPILLED_MERGED : 0));
+
+  for (int i = 0; i < num_labels; i++)
+    append_value(buf, bucket->values[i], bucket->is_null[i], &bucket_desc->attrs[i]);
+
+  Size label_size = buf->len - 1;
+
+  for (int i = num_labels; i < num_atts; i++)
+  {
+    if (!owns_agg_state(bucket_desc, i))
+      append_value(buf, bucket->values[i], bucket->is_null[i], &bucket_desc->attrs[i]);
+  }
+
+  serialize_bucket_states(bucket, bucket_desc, buf);
+
+  uint32 size = buf->len;
+  BufFileWrite(file, &size, sizeof(size));
+  BufFileWrite(file, buf->data, buf->len);
+
+  return label_size;
+}
+
+void bucket_store_spill(BucketStore *store)
+{
+  Assert(!bucket_store_spilled(store));
+
+  MemoryContext old_context = MemoryContextSwitchTo(store->memory_context);
+  BufFile *spill_file = BufFileCreateTemp(false);
+  initStringInfo(&store->read_buf);
+  initStringInfo(&store->write_buf);
+  store->read_context = AllocSetContextCreate(store->memory_context, "BucketStore read context", ALLOCSET_DEFAULT_SIZES);
+  MemoryContextSwitchTo(old_context);
+
+  for (int i = 0; i < store->num_buckets; i++)
+    store->label_size += write_record(store, spill_file, bucket_store_get(store, i));
+
+  /* From now on buckets live only on disk. Chunks go away with the chunk context. */
+  store->spill_file = spill_file;
+  store->chunks = NULL;
+  store->num_chunks = 0;
+  store->max_chunks = 0;
+}
+
+void bucket_store_write(BucketStore *store, Bucket *bucket)
+{
+  Assert(bucket_store_spilled(store));
+  Assert(store->rewrite_file == NULL);
+
+  /* Buckets are written only while gathering, when the file is never read, so its position is at the end. */
+  store->label_size += write_record(store, store->spill_file, bucket);
+  store->num_buckets++;
+}
+
+void bucket_store_rewind(BucketStore *store)
+{
+  store->read_position = 0;
+  store->read_bucket = NULL;
+
+  if (bucket_store_spilled(store) && BufFileSeek(store->spill_file, 0, 0, SEEK_SET) != 0)
+    FAILWITH("Could not seek in bucket spill file.");
+}
+
+Bucket *bucket_store_next(BucketStore *store)
+{
+  if (store->read_position >= store->num_buckets)
+    return NULL;
+
+  if (!bucket_store_spilled(store))
+    return bucket_store_get(store, store->read_position++);
+
+  store->read_position++;
+
+  /* Releases the previous bucket. */
+  MemoryContextReset(store->read_context);
+
+  StringInfo buf = &store->read_buf;
+  uint32 size;
+  if (BufFileRead(store->spill_file, &size, sizeof(size)) != sizeof(size))
+    FAILWITH("Could not read from bucket spill file.");
+
+  resetStringInfo(buf);
+  enlargeStringInfo(buf, size);
+  if (BufFileRead(store->spill_file, buf->data, size) != size)
+    FAILWITH("Could not read from bucket spill file.");
+  buf->len = size;
+
+  BucketDescriptor *bucket_desc = store->bucket_desc;
+  int num_atts = bucket_num_atts(bucket_desc);
+
+  MemoryContext old_context = MemoryContextSwitchTo(store->read_context);
+
+  Bucket *bucket = palloc0(sizeof(Bucket));
+  bucket->values = palloc0(num_atts * sizeof(Datum));
+  bucket->is_null = palloc0(num_atts * sizeof(bool));
+
+  int flags = pq_getmsgbyte(buf);
+  bucket->low_count = (flags & SPILLED_LOW_COUNT) != 0;
+  bucket->merged = (flags & SPILLED_MERGED) != 0;
+
+  for (int i = 0; i < num_atts; i++)
+  {
+    if (owns_agg_state(bucket_desc, i))
+      continue; /* States are restored on demand. */
+
+    char *start_address = buf->data + buf->cursor;
+    bucket->values[i] = datumRestore(&start_address, &bucket->is_null[i]);
+    buf->cursor = start_address - buf->data;
+  }
+
+  MemoryContextSwitchTo(old_context);
+
+  store->read_bucket = bucket;
+  return bucket;
+}
+
+void bucket_store_load_states(BucketStore *store, Bucket *bucket)
+{
+  if (!bucket_store_spilled(store))
+    return;
+
+  Assert(bucket == store->read_bucket);
+  deserialize_bucket_states(bucket, store->bucket_desc, &store->read_buf, store->read_context);
+  pq_getmsgend(&store->read_buf);
+}
+
+void bucket_store_begin_rewrite(BucketStore *store)
+{
+  Assert(bucket_store_spilled(store));
+  Assert(store->rewrite_file == NULL);
+
+  MemoryContext old_context = MemoryContextSwitchTo(store->memory_context);
+  store->rewrite_file = BufFileCreateTemp(false);
+  MemoryContextSwitchTo(old_context);
+
+  bucket_store_rewind(store);
+}
+
+void bucket_store_rewrite(BucketStore *store, Bucket *bucket)
+{
+  Assert(store->rewrite_file != NULL);
+  write_record(store, store->rewrite_file, bucket);
+}
+
+void bucket_store_end_rewrite(BucketStore *store)
+{
+  Assert(store->rewrite_file != NULL);
+
+  /* Closing a temporary file deletes it, so the space of the old records is released. */
+  BufFileClose(store->spill_file);
+  store->spill_file = store->rewrite_file;
+  store->rewrite_file = NULL;
+
+  bucket_store_rewind(store);
+}
@@ -3,6 +3,8 @@
 #include <math.h>
 
 #include "fmgr.h"
+#include "libpq/pqformat.h"
+#include "nodes/execnodes.h"
 #include "nodes/nodeFuncs.h"
 #include "nodes/primnodes.h"
 #include "utils/lsyscache.h"
@@ -16,13 +18,16 @@
 #define PG_RETURN_AGG_STATE(state) PG_RETURN_POINTER(state)
 
 /* Functions declared in bucket_scan.c. Depend on global state and should not be public API. */
-extern MemoryContext get_current_bucket_context(void);
-extern bool aggref_shares_state(Aggref *aggref);
+extern MemoryContext get_current_bucket_context(const AnonAggFuncs *agg_funcs);
+extern BucketDescriptor *get_current_bucket_descriptor(void);
 
 PGDLLEXPORT PG_FUNCTION_INFO_V1(anon_agg_state_input);
 PGDLLEXPORT PG_FUNCTION_INFO_V1(anon_agg_state_output);
 PGDLLEXPORT PG_FUNCTION_INFO_V1(anon_agg_state_transfn);
 PGDLLEXPORT PG_FUNCTION_INFO_V1(anon_agg_state_finalfn);
+PGDLLEXPORT PG_FUNCTION_INFO_V1(anon_agg_state_combinefn);
+PGDLLEXPORT PG_FUNCTION_INFO_V1(anon_agg_state_serialfn);
+PGDLLEXPORT PG_FUNCTION_INFO_V1(anon_agg_state_deserialfn);
 
 ArgsDescriptor *build_args_desc(Aggref *aggref)
 {
@@ -49,6 +54,36 @@ ArgsDescriptor *build_args_desc(Aggref *aggref)
   return args_desc;
 }
 
+Aggref *find_partial_aggref(Plan *agg_plan, Aggref *aggref)
+{
+  if (!DO_AGGSPLIT_COMBINE(aggref->aggsplit))
+    return aggref;
+
+  /* The partial state is passed up through intermediate nodes (Gather, Sort) as an OUTER_VAR. */
+  Plan *plan = agg_plan;
+  Expr *expr = linitial_node(TargetEntry, aggref->args)->expr;
+  while (IsA(expr, Var) && ((Var *)expr)->varno == OUTER_VAR)
+  {
+    plan = outerPlan(plan);
+
+    /* Children of an Append have identical target lists, any of them will do. */
+    if (plan != NULL && IsA(plan, Append))
+      plan = linitial(((Append *)plan)->appendplans);
+    else if (plan != NULL && IsA(plan, MergeAppend))
+      plan = linitial(((MergeAppend *)plan)->mergeplans);
+
+    if (plan == NULL)
+      break;
+
+    expr = list_nth_node(TargetEntry, plan->targetlist, ((Var *)expr)->varattno - 1)->expr;
+  }
+
+  if (!IsA(expr, Aggref) || ((Aggref *)expr)->aggfnoid != aggref->aggfnoid)
+    FAILWITH("Could not find partial aggregate for aggregate (OID %u).", aggref->aggfnoid);
+
+  return (Aggref *)expr;
+}
+
 const AnonAggFuncs *find_agg_funcs(Oid oid)
 {
   if (!OidIsValid(oid))
@@ -110,6 +145,83 @@ void merge_bucket(Bucket *destination, Bucket *source, BucketDescriptor *bucket_
   }
 }
 
+/*
+ * Per-aggregate data which stays the same for every group of an Agg node.
+ * It is cached in `fn_extra` of the transition and combine functions, so that
+ * creating the state of a new group needs no catalog lookups.
+ */
+typedef struct AnonAggCallInfo
+{
+  Aggref *aggref;                /* Aggregate being evaluated */
+  const AnonAggFuncs *agg_funcs; /* Aggregator implementation */
+  ArgsDescriptor *args_desc;     /* Original arguments, looking through combining aggregates of a Finalize Agg */
+  BucketDescriptor *bucket_desc; /* Bucket descriptor for which `shares_state` was determined */
+  bool shares_state;             /* Does another aggregate in the bucket own the state? */
+} AnonAggCallInfo;
+
+static AnonAggCallInfo *get_call_info(PG_FUNCTION_ARGS)
+{
+  Aggref *aggref = AggGetAggref(fcinfo);
+  AnonAggCallInfo *call_info = (AnonAggCallInfo *)fcinfo->flinfo->fn_extra;
+
+  if (likely(call_info != NULL && call_info->aggref == aggref))
+    return call_info;
+
+  const AnonAggFuncs *agg_funcs = find_agg_funcs(aggref->aggfnoid);
+
+  if (unlikely(agg_funcs == NULL))
+    FAILWITH("Unsupported anonymizing aggregator (OID %u)", aggref->aggfnoid);
+
+  Plan *agg_plan = ((AggState *)fcinfo->context)->ss.ps.plan;
+  MemoryContext old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+
+  if (call_info == NULL)
+    call_info = palloc(sizeof(AnonAggCallInfo));
+  else
+    pfree(call_info->args_desc);
+
+  call_info->aggref = aggref;
+  call_info->agg_funcs = agg_funcs;
+  call_info->args_desc = build_args_desc(find_partial_aggref(agg_plan, aggref));
+  call_info->bucket_desc = NULL;
+  call_info->shares_state = false;
+
+  MemoryContextSwitchTo(old_context);
+
+  fcinfo->flinfo->fn_extra = call_info;
+  return call_info;
+}
+
+/* Returns true if another aggregate in the current bucket does identical transitions. */
+static bool shares_state(AnonAggCallInfo *call_info)
+{
+  BucketDescriptor *bucket_desc = get_current_bucket_descriptor();
+  if (bucket_desc == NULL)
+    return false;
+
+  if (call_info->bucket_desc != bucket_desc)
+  {
+    call_info->bucket_desc = bucket_desc;
+    call_info->shares_state = false;
+
+    int num_atts = bucket_num_atts(bucket_desc);
+    for (int i = bucket_desc->num_labels; i < num_atts; i++)
+    {
+      BucketAttribute *att = &bucket_desc->attrs[i];
+      /* We use reference comparison to pinpoint exact position of aggregate. */
+      if (att->agg.aggref == call_info->aggref)
+      {
+        call_info->shares_state = i != att->agg.redirect_to;
+        break;
+      }
+    }
+
+    /* If not found, we can't guarantee that the Aggref was not copied somewhere, and don't share. */
+  }
+
+  return call_info->shares_state;
+}
+
 static AnonAggState *get_agg_state(PG_FUNCTION_ARGS)
 {
   if (!PG_ARGISNULL(0))
@@ -119,22 +231,27 @@ static AnonAggState *get_agg_state(PG_FUNCTION_ARGS)
   if (AggCheckCallContext(fcinfo, &bucket_context) != AGG_CONTEXT_AGGREGATE)
     FAILWITH("Aggregate called in non-aggregate context");
 
-  Aggref *aggref = AggGetAggref(fcinfo);
+  /* Parallel workers do not go through the planner hook. */
+  oid_cache_init();
 
-  if (get_current_bucket_context() != NULL)
+  AnonAggCallInfo *call_info = get_call_info(fcinfo);
+
+  /*
+   * Partial states are serialized and combined by a Finalize Agg, so they never reach the BucketScan.
+   * This also applies to partial aggregation done by the leader process below an active BucketScan.
+   */
+  if (!DO_AGGSPLIT_SKIPFINAL(call_info->aggref->aggsplit))
   {
-    if (aggref_shares_state(aggref))
+    if (shares_state(call_info))
       return AGG_STATE_REDIRECTED;
 
-    bucket_context = get_current_bucket_context();
+    /* A streaming BucketScan has no bucket context, states live in the Agg's memory instead. */
+    MemoryContext current_bucket_context = get_current_bucket_context(call_info->agg_funcs);
+    if (current_bucket_context != NULL)
+      bucket_context = current_bucket_context;
   }
 
-  const AnonAggFuncs *agg_funcs = find_agg_funcs(aggref->aggfnoid);
-
-  if (unlikely(agg_funcs == NULL))
-    FAILWITH("Unsupported anonymizing aggregator (OID %u)", aggref->aggfnoid);
-
-  return create_anon_agg_state(agg_funcs, bucket_context, build_args_desc(aggref));
+  return create_anon_agg_state(call_info->agg_funcs, bucket_context, call_info->args_desc);
 }
 
 Datum anon_agg_state_input(PG_FUNCTION_ARGS)
@@ -170,6 +287,51 @@ Datum anon_agg_state_finalfn(PG_FUNCTION_ARGS)
   PG_RETURN_AGG_STATE(state);
 }
 
+Datum anon_agg_state_combinefn(PG_FUNCTION_ARGS)
+{
+  AnonAggState *state = get_agg_state(fcinfo);
+
+  /* AGG_STATE_REDIRECTED means the owning aggregator will handle merging. */
+  if (state != AGG_STATE_REDIRECTED && !PG_ARGISNULL(1))
+  {
+    bytea *serialized = (bytea *)PG_GETARG_POINTER(1);
+
+    StringInfoData buf;
+    initStringInfo(&buf);
+    appendBinaryStringInfo(&buf, VARDATA_ANY(serialized), VARSIZE_ANY_EXHDR(serialized));
+
+    /* Source state lives in the per-tuple memory context and is discarded after merging. */
+    ArgsDescriptor *args_desc = get_call_info(fcinfo)->args_desc;
+    AnonAggState *src_state = create_anon_agg_state(state->agg_funcs, CurrentMemoryContext, args_desc);
+    state->agg_funcs->deserialize(src_state, &buf);
+    pq_getmsgend(&buf);
+
+    state->agg_funcs->merge(state, src_state);
+  }
+
+  PG_RETURN_AGG_STATE(state);
+}
+
+Datum anon_agg_state_serialfn(PG_FUNCTION_ARGS)
+{
+  AnonAggState *state = PG_GET_AGG_STATE(0);
+  Assert(state != AGG_STATE_REDIRECTED); /* Partial aggregation never redirects state. */
+
+  StringInfoData buf;
+  pq_begintypsend(&buf);
+  state->agg_funcs->serialize(state, &buf);
+  PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * Creating a state requires the argument types of the aggregate, which are only known
+ * when the combine function is called. We pass the serialized state through and decode it there.
+ */
+Datum anon_agg_state_deserialfn(PG_FUNCTION_ARGS)
+{
+  PG_RETURN_POINTER(PG_GETARG_BYTEA_PP(0));
+}
+
 bool all_aids_null(NullableDatum *args, int aids_offset, int aids_count)
 {
   for (int aid_index = aids_offset; aid_index < aids_offset + aids_count; aid_index++)
@@ -1,5 +1,7 @@
 #include "postgres.h"
 
+#include "libpq/pqformat.h"
+
 #include "pg_diffix/aggregation/contribution_tracker.h"
 #include "pg_diffix/config.h"
 #include "pg_diffix/utils.h"
@@ -186,3 +188,31 @@ void contribution_tracker_update_contribution(
         entry->contributor);
   }
 }
+
+/* Contributions are sent as raw 64 bits, regardless of their type. */
+
+void contribution_tracker_serialize(const ContributionTrackerState *state, StringInfo buf)
+{
+  pq_sendint64(buf, state->unaccounted_for.integer);
+  pq_sendint32(buf, state->contribution_table->members);
+
+  ContributionTrackerHashEntry *entry;
+  foreach_entry(entry, state->contribution_table, ContributionTracker)
+  {
+    pq_sendint64(buf, entry->contributor.aid);
+    pq_sendint64(buf, entry->contributor.contribution.integer);
+  }
+}
+
+void contribution_tracker_deserialize(ContributionTrackerState *state, StringInfo buf)
+{
+  state->unaccounted_for.integer = pq_getmsgint64(buf);
+  uint32 num_contributors = pq_getmsgint(buf, sizeof(uint32));
+
+  for (uint32 i = 0; i < num_contributors; i++)
+  {
+    aid_t aid = (aid_t)pq_getmsgint64(buf);
+    contribution_t contribution = {.integer = pq_getmsgint64(buf)};
+    contribution_tracker_update_contribution(state, aid, contribution);
+  }
+}
@@ -26,6 +26,8 @@ int64 finalize_count_result(const SummableResultAccumulator *accumulator)
 typedef struct CountState
 {
   AnonAggState base;
+  bool has_final_result;                  /* Is `final_result` valid? Cleared when the state changes */
+  SummableResultAccumulator final_result; /* Memoized result, shared by count and its noise */
   int trackers_count;
   ContributionTrackerState *trackers[FLEXIBLE_ARRAY_MEMBER];
 } CountState;
@@ -57,6 +59,9 @@ static AnonAggState *count_create_state(MemoryContext memory_context, ArgsDescri
 static SummableResultAccumulator count_calculate_final(AnonAggState *base_state, Bucket *bucket, BucketDescriptor *bucket_desc)
 {
   CountState *state = (CountState *)base_state;
+  if (state->has_final_result)
+    return state->final_result;
+
   SummableResultAccumulator result_accumulator = {0};
   seed_t bucket_seed = compute_bucket_seed(bucket, bucket_desc);
 
@@ -68,6 +73,9 @@ static SummableResultAccumulator count_calculate_final(AnonAggState *base_state,
     if (result_accumulator.not_enough_aid_values)
       break;
   }
+
+  state->final_result = result_accumulator;
+  state->has_final_result = true;
   return result_accumulator;
 }
 
@@ -86,9 +94,25 @@ static void count_merge(AnonAggState *dst_base_state, const AnonAggState *src_ba
 {
   CountState *dst_state = (CountState *)dst_base_state;
   const CountState *src_state = (const CountState *)src_base_state;
+  dst_state->has_final_result = false;
   merge_trackers(dst_state->trackers_count, src_state->trackers_count, dst_state->trackers, src_state->trackers);
 }
 
+static void count_serialize(const AnonAggState *base_state, StringInfo buf)
+{
+  const CountState *state = (const CountState *)base_state;
+  for (int i = 0; i < state->trackers_count; i++)
+    contribution_tracker_serialize(state->trackers[i], buf);
+}
+
+static void count_deserialize(AnonAggState *base_state, StringInfo buf)
+{
+  CountState *state = (CountState *)base_state;
+  state->has_final_result = false;
+  for (int i = 0; i < state->trackers_count; i++)
+    contribution_tracker_deserialize(state->trackers[i], buf);
+}
+
 static const int COUNT_VALUE_INDEX = 1;
 static const int COUNT_VALUE_AIDS_OFFSET = 2;
 
@@ -100,6 +124,7 @@ static AnonAggState *count_value_create_state(MemoryContext memory_context, Args
 static void count_value_transition(AnonAggState *base_state, int num_args, NullableDatum *args)
 {
   CountState *state = (CountState *)base_state;
+  state->has_final_result = false;
 
   if (all_aids_null(args, COUNT_VALUE_AIDS_OFFSET, state->trackers_count))
     return;
@@ -135,6 +160,8 @@ const AnonAggFuncs g_count_value_funcs = {
     .transition = count_value_transition,
     .finalize = count_finalize,
     .merge = count_merge,
+    .serialize = count_serialize,
+    .deserialize = count_deserialize,
     .explain = count_value_explain,
 };
 
@@ -148,6 +175,7 @@ static AnonAggState *count_star_create_state(MemoryContext memory_context, ArgsD
 static void count_star_transition(AnonAggState *base_state, int num_args, NullableDatum *args)
 {
   CountState *state = (CountState *)base_state;
+  state->has_final_result = false;
 
   if (all_aids_null(args, COUNT_STAR_AIDS_OFFSET, state->trackers_count))
     return;
@@ -179,6 +207,8 @@ const AnonAggFuncs g_count_star_funcs = {
     .transition = count_star_transition,
     .finalize = count_finalize,
     .merge = count_merge,
+    .serialize = count_serialize,
+    .deserialize = count_deserialize,
     .explain = count_star_explain,
 };
 
@@ -219,6 +249,8 @@ const AnonAggFuncs g_count_value_noise_funcs = {
     .transition = count_value_transition,
     .finalize = count_noise_finalize,
     .merge = count_merge,
+    .serialize = count_serialize,
+    .deserialize = count_deserialize,
     .explain = count_value_noise_explain,
 };
 
@@ -228,5 +260,7 @@ const AnonAggFuncs g_count_star_noise_funcs = {
     .transition = count_star_transition,
     .finalize = count_noise_finalize,
     .merge = count_merge,
+    .serialize = count_serialize,
+    .deserialize = count_deserialize,
     .explain = count_noise_explain,
 };
@@ -1,10 +1,12 @@
 #include "postgres.h"
 
 #include "catalog/pg_type.h"
+#include "libpq/pqformat.h"
 #include "utils/builtins.h"
 #include "utils/typcache.h"
 
 #include "pg_diffix/aggregation/count.h"
+#include "pg_diffix/aggregation/interner.h"
 #include "pg_diffix/aggregation/summable.h"
 #include "pg_diffix/config.h"
 #include "pg_diffix/query/anonymization.h"
@@ -45,15 +47,21 @@ typedef struct DistinctTrackerData
 static const int VALUE_INDEX = 1;
 static const int AIDS_OFFSET = 2;
 
+/* Declared in bucket_scan.c. Depends on global state and should not be public API. */
+extern DatumInterner *get_current_bucket_interner(MemoryContext state_context);
+
 static DistinctTrackerHashEntry *
-get_distinct_tracker_entry(DistinctTracker_hash *tracker, Datum value, int aids_count)
+get_distinct_tracker_entry(DistinctTracker_hash *tracker, DatumInterner *interner, Datum value, int aids_count)
 {
   bool found;
   DistinctTrackerHashEntry *entry = DistinctTracker_insert(tracker, value, &found);
   if (!found)
   {
     entry->aid_values_sets = NIL;
-    entry->value = datumCopy(value, DATA(tracker)->typbyval, DATA(tracker)->typlen);
+    /* Inside a BucketScan, values repeated across buckets are stored only once. */
+    entry->value = interner != NULL
+                       ? intern_datum(interner, value, DATA(tracker)->typbyval, DATA(tracker)->typlen)
+                       : datumCopy(value, DATA(tracker)->typbyval, DATA(tracker)->typlen);
     for (int i = 0; i < aids_count; i++)
     {
       entry->aid_values_sets = lappend(entry->aid_values_sets, NIL);
@@ -246,7 +254,8 @@ typedef struct DatumSetEntry
 
 /*
  * Declarations for HashTable<Datum, DatumSetEntry>>
- * Since values held here are unique at this point, we can use simple pointer equality even for reference types.
+ * Since values held here are unique (and interned inside a BucketScan) at this point,
+ * we can use simple pointer equality even for reference types.
  */
 #define SH_PREFIX DatumSet
 #define SH_ELEMENT_TYPE DatumSetEntry
@@ -324,13 +333,6 @@ static void process_lc_values_contributions(List *per_aid_values,
   }
 }
 
-typedef struct CountDistinctState
-{
-  AnonAggState base;
-  ArgsDescriptor *args_desc;
-  DistinctTracker_hash *tracker;
-} CountDistinctState;
-
 typedef struct CountDistinctResult
 {
   int64 hc_values_count;
@@ -340,6 +342,19 @@ typedef struct CountDistinctResult
   bool not_enough_aid_values;
 } CountDistinctResult;
 
+typedef struct CountDistinctState
+{
+  AnonAggState base;
+  Oid value_type;                                /* Type of counted values */
+  int aids_count;                                /* Number of AID instances */
+  DistinctTracker_hash *tracker;                 /* Distinct values with their AID sets */
+  DistinctTrackerData tracker_data;              /* Private data of `tracker` */
+  DatumInterner *interner;                       /* Storage for distinct values, NULL outside of bucket memory */
+  bool has_final_result;                         /* Is `final_result` valid? Cleared when the state changes */
+  CountDistinctResult final_result;              /* Memoized result, shared by count distinct and its noise */
+  MapAidFunc aid_mappers[FLEXIBLE_ARRAY_MEMBER]; /* Resolved AID mappers, one for each AID instance */
+} CountDistinctState;
+
 /*
  * The number of high count values is safe to be shown directly, without any extra noise.
  * The number of low count values has to be anonymized.
@@ -347,11 +362,13 @@ typedef struct CountDistinctResult
 static CountDistinctResult count_distinct_calculate_final(AnonAggState *base_state, Bucket *bucket, BucketDescriptor *bucket_desc)
 {
   CountDistinctState *state = (CountDistinctState *)base_state;
+  if (state->has_final_result)
+    return state->final_result;
 
   seed_t bucket_seed = compute_bucket_seed(bucket, bucket_desc);
 
-  int aids_count = state->args_desc->num_args - AIDS_OFFSET;
-  set_value_sorting_globals(state->args_desc->args[VALUE_INDEX].type_oid);
+  int aids_count = state->aids_count;
+  set_value_sorting_globals(state->value_type);
 
   DistinctTracker_hash *tracker = state->tracker;
 
@@ -405,15 +422,10 @@ static CountDistinctResult count_distinct_calculate_final(AnonAggState *base_sta
   }
 
   result.not_enough_aid_values = lc_result_accumulator.not_enough_aid_values && result.hc_values_count == 0;
-  return result;
-}
 
-static ArgsDescriptor *copy_args_desc(const ArgsDescriptor *source)
-{
-  size_t args_desc_size = sizeof(ArgsDescriptor) + source->num_args * sizeof(ArgDescriptor);
-  ArgsDescriptor *dest = palloc(args_desc_size);
-  memcpy(dest, source, args_desc_size);
-  return dest;
+  state->final_result = result;
+  state->has_final_result = true;
+  return result;
 }
 
 /*-------------------------------------------------------------------------
@@ -432,14 +444,17 @@ static AnonAggState *count_distinct_create_state(MemoryContext memory_context, A
 {
   MemoryContext old_context = MemoryContextSwitchTo(memory_context);
 
-  CountDistinctState *state = palloc0(sizeof(CountDistinctState));
+  int aids_count = args_desc->num_args - AIDS_OFFSET;
+  CountDistinctState *state = palloc0(sizeof(CountDistinctState) + aids_count * sizeof(MapAidFunc));
+  state->value_type = args_desc->args[VALUE_INDEX].type_oid;
+  state->aids_count = aids_count;
+  state->tracker_data.typlen = args_desc->args[VALUE_INDEX].typlen;
+  state->tracker_data.typbyval = args_desc->args[VALUE_INDEX].typbyval;
+  state->tracker = DistinctTracker_create(memory_context, 4, &state->tracker_data);
+  state->interner = get_current_bucket_interner(memory_context);
 
-  DistinctTrackerData *data = palloc0(sizeof(DistinctTrackerData));
-  data->typlen = args_desc->args[VALUE_INDEX].typlen;
-  data->typbyval = args_desc->args[VALUE_INDEX].typbyval;
-
-  state->tracker = DistinctTracker_create(memory_context, 4, data);
-  state->args_desc = copy_args_desc(args_desc);
+  for (int i = 0; i < aids_count; i++)
+    state->aid_mappers[i] = get_aid_mapper(args_desc->args[i + AIDS_OFFSET].type_oid);
 
   MemoryContextSwitchTo(old_context);
   return &state->base;
@@ -458,21 +473,21 @@ static void count_distinct_merge(AnonAggState *dst_base_state, const AnonAggStat
   CountDistinctState *dst_state = (CountDistinctState *)dst_base_state;
   const CountDistinctState *src_state = (const CountDistinctState *)src_base_state;
 
-  Assert(dst_state->args_desc->num_args == src_state->args_desc->num_args);
-  Assert(0 == memcmp(dst_state->args_desc,
-                     src_state->args_desc,
-                     sizeof(ArgsDescriptor) + dst_state->args_desc->num_args * sizeof(ArgDescriptor)));
+  Assert(dst_state->aids_count == src_state->aids_count);
+  Assert(dst_state->value_type == src_state->value_type);
   Assert(DATA(dst_state->tracker)->typbyval == DATA(src_state->tracker)->typbyval);
   Assert(DATA(dst_state->tracker)->typlen == DATA(src_state->tracker)->typlen);
 
-  int aids_count = dst_state->args_desc->num_args - AIDS_OFFSET;
+  dst_state->has_final_result = false;
+
+  int aids_count = dst_state->aids_count;
   MemoryContext old_context = MemoryContextSwitchTo(dst_base_state->memory_context);
 
   DistinctTrackerHashEntry *src_entry;
   foreach_entry(src_entry, src_state->tracker, DistinctTracker)
   {
     DistinctTrackerHashEntry *dst_entry =
-        get_distinct_tracker_entry(dst_state->tracker, src_entry->value, aids_count);
+        get_distinct_tracker_entry(dst_state->tracker, dst_state->interner, src_entry->value, aids_count);
 
     ListCell *dst_cell = NULL;
     const ListCell *src_cell = NULL;
@@ -487,17 +502,105 @@ static void count_distinct_merge(AnonAggState *dst_base_state, const AnonAggStat
   MemoryContextSwitchTo(old_context);
 }
 
+/*
+ * Serialized layout: entry count (int32), followed by entries of (value, AID sets).
+ * By-value values are sent as int64, by-reference values as a size (int32) followed by raw bytes.
+ * Each AID set is sent as its length (int32) followed by the AID values (int64).
+ */
+static void count_distinct_serialize(const AnonAggState *base_state, StringInfo buf)
+{
+  const CountDistinctState *state = (const CountDistinctState *)base_state;
+  int16 typlen = DATA(state->tracker)->typlen;
+  bool typbyval = DATA(state->tracker)->typbyval;
+
+  pq_sendint32(buf, state->tracker->members);
+
+  DistinctTrackerHashEntry *entry;
+  foreach_entry(entry, state->tracker, DistinctTracker)
+  {
+    if (typbyval)
+    {
+      pq_sendint64(buf, (int64)entry->value);
+    }
+    else
+    {
+      Size size = datumGetSize(entry->value, false, typlen);
+      pq_sendint32(buf, size);
+      pq_sendbytes(buf, DatumGetPointer(entry->value), size);
+    }
+
+    ListCell *cell;
+    foreach (cell, entry->aid_values_sets)
+    {
+      const List *aid_values_set = (const List *)lfirst(cell);
+      pq_sendint32(buf, list_length(aid_values_set));
+
+      ListCell *aidv_cell;
+      foreach (aidv_cell, aid_values_set)
+      {
+        pq_sendint64(buf, (aid_t)lfirst(aidv_cell));
+      }
+    }
+  }
+}
+
+static void count_distinct_deserialize(AnonAggState *base_state, StringInfo buf)
+{
+  CountDistinctState *state = (CountDistinctState *)base_state;
+  int16 typlen = DATA(state->tracker)->typlen;
+  bool typbyval = DATA(state->tracker)->typbyval;
+
+  state->has_final_result = false;
+
+  int aids_count = state->aids_count;
+  MemoryContext old_context = MemoryContextSwitchTo(base_state->memory_context);
+
+  int32 num_entries = pq_getmsgint(buf, sizeof(int32));
+  for (int32 i = 0; i < num_entries; i++)
+  {
+    Datum value;
+    if (typbyval)
+    {
+      value = (Datum)pq_getmsgint64(buf);
+    }
+    else
+    {
+      int32 size = pq_getmsgint(buf, sizeof(int32));
+      /* Copy to aligned memory before using as a Datum. */
+      void *data = palloc(size);
+      memcpy(data, pq_getmsgbytes(buf, size), size);
+      value = PointerGetDatum(data);
+    }
+
+    DistinctTrackerHashEntry *entry = get_distinct_tracker_entry(state->tracker, state->interner, value, aids_count);
+
+    ListCell *cell;
+    foreach (cell, entry->aid_values_sets)
+    {
+      List **aid_values_set = (List **)&lfirst(cell);
+      int32 num_aids = pq_getmsgint(buf, sizeof(int32));
+      for (int32 j = 0; j < num_aids; j++)
+        *aid_values_set = hash_set_add(*aid_values_set, (aid_t)pq_getmsgint64(buf));
+    }
+  }
+
+  MemoryContextSwitchTo(old_context);
+}
+
 static const char *count_distinct_explain(const AnonAggState *base_state)
 {
   return "diffix.anon_count_distinct";
 }
 
-static List *add_aid_value_to_set(List *aid_values_set, NullableDatum aid_arg, Oid aid_type)
+static List *add_aid_value_to_set(List *aid_values_set, NullableDatum aid_arg, MapAidFunc aid_mapper, MemoryContext memory_context)
 {
   if (!aid_arg.isnull)
   {
-    aid_t aid_value = get_aid_mapper(aid_type)(aid_arg.value);
+    /* AIDs are mapped in the caller's memory, only the set lives in the state's memory. */
+    aid_t aid_value = aid_mapper(aid_arg.value);
+    MemoryContext old_context = MemoryContextSwitchTo(memory_context);
     aid_values_set = hash_set_add(aid_values_set, aid_value);
+    MemoryContextSwitchTo(old_context);
   }
   return aid_values_set;
 }
@@ -507,25 +610,25 @@ static void count_distinct_transition(AnonAggState *base_state, int num_args, Nu
   CountDistinctState *state = (CountDistinctState *)base_state;
 
   Assert(num_args > AIDS_OFFSET);
+  state->has_final_result = false;
   int aids_count = num_args - AIDS_OFFSET;
-  MemoryContext old_context = MemoryContextSwitchTo(base_state->memory_context);
 
   if (!args[VALUE_INDEX].isnull)
   {
     Datum value = args[VALUE_INDEX].value;
-    DistinctTrackerHashEntry *entry = get_distinct_tracker_entry(state->tracker, value, aids_count);
+    MemoryContext old_context = MemoryContextSwitchTo(base_state->memory_context);
+    DistinctTrackerHashEntry *entry = get_distinct_tracker_entry(state->tracker, state->interner, value, aids_count);
+    MemoryContextSwitchTo(old_context);
 
     ListCell *cell;
     foreach (cell, entry->aid_values_sets)
     {
-      int aid_index = foreach_current_index(cell) + AIDS_OFFSET;
-      Oid aid_type = state->args_desc->args[aid_index].type_oid;
+      int aid_index = foreach_current_index(cell);
       List **aid_values_set = (List **)&lfirst(cell);
-      *aid_values_set = add_aid_value_to_set(*aid_values_set, args[aid_index], aid_type);
+      *aid_values_set = add_aid_value_to_set(*aid_values_set, args[aid_index + AIDS_OFFSET],
+                                             state->aid_mappers[aid_index], base_state->memory_context);
     }
   }
-
-  MemoryContextSwitchTo(old_context);
 }
 
 const AnonAggFuncs g_count_distinct_funcs = {
@@ -534,6 +637,8 @@ const AnonAggFuncs g_count_distinct_funcs = {
     .transition = count_distinct_transition,
     .finalize = count_distinct_finalize,
     .merge = count_distinct_merge,
+    .serialize = count_distinct_serialize,
+    .deserialize = count_distinct_deserialize,
     .explain = count_distinct_explain,
 };
 
@@ -569,5 +674,7 @@ const AnonAggFuncs g_count_distinct_noise_funcs = {
     .transition = count_distinct_transition,
     .finalize = count_distinct_noise_finalize,
     .merge = count_distinct_merge,
+    .serialize = count_distinct_serialize,
+    .deserialize = count_distinct_deserialize,
     .explain = count_distinct_noise_explain,
 };
@@ -4,8 +4,10 @@
 
 #include "catalog/pg_type.h"
 #include "fmgr.h"
+#include "libpq/pqformat.h"
 #include "nodes/nodeFuncs.h"
 #include "utils/array.h"
+#include "utils/datum.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 
@@ -76,9 +78,13 @@ typedef struct Int64ToInt64Entry
 
 PGDLLEXPORT PG_FUNCTION_INFO_V1(count_histogram_transfn);
 PGDLLEXPORT PG_FUNCTION_INFO_V1(count_histogram_finalfn);
+PGDLLEXPORT PG_FUNCTION_INFO_V1(count_histogram_combinefn);
+PGDLLEXPORT PG_FUNCTION_INFO_V1(count_histogram_serialfn);
+PGDLLEXPORT PG_FUNCTION_INFO_V1(count_histogram_deserialfn);
 
 typedef struct CountHistogramState
 {
+  MemoryContext memory_context; /* Where table keys live */
   DatumToInt64_hash *table;
   int64 bin_size;
 } CountHistogramState;
@@ -87,6 +93,23 @@ const int STATE_INDEX = 0;
 const int VALUE_INDEX = 1;
 const int BIN_SIZE_INDEX = 2;
 
+static CountHistogramState *count_histogram_state_create(MemoryContext memory_context, int16 typlen, bool typbyval, int64 bin_size)
+{
+  MemoryContext old_context = MemoryContextSwitchTo(memory_context);
+
+  DatumToInt64Data *data = palloc(sizeof(DatumToInt64Data));
+  data->typlen = typlen;
+  data->typbyval = typbyval;
+
+  CountHistogramState *state = palloc(sizeof(CountHistogramState));
+  state->memory_context = memory_context;
+  state->table = DatumToInt64_create(memory_context, 4, data);
+  state->bin_size = bin_size;
+
+  MemoryContextSwitchTo(old_context);
+  return state;
+}
+
 static CountHistogramState *count_histogram_state_new(PG_FUNCTION_ARGS)
 {
   MemoryContext agg_context;
@@ -103,18 +126,30 @@ static CountHistogramState *count_histogram_state_new(PG_FUNCTION_ARGS)
       FAILWITH("Invalid bin_size for count_histogram.");
   }
 
-  MemoryContext old_context = MemoryContextSwitchTo(agg_context);
-
-  DatumToInt64Data *data = palloc(sizeof(DatumToInt64Data));
+  int16 typlen;
+  bool typbyval;
   Oid type_oid = get_fn_expr_argtype(fcinfo->flinfo, VALUE_INDEX);
-  get_typlenbyval(type_oid, &data->typlen, &data->typbyval);
+  get_typlenbyval(type_oid, &typlen, &typbyval);
 
-  CountHistogramState *state = palloc(sizeof(CountHistogramState));
-  state->table = DatumToInt64_create(agg_context, 4, data);
-  state->bin_size = bin_size;
+  return count_histogram_state_create(agg_context, typlen, typbyval, bin_size);
+}
 
-  MemoryContextSwitchTo(old_context);
-  return state;
+/* Adds `count` occurrences of `value` to the state. New keys are copied to the state's memory. */
+static void count_histogram_state_add(CountHistogramState *state, Datum value, int64 count)
+{
+  bool found;
+  DatumToInt64Entry *entry = DatumToInt64_insert(state->table, value, &found);
+  if (found)
+  {
+    entry->value += count;
+  }
+  else
+  {
+    MemoryContext old_context = MemoryContextSwitchTo(state->memory_context);
+    entry->key = datumCopy(value, DATA(state->table)->typbyval, DATA(state->table)->typlen);
+    entry->value = count;
+    MemoryContextSwitchTo(old_context);
+  }
 }
 
 Datum count_histogram_transfn(PG_FUNCTION_ARGS)
@@ -126,15 +161,129 @@ Datum count_histogram_transfn(PG_FUNCTION_ARGS)
     state = count_histogram_state_new(fcinfo);
 
   if (!PG_ARGISNULL(VALUE_INDEX))
+    count_histogram_state_add(state, PG_GETARG_DATUM(VALUE_INDEX), 1);
+
+  PG_RETURN_POINTER(state);
+}
+
+Datum count_histogram_combinefn(PG_FUNCTION_ARGS)
+{
+  MemoryContext agg_context;
+  if (!AggCheckCallContext(fcinfo, &agg_context))
+    FAILWITH("count_histogram_combinefn called in non-aggregate context.");
+
+  if (PG_ARGISNULL(1))
   {
-    bool found;
-    DatumToInt64Entry *entry = DatumToInt64_insert(state->table, PG_GETARG_DATUM(VALUE_INDEX), &found);
-    if (found)
-      entry->value++;
+    if (PG_ARGISNULL(0))
+      PG_RETURN_NULL();
+    PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+  }
+
+  CountHistogramState *src_state = (CountHistogramState *)PG_GETARG_POINTER(1);
+
+  /* Source state may be short lived, so we always copy its data into a state owned by the aggregate. */
+  CountHistogramState *dst_state;
+  if (!PG_ARGISNULL(0))
+    dst_state = (CountHistogramState *)PG_GETARG_POINTER(0);
+  else
+    dst_state = count_histogram_state_create(agg_context,
+                                             DATA(src_state->table)->typlen,
+                                             DATA(src_state->table)->typbyval,
+                                             src_state->bin_size);
+
+  Assert(dst_state->bin_size == src_state->bin_size);
+
+  DatumToInt64Entry *entry;
+  foreach_entry(entry, src_state->table, DatumToInt64)
+  {
+    count_histogram_state_add(dst_state, entry->key, entry->value);
+  }
+
+  PG_RETURN_POINTER(dst_state);
+}
+
+/*
+ * Serialized layout:
+ *   bin_size (int64), typlen (int16), typbyval (byte), entry count (int32),
+ *   followed by entries of (key, count (int64)).
+ * By-value keys are sent as int64, by-reference keys as a size (int32) followed by raw bytes.
+ */
+Datum count_histogram_serialfn(PG_FUNCTION_ARGS)
+{
+  CountHistogramState *state = (CountHistogramState *)PG_GETARG_POINTER(STATE_INDEX);
+  int16 typlen = DATA(state->table)->typlen;
+  bool typbyval = DATA(state->table)->typbyval;
+
+  StringInfoData buf;
+  pq_begintypsend(&buf);
+  pq_sendint64(&buf, state->bin_size);
+  pq_sendint16(&buf, typlen);
+  pq_sendbyte(&buf, typbyval);
+  pq_sendint32(&buf, state->table->members);
+
+  DatumToInt64Entry *entry;
+  foreach_entry(entry, state->table, DatumToInt64)
+  {
+    if (typbyval)
+    {
+      pq_sendint64(&buf, (int64)entry->key);
+    }
+    else
+    {
+      Size size = datumGetSize(entry->key, false, typlen);
+      pq_sendint32(&buf, size);
+      pq_sendbytes(&buf, DatumGetPointer(entry->key), size);
+    }
+    pq_sendint64(&buf, entry->value);
+  }
+
+  PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum count_histogram_deserialfn(PG_FUNCTION_ARGS)
+{
+  if (!AggCheckCallContext(fcinfo, NULL))
+    FAILWITH("count_histogram_deserialfn called in non-aggregate context.");
+
+  bytea *serialized = PG_GETARG_BYTEA_PP(0);
+
+  StringInfoData buf;
+  initStringInfo(&buf);
+  appendBinaryStringInfo(&buf, VARDATA_ANY(serialized), VARSIZE_ANY_EXHDR(serialized));
+
+  int64 bin_size = pq_getmsgint64(&buf);
+  int16 typlen = pq_getmsgint(&buf, sizeof(int16));
+  bool typbyval = pq_getmsgbyte(&buf);
+  int32 num_entries = pq_getmsgint(&buf, sizeof(int32));
+
+  /* The deserialized state is only used as input to the combine function. */
+  CountHistogramState *state = count_histogram_state_create(CurrentMemoryContext, typlen, typbyval, bin_size);
+
+  for (int32 i = 0; i < num_entries; i++)
+  {
+    Datum key;
+    if (typbyval)
+    {
+      key = (Datum)pq_getmsgint64(&buf);
+    }
     else
-      entry->value = 1;
+    {
+      int32 size = pq_getmsgint(&buf, sizeof(int32));
+      /* Copy to aligned memory before using as a Datum. */
+      void *data = palloc(size);
+      memcpy(data, pq_getmsgbytes(&buf, size), size);
+      key = PointerGetDatum(data);
+    }
+
+    bool found;
+    DatumToInt64Entry *entry = DatumToInt64_insert(state->table, key, &found);
+    Assert(!found);
+    entry->value = pq_getmsgint64(&buf);
   }
 
+  pq_getmsgend(&buf);
+  pfree(buf.data);
+
   PG_RETURN_POINTER(state);
 }
 
@@ -221,13 +370,13 @@ typedef struct CountTracker
 
 /*
  * HashTable<aid_t, AidCountTrackerEntry>
- * Holds intermediate aggregation state.
+ * Holds the row count of each counted AID.
  */
 
 typedef struct AidCountTrackerEntry
 {
   aid_t key;
-  CountTracker *data;
+  int64 count;
   char status;
 } AidCountTrackerEntry;
 
@@ -242,6 +391,34 @@ typedef struct AidCountTrackerEntry
 #define SH_DEFINE
 #include "lib/simplehash.h"
 
+/*
+ * HashSet<AidPair>
+ * Associates counted AIDs with the values of another AID instance seen in the same rows.
+ */
+
+typedef struct AidPair
+{
+  aid_t counted_aid;
+  aid_t aid;
+} AidPair;
+
+typedef struct AidPairSetEntry
+{
+  AidPair key;
+  char status;
+} AidPairSetEntry;
+
+#define SH_PREFIX AidPairSet
+#define SH_ELEMENT_TYPE AidPairSetEntry
+#define SH_KEY key
+#define SH_KEY_TYPE AidPair
+#define SH_EQUAL(tb, a, b) (a.counted_aid == b.counted_aid && a.aid == b.aid)
+#define SH_HASH_KEY(tb, key) (uint32)(key.counted_aid ^ (key.aid >> 32)) /* Both AIDs are already hashes. */
+#define SH_SCOPE static inline
+#define SH_DECLARE
+#define SH_DEFINE
+#include "lib/simplehash.h"
+
 /*
  * HashTable<int64, HistogramEntry>
  * Used for grouping by count in finalizer.
@@ -265,10 +442,16 @@ typedef struct HistogramEntry
 #define SH_DEFINE
 #include "lib/simplehash.h"
 
+/*
+ * During aggregation we only keep a row count per counted AID. Per-bin AID sets are built
+ * in the finalizer, once bins are known. For the other AID instances we record which of their
+ * values were seen together with each counted AID, so that they can be assigned to bins later.
+ */
 typedef struct AnonCountHistogramState
 {
   AnonAggState base;
-  AidCountTracker_hash *table;
+  AidCountTracker_hash *table; /* Row count per counted AID */
+  AidPairSet_hash **aid_pairs; /* Per AID instance, pairs of (counted AID, AID); NULL for counted AID */
   MapAidFunc *aid_mappers;
   int64 bin_size;
   int32 counted_aid_index; /* 0-based index of counted AID */
@@ -319,6 +502,21 @@ static void count_tracker_finalize(CountTracker *count_tracker, seed_t bucket_se
   count_tracker->count = Max(noisy_count, g_config.low_count_min_threshold);
 }
 
+/* Returns the AID trackers of the histogram bin where the given row count belongs. */
+static CountTracker *get_histogram_bin(Histogram_hash *histogram,
+                                       AnonCountHistogramState *state,
+                                       int64 row_count,
+                                       MemoryContext memory_context)
+{
+  int bin_label = generalize(row_count, state->bin_size);
+  bool found;
+  HistogramEntry *histogram_entry = Histogram_insert(histogram, bin_label, &found);
+  if (!found)
+    histogram_entry->data = count_tracker_new(state, memory_context);
+
+  return histogram_entry->data;
+}
+
 static int histogram_entry_comparer(const ListCell *a, const ListCell *b)
 {
   HistogramEntry *entry_a = (HistogramEntry *)lfirst(a);
@@ -353,6 +551,13 @@ static AnonAggState *agg_create_state(MemoryContext memory_context, ArgsDescript
   state->bin_size = unwrap_const_int64(args_desc->args[BIN_SIZE_INDEX].expr, 1, INT64_MAX);
   state->aid_trackers_count = aid_trackers_count;
 
+  state->aid_pairs = palloc0(aid_trackers_count * sizeof(AidPairSet_hash *));
+  for (int i = 0; i < aid_trackers_count; i++)
+  {
+    if (i != state->counted_aid_index)
+      state->aid_pairs[i] = AidPairSet_create(memory_context, 4, NULL);
+  }
+
   MemoryContextSwitchTo(old_context);
   return &state->base;
 }
@@ -366,22 +571,21 @@ static void agg_transition(AnonAggState *base_state, int num_args, NullableDatum
   if (args[counted_aid_arg_index].isnull)
     return;
 
-  aid_t aid = state->aid_mappers[state->counted_aid_index](args[counted_aid_arg_index].value);
+  aid_t counted_aid = state->aid_mappers[state->counted_aid_index](args[counted_aid_arg_index].value);
 
   bool found;
-  AidCountTrackerEntry *entry = AidCountTracker_insert(state->table, aid, &found);
+  AidCountTrackerEntry *entry = AidCountTracker_insert(state->table, counted_aid, &found);
   if (!found)
-    entry->data = count_tracker_new(state, base_state->memory_context);
+    entry->count = 0;
 
-  entry->data->count++;
+  entry->count++;
   for (int i = 0; i < state->aid_trackers_count; i++)
   {
     int aid_index = i + AIDS_OFFSET;
-    if (!args[aid_index].isnull)
+    if (i != state->counted_aid_index && !args[aid_index].isnull)
     {
-      AidTrackerState *aid_tracker = &entry->data->aid_trackers[i];
-      aid_t aid = aid_tracker->aid_mapper(args[aid_index].value);
-      aid_tracker_update(aid_tracker, aid);
+      AidPair pair = {.counted_aid = counted_aid, .aid = state->aid_mappers[i](args[aid_index].value)};
+      AidPairSet_insert(state->aid_pairs[i], pair, &found);
     }
   }
 }
@@ -398,18 +602,28 @@ static Datum agg_finalize(AnonAggState *base_state, Bucket *bucket, BucketDescri
 
   Histogram_hash *histogram = Histogram_create(temp_context, 4, NULL);
 
-  /* Group entries by count. */
+  /* Group counted AIDs by count. We don't care about the `count` field of bins yet. */
   AidCountTrackerEntry *state_entry;
   foreach_entry(state_entry, state->table, AidCountTracker)
   {
-    int bin_label = generalize(state_entry->data->count, state->bin_size);
-    bool found;
-    HistogramEntry *histogram_entry = Histogram_insert(histogram, bin_label, &found);
-    if (!found)
-      histogram_entry->data = count_tracker_new(state, temp_context);
+    CountTracker *bin = get_histogram_bin(histogram, state, state_entry->count, temp_context);
+    aid_tracker_update(&bin->aid_trackers[counted_aid_index], state_entry->key);
+  }
+
+  /* Other AID instances follow the bin of the counted AID they were seen with. */
+  for (int i = 0; i < aid_trackers_count; i++)
+  {
+    if (i == counted_aid_index)
+      continue;
 
-    /* Add AIDs to histogram bin. We don't care about the `count` field yet. */
-    count_tracker_merge(histogram_entry->data, state_entry->data, aid_trackers_count);
+    AidPairSetEntry *pair_entry;
+    foreach_entry(pair_entry, state->aid_pairs[i], AidPairSet)
+    {
+      AidCountTrackerEntry *counted_entry = AidCountTracker_lookup(state->table, pair_entry->key.counted_aid);
+      Assert(counted_entry != NULL);
+      CountTracker *bin = get_histogram_bin(histogram, state, counted_entry->count, temp_context);
+      aid_tracker_update(&bin->aid_trackers[i], pair_entry->key.aid);
+    }
   }
 
   CountTracker *suppress_bin = count_tracker_new(state, temp_context);
@@ -490,9 +704,86 @@ static void agg_merge(AnonAggState *dst_base_state, const AnonAggState *src_base
     bool found;
     AidCountTrackerEntry *dst_entry = AidCountTracker_insert(dst_state->table, src_entry->key, &found);
     if (!found)
-      dst_entry->data = count_tracker_new(dst_state, dst_base_state->memory_context);
+      dst_entry->count = 0;
+
+    dst_entry->count += src_entry->count;
+  }
 
-    count_tracker_merge(dst_entry->data, src_entry->data, dst_state->aid_trackers_count);
+  for (int i = 0; i < dst_state->aid_trackers_count; i++)
+  {
+    if (i == dst_state->counted_aid_index)
+      continue;
+
+    AidPairSetEntry *src_pair_entry;
+    foreach_entry(src_pair_entry, src_state->aid_pairs[i], AidPairSet)
+    {
+      bool found;
+      AidPairSet_insert(dst_state->aid_pairs[i], src_pair_entry->key, &found);
+    }
+  }
+}
+
+/*
+ * Serialized layout: counted AID count (int32), followed by entries of (AID, row count),
+ * then for each other AID instance a pair count (int32), followed by pairs of (counted AID, AID).
+ * All AIDs and counts are sent as int64.
+ */
+static void agg_serialize(const AnonAggState *base_state, StringInfo buf)
+{
+  const AnonCountHistogramState *state = (const AnonCountHistogramState *)base_state;
+
+  pq_sendint32(buf, state->table->members);
+
+  AidCountTrackerEntry *entry;
+  foreach_entry(entry, state->table, AidCountTracker)
+  {
+    pq_sendint64(buf, entry->key);
+    pq_sendint64(buf, entry->count);
+  }
+
+  for (int i = 0; i < state->aid_trackers_count; i++)
+  {
+    if (i == state->counted_aid_index)
+      continue;
+
+    pq_sendint32(buf, state->aid_pairs[i]->members);
+
+    AidPairSetEntry *pair_entry;
+    foreach_entry(pair_entry, state->aid_pairs[i], AidPairSet)
+    {
+      pq_sendint64(buf, pair_entry->key.counted_aid);
+      pq_sendint64(buf, pair_entry->key.aid);
+    }
+  }
+}
+
+static void agg_deserialize(AnonAggState *base_state, StringInfo buf)
+{
+  AnonCountHistogramState *state = (AnonCountHistogramState *)base_state;
+  bool found;
+
+  int32 num_entries = pq_getmsgint(buf, sizeof(int32));
+  for (int32 i = 0; i < num_entries; i++)
+  {
+    aid_t counted_aid = (aid_t)pq_getmsgint64(buf);
+    AidCountTrackerEntry *entry = AidCountTracker_insert(state->table, counted_aid, &found);
+    Assert(!found);
+    entry->count = pq_getmsgint64(buf);
+  }
+
+  for (int i = 0; i < state->aid_trackers_count; i++)
+  {
+    if (i == state->counted_aid_index)
+      continue;
+
+    int32 num_pairs = pq_getmsgint(buf, sizeof(int32));
+    for (int32 j = 0; j < num_pairs; j++)
+    {
+      AidPair pair;
+      pair.counted_aid = (aid_t)pq_getmsgint64(buf);
+      pair.aid = (aid_t)pq_getmsgint64(buf);
+      AidPairSet_insert(state->aid_pairs[i], pair, &found);
+    }
   }
 }
 
@@ -507,5 +798,7 @@ const AnonAggFuncs g_count_histogram_funcs = {
     .transition = agg_transition,
     .finalize = agg_finalize,
     .merge = agg_merge,
+    .serialize = agg_serialize,
+    .deserialize = agg_deserialize,
     .explain = agg_explain,
 };
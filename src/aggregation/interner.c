@@ -0,0 +1,81 @@
+#include "postgres.h"
+
+#include "utils/datum.h"
+
+#include "pg_diffix/aggregation/interner.h"
+#include "pg_diffix/utils.h"
+
+typedef struct InternedValue
+{
+  const void *data; /* Pointer to value bytes */
+  Size size;        /* Size of value in bytes */
+} InternedValue;
+
+typedef struct InternerEntry
+{
+  InternedValue key; /* Interned value */
+  uint32 hash;       /* Memorized hash */
+  char status;       /* Required for hash table */
+} InternerEntry;
+
+static inline bool interned_value_equals(InternedValue a, InternedValue b)
+{
+  return a.size == b.size && memcmp(a.data, b.data, a.size) == 0;
+}
+
+/*
+ * Declarations for HashTable<InternedValue, InternerEntry>
+ */
+#define SH_PREFIX Interner
+#define SH_ELEMENT_TYPE InternerEntry
+#define SH_KEY key
+#define SH_KEY_TYPE InternedValue
+#define SH_EQUAL(tb, a, b) interned_value_equals(a, b)
+#define SH_HASH_KEY(tb, key) (uint32) hash_bytes(key.data, key.size)
+#define SH_STORE_HASH
+#define SH_GET_HASH(tb, entry) entry->hash
+#define SH_SCOPE static inline
+#define SH_DECLARE
+#define SH_DEFINE
+#include "lib/simplehash.h"
+
+struct DatumInterner
+{
+  MemoryContext memory_context; /* Where interned values live */
+  Interner_hash *values;        /* Set of interned values */
+};
+
+DatumInterner *create_datum_interner(MemoryContext memory_context)
+{
+  DatumInterner *interner = MemoryContextAlloc(memory_context, sizeof(DatumInterner));
+  interner->memory_context = memory_context;
+  interner->values = Interner_create(memory_context, 256, NULL);
+  return interner;
+}
+
+Datum intern_datum(DatumInterner *interner, Datum value, bool typbyval, int16 typlen)
+{
+  if (typbyval)
+    return value;
+
+  /* Expanded objects have to be flattened before their bytes can be compared. */
+  if (typlen == -1 && VARATT_IS_EXTERNAL_EXPANDED(DatumGetPointer(value)))
+    value = datumCopy(value, false, typlen);
+
+  InternedValue key = {
+      .data = DatumGetPointer(value),
+      .size = datumGetSize(value, false, typlen),
+  };
+
+  bool found;
+  InternerEntry *entry = Interner_insert(interner->values, key, &found);
+  if (!found)
+  {
+    /* Entry points to caller's data until we make a copy. */
+    void *data = MemoryContextAlloc(interner->memory_context, key.size);
+    memcpy(data, key.data, key.size);
+    entry->key.data = data;
+  }
+
+  return PointerGetDatum(entry->key.data);
+}
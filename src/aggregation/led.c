@@ -2,91 +2,121 @@
 
 #include <math.h>
 
-#include "nodes/pg_list.h"
+#include "access/parallel.h"
+#include "catalog/pg_type.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "port/pg_bswap.h"
+#include "storage/shm_toc.h"
 #include "utils/datum.h"
 #include "utils/memutils.h"
+#include "utils/tuplesort.h"
+#include "utils/typcache.h"
 
+#include "pg_diffix/aggregation/bucket_store.h"
 #include "pg_diffix/aggregation/led.h"
+#include "pg_diffix/config.h"
 #include "pg_diffix/utils.h"
 
 typedef Bucket *BucketRef; /* Treat a bucket pointer as opaque in this file. */
 
 #define MAX_SIBLINGS 3
 
-typedef struct BucketSiblings
-{
-  BucketRef values[MAX_SIBLINGS]; /* (up to) First 3 buckets in subset */
-} BucketSiblings;
+/* Sibling of a low count bucket for a column, if not the index of its only sibling. */
+#define NO_SIBLINGS -1       /* Bucket is alone in its subset */
+#define MULTIPLE_SIBLINGS -2 /* Bucket has more than one sibling */
+
+/* Target of a fact about a spilled low count bucket, if not the index of its only high count sibling. */
+#define UNKNOWN_COLUMN 0xFFFFFFFF
+
+/* Spilled buckets are partitioned into at most this many temporary files, each with its own buffer. */
+#define MAX_PARTITIONS 1024
+
+/* Keys of the parallel LED state in the DSM table of contents. */
+#define PARALLEL_KEY_LED_SHARED UINT64CONST(0xD1FF1E0000000001)
+#define PARALLEL_KEY_LED_VALUES UINT64CONST(0xD1FF1E0000000002)
+#define PARALLEL_KEY_LED_IS_NULL UINT64CONST(0xD1FF1E0000000003)
+#define PARALLEL_KEY_LED_LABEL_HASHES UINT64CONST(0xD1FF1E0000000004)
+#define PARALLEL_KEY_LED_BUCKET_HASHES UINT64CONST(0xD1FF1E0000000005)
+#define PARALLEL_KEY_LED_LOW_COUNT_BUCKETS UINT64CONST(0xD1FF1E0000000006)
+#define PARALLEL_KEY_LED_SIBLINGS UINT64CONST(0xD1FF1E0000000007)
 
 typedef struct SiblingsTrackerData
 {
-  BucketDescriptor *bucket_desc; /* Reference to bucket descriptor */
-  int skipped_column;            /* Skipped column for subsets */
+  int num_labels;        /* Number of labels per bucket */
+  int skipped_column;    /* Skipped column for subsets */
+  Datum *values;         /* Labels, per bucket */
+  bool *is_null;         /* Label null flags, per bucket */
+  uint32 *label_hashes;  /* Hash of each label, per bucket */
+  uint32 *bucket_hashes; /* Combined hash of all labels, per bucket */
 } SiblingsTrackerData;
 
 typedef struct SiblingsTrackerEntry
 {
-  BucketRef key;            /* First bucket in subset */
-  BucketSiblings *siblings; /* Pointer to siblings in subset */
-  uint32 hash;              /* Memorized hash */
-  char status;              /* Required for hash table */
+  uint32 key;     /* Index of first bucket in subset */
+  uint32 second;  /* Index of second bucket in subset, valid if `count` > 1 */
+  int count;      /* Number of buckets in subset, up to MAX_SIBLINGS */
+  uint32 hash;    /* Memorized hash */
+  char status;    /* Required for hash table */
 } SiblingsTrackerEntry;
 
-static inline bool subset_equals(SiblingsTrackerData *data, BucketRef a, BucketRef b)
+/*
+ * State shared between participants of a parallel sibling search.
+ * Participants claim columns until none are left.
+ */
+typedef struct LedParallelShared
+{
+  int num_buckets;              /* Number of buckets */
+  int num_labels;               /* Number of labels per bucket */
+  int num_low_count;            /* Number of low count buckets */
+  pg_atomic_uint32 next_column; /* Next column to be claimed */
+} LedParallelShared;
+
+static inline bool subset_equals(SiblingsTrackerData *data, uint32 a_index, uint32 b_index)
 {
-  BucketDescriptor *bucket_desc = data->bucket_desc;
   int skipped_column = data->skipped_column;
-  int num_labels = bucket_desc->num_labels;
+  int num_labels = data->num_labels;
+  Datum *a_values = &data->values[(Size)a_index * num_labels];
+  Datum *b_values = &data->values[(Size)b_index * num_labels];
+  bool *a_is_null = &data->is_null[(Size)a_index * num_labels];
+  bool *b_is_null = &data->is_null[(Size)b_index * num_labels];
 
   for (int i = 0; i < num_labels; i++)
   {
     if (i == skipped_column)
       continue;
 
-    if (a->is_null[i] != b->is_null[i])
+    if (a_is_null[i] != b_is_null[i])
       return false; /* NULL vs non-NULL. */
 
-    if (a->is_null[i])
+    if (a_is_null[i])
       continue; /* Both NULL. */
 
-    BucketAttribute *att = &bucket_desc->attrs[i];
-    if (!datumIsEqual(a->values[i], b->values[i], att->typ_byval, att->typ_len))
+    /*
+     * Labels are interned, so by-reference values can be compared by pointer.
+     * Parallel workers compare the leader's pointers without dereferencing them.
+     */
+    if (a_values[i] != b_values[i])
       return false;
   }
 
   return true;
 }
 
-static inline uint32 subset_hash(SiblingsTrackerData *data, BucketRef bucket)
+static inline uint32 subset_hash(SiblingsTrackerData *data, uint32 index)
 {
-  BucketDescriptor *bucket_desc = data->bucket_desc;
-  int skipped_column = data->skipped_column;
-  int num_labels = bucket_desc->num_labels;
-
-  uint32 hash = 0;
-  for (int i = 0; i < num_labels; i++)
-  {
-    if (i == skipped_column)
-      continue;
-
-    uint32 label_hash = bucket->is_null[i]
-                            ? 0
-                            : (uint32)hash_datum(bucket->values[i],
-                                                 bucket_desc->attrs[i].typ_byval,
-                                                 bucket_desc->attrs[i].typ_len);
-    hash ^= label_hash;
-  }
-
-  return hash;
+  /* Label hashes are combined with XOR, so the skipped label can be XOR-ed out again. */
+  return data->bucket_hashes[index] ^ data->label_hashes[(Size)index * data->num_labels + data->skipped_column];
 }
 
 /*
- * Declarations for HashTable<Bucket, SiblingsTrackerEntry>
+ * Declarations for HashTable<uint32, SiblingsTrackerEntry>
  */
 #define SH_PREFIX SiblingsTracker
 #define SH_ELEMENT_TYPE SiblingsTrackerEntry
 #define SH_KEY key
-#define SH_KEY_TYPE BucketRef
+#define SH_KEY_TYPE uint32
 #define DATA(tb) ((SiblingsTrackerData *)tb->private_data)
 #define SH_EQUAL(tb, a, b) subset_equals(DATA(tb), a, b)
 #define SH_HASH_KEY(tb, key) subset_hash(DATA(tb), key)
@@ -97,38 +127,643 @@ static inline uint32 subset_hash(SiblingsTrackerData *data, BucketRef bucket)
 #define SH_DEFINE
 #include "lib/simplehash.h"
 
-static inline void add_sibling(BucketSiblings *siblings, BucketRef bucket)
+/*
+ * Subset of a spilled bucket, which are its labels excluding the skipped column.
+ * Entries are written to partition files without the `labels` pointer, followed by the labels.
+ */
+typedef struct SubsetEntry
+{
+  uint32 hash;      /* Hash of the labels */
+  uint32 bucket_id; /* Index of the bucket in the store */
+  uint32 size;      /* Size of the serialized labels */
+  bool low_count;   /* Is the bucket low count? */
+  char *labels;     /* Serialized labels */
+} SubsetEntry;
+
+#define SUBSET_ENTRY_HEADER_SIZE offsetof(SubsetEntry, labels)
+
+/* Merge of a spilled low count bucket into one of its siblings. */
+typedef struct SpilledMerge
+{
+  uint32 source; /* Index of the merged low count bucket */
+  uint32 target; /* Index of the high count sibling */
+} SpilledMerge;
+
+static inline bool spilled_subset_equals(SubsetEntry *entries, uint32 a_index, uint32 b_index)
 {
-  for (int i = 0; i < MAX_SIBLINGS; i++)
+  SubsetEntry *a = &entries[a_index];
+  SubsetEntry *b = &entries[b_index];
+  return a->size == b->size && memcmp(a->labels, b->labels, a->size) == 0;
+}
+
+/*
+ * Declarations for HashTable<uint32, SiblingsTrackerEntry> over the entries of a partition
+ */
+#define SH_PREFIX SpilledSiblingsTracker
+#define SH_ELEMENT_TYPE SiblingsTrackerEntry
+#define SH_KEY key
+#define SH_KEY_TYPE uint32
+#define ENTRIES(tb) ((SubsetEntry *)tb->private_data)
+#define SH_EQUAL(tb, a, b) spilled_subset_equals(ENTRIES(tb), a, b)
+#define SH_HASH_KEY(tb, key) ENTRIES(tb)[key].hash
+#define SH_STORE_HASH
+#define SH_GET_HASH(tb, entry) entry->hash
+#define SH_SCOPE static inline
+#define SH_DECLARE
+#define SH_DEFINE
+#include "lib/simplehash.h"
+
+/*
+ * Copies labels of all buckets into flat arrays and hashes every label once.
+ * Subset hashes are derived from these.
+ */
+static void hash_labels(SiblingsTrackerData *data, BucketStore *buckets)
+{
+  int num_buckets = bucket_store_size(buckets);
+  int num_labels = data->num_labels;
+  for (int bucket_idx = 0; bucket_idx < num_buckets; bucket_idx++)
   {
-    if (siblings->values[i] == NULL)
+    BucketRef bucket = bucket_store_get(buckets, bucket_idx);
+    Size offset = (Size)bucket_idx * num_labels;
+    uint32 bucket_hash = 0;
+    for (int column_idx = 0; column_idx < num_labels; column_idx++)
     {
-      siblings->values[i] = bucket;
-      return;
+      /* Interned labels are unique, so it is enough to hash the Datum itself. */
+      uint32 label_hash = bucket->is_null[column_idx]
+                              ? 0
+                              : (uint32)hash_bytes(&bucket->values[column_idx], sizeof(Datum));
+      data->values[offset + column_idx] = bucket->values[column_idx];
+      data->is_null[offset + column_idx] = bucket->is_null[column_idx];
+      data->label_hashes[offset + column_idx] = label_hash;
+      bucket_hash ^= label_hash;
     }
+    data->bucket_hashes[bucket_idx] = bucket_hash;
   }
+}
 
-  /* Array is full, do nothing. */
+/*
+ * For the given column, groups buckets by their labels EXCLUDING that column,
+ * meaning that buckets in a group are siblings which differ only in that column.
+ * Stores the sibling of each low count bucket for the column in `siblings`.
+ */
+static void find_siblings(SiblingsTrackerData *data, int num_buckets,
+                          const int *low_count_buckets, int num_low_count, int32 *siblings,
+                          MemoryContext temp_context)
+{
+  int num_labels = data->num_labels;
+  int column_idx = data->skipped_column;
+  SiblingsTracker_hash *tracker = SiblingsTracker_create(temp_context, num_buckets, data);
+
+  for (int bucket_idx = 0; bucket_idx < num_buckets; bucket_idx++)
+  {
+    bool found;
+    SiblingsTrackerEntry *entry = SiblingsTracker_insert(tracker, bucket_idx, &found);
+    if (!found)
+    {
+      entry->count = 1;
+    }
+    else if (entry->count < MAX_SIBLINGS)
+    {
+      if (entry->count == 1)
+        entry->second = bucket_idx;
+      entry->count++;
+    }
+  }
+
+  for (int i = 0; i < num_low_count; i++)
+  {
+    uint32 bucket_idx = low_count_buckets[i];
+    SiblingsTrackerEntry *entry = SiblingsTracker_lookup(tracker, bucket_idx);
+    Assert(entry != NULL);
+
+    int32 sibling;
+    if (entry->count == 1)
+      sibling = NO_SIBLINGS;
+    else if (entry->count == 2)
+      sibling = entry->key == bucket_idx ? entry->second : entry->key;
+    else
+      sibling = MULTIPLE_SIBLINGS;
+
+    siblings[(Size)i * num_labels + column_idx] = sibling;
+  }
+
+  MemoryContextReset(temp_context);
 }
 
-static inline int siblings_length(BucketSiblings *siblings)
+/*
+ * Finds siblings for columns claimed from the shared state, until all columns are done.
+ * Each column is handled by exactly one participant, so results don't depend on scheduling.
+ */
+static void find_claimed_siblings(LedParallelShared *shared, SiblingsTrackerData *data,
+                                  const int *low_count_buckets, int32 *siblings,
+                                  MemoryContext temp_context)
 {
-  int len = 0;
-  for (int i = 0; i < MAX_SIBLINGS; i++)
+  for (;;)
   {
-    if (siblings->values[i] == NULL)
+    uint32 column_idx = pg_atomic_fetch_add_u32(&shared->next_column, 1);
+    if (column_idx >= (uint32)shared->num_labels)
       break;
+
+    data->skipped_column = column_idx;
+    find_siblings(data, shared->num_buckets, low_count_buckets, shared->num_low_count, siblings, temp_context);
+  }
+}
+
+void led_parallel_worker_main(dsm_segment *seg, shm_toc *toc)
+{
+  LedParallelShared *shared = shm_toc_lookup(toc, PARALLEL_KEY_LED_SHARED, false);
+
+  SiblingsTrackerData data = {
+      .num_labels = shared->num_labels,
+      .values = shm_toc_lookup(toc, PARALLEL_KEY_LED_VALUES, false),
+      .is_null = shm_toc_lookup(toc, PARALLEL_KEY_LED_IS_NULL, false),
+      .label_hashes = shm_toc_lookup(toc, PARALLEL_KEY_LED_LABEL_HASHES, false),
+      .bucket_hashes = shm_toc_lookup(toc, PARALLEL_KEY_LED_BUCKET_HASHES, false),
+  };
+  int *low_count_buckets = shm_toc_lookup(toc, PARALLEL_KEY_LED_LOW_COUNT_BUCKETS, false);
+  int32 *siblings = shm_toc_lookup(toc, PARALLEL_KEY_LED_SIBLINGS, false);
+
+  MemoryContext temp_context = AllocSetContextCreate(CurrentMemoryContext, "led worker temporary context", ALLOCSET_DEFAULT_SIZES);
+  find_claimed_siblings(shared, &data, low_count_buckets, siblings, temp_context);
+  MemoryContextDelete(temp_context);
+}
+
+/*
+ * Same as calling `find_siblings` for each column, but columns are distributed between
+ * the leader and up to `num_workers` parallel workers. Labels and hashes are placed in DSM.
+ */
+static void find_siblings_parallel(BucketStore *buckets, int num_labels,
+                                   const int *low_count_buckets, int num_low_count, int32 *siblings,
+                                   int num_workers, MemoryContext temp_context)
+{
+  int num_buckets = bucket_store_size(buckets);
+  Size num_values = (Size)num_buckets * num_labels;
+  Size siblings_size = (Size)num_low_count * num_labels * sizeof(int32);
+
+  EnterParallelMode();
+  ParallelContext *pcxt = CreateParallelContext("pg_diffix", "led_parallel_worker_main", num_workers);
+
+  shm_toc_estimate_chunk(&pcxt->estimator, sizeof(LedParallelShared));
+  shm_toc_estimate_chunk(&pcxt->estimator, num_values * sizeof(Datum));
+  shm_toc_estimate_chunk(&pcxt->estimator, num_values * sizeof(bool));
+  shm_toc_estimate_chunk(&pcxt->estimator, num_values * sizeof(uint32));
+  shm_toc_estimate_chunk(&pcxt->estimator, num_buckets * sizeof(uint32));
+  shm_toc_estimate_chunk(&pcxt->estimator, num_low_count * sizeof(int));
+  shm_toc_estimate_chunk(&pcxt->estimator, siblings_size);
+  shm_toc_estimate_keys(&pcxt->estimator, 7);
+
+  InitializeParallelDSM(pcxt);
+
+  LedParallelShared *shared = shm_toc_allocate(pcxt->toc, sizeof(LedParallelShared));
+  shared->num_buckets = num_buckets;
+  shared->num_labels = num_labels;
+  shared->num_low_count = num_low_count;
+  pg_atomic_init_u32(&shared->next_column, 0);
+
+  SiblingsTrackerData data = {
+      .num_labels = num_labels,
+      .values = shm_toc_allocate(pcxt->toc, num_values * sizeof(Datum)),
+      .is_null = shm_toc_allocate(pcxt->toc, num_values * sizeof(bool)),
+      .label_hashes = shm_toc_allocate(pcxt->toc, num_values * sizeof(uint32)),
+      .bucket_hashes = shm_toc_allocate(pcxt->toc, num_buckets * sizeof(uint32)),
+  };
+  hash_labels(&data, buckets);
+
+  int *shared_low_count_buckets = shm_toc_allocate(pcxt->toc, num_low_count * sizeof(int));
+  memcpy(shared_low_count_buckets, low_count_buckets, num_low_count * sizeof(int));
+  int32 *shared_siblings = shm_toc_allocate(pcxt->toc, siblings_size);
+
+  shm_toc_insert(pcxt->toc, PARALLEL_KEY_LED_SHARED, shared);
+  shm_toc_insert(pcxt->toc, PARALLEL_KEY_LED_VALUES, data.values);
+  shm_toc_insert(pcxt->toc, PARALLEL_KEY_LED_IS_NULL, data.is_null);
+  shm_toc_insert(pcxt->toc, PARALLEL_KEY_LED_LABEL_HASHES, data.label_hashes);
+  shm_toc_insert(pcxt->toc, PARALLEL_KEY_LED_BUCKET_HASHES, data.bucket_hashes);
+  shm_toc_insert(pcxt->toc, PARALLEL_KEY_LED_LOW_COUNT_BUCKETS, shared_low_count_buckets);
+  shm_toc_insert(pcxt->toc, PARALLEL_KEY_LED_SIBLINGS, shared_siblings);
+
+  LaunchParallelWorkers(pcxt);
+
+  /* Leader participates too, so this completes even if no workers could be launched. */
+  find_claimed_siblings(shared, &data, shared_low_count_buckets, shared_siblings, temp_context);
+
+  WaitForParallelWorkersToFinish(pcxt);
+
+  memcpy(siblings, shared_siblings, siblings_size);
+
+  DestroyParallelContext(pcxt);
+  ExitParallelMode();
+}
+
+/*
+ * Serializes the labels of the bucket and stores where each of them ends.
+ */
+static void serialize_labels(Bucket *bucket, BucketDescriptor *bucket_desc, StringInfo buf, int *label_ends)
+{
+  resetStringInfo(buf);
+
+  for (int i = 0; i < bucket_desc->num_labels; i++)
+  {
+    BucketAttribute *att = &bucket_desc->attrs[i];
+    Size size = datumEstimateSpace(bucket->values[i], bucket->is_null[i], att->typ_byval, att->typ_len);
+    enlargeStringInfo(buf, size);
+
+    char *start_address = buf->data + buf->len;
+    datumSerialize(bucket->values[i], bucket->is_null[i], att->typ_byval, att->typ_len, &start_address);
+    buf->len += size;
+    label_ends[i] = buf->len;
+  }
+}
+
+/*
+ * Groups the subsets of a partition in memory and adds a fact to `facts` for each low count bucket
+ * which is alone in its subset (unknown column) or has a single high count sibling (isolating column).
+ * Facts are packed as the bucket index in the high half and the sibling index or `UNKNOWN_COLUMN` in the low half.
+ */
+static void find_partition_facts(BufFile *partition, Tuplesortstate *facts, MemoryContext temp_context)
+{
+  MemoryContext old_context = MemoryContextSwitchTo(temp_context);
+
+  if (BufFileSeek(partition, 0, 0, SEEK_SET) != 0)
+    FAILWITH("Could not seek in LED partition file.");
+
+  uint32 num_entries = 0;
+  uint32 max_entries = 64;
+  SubsetEntry *entries = palloc(max_entries * sizeof(SubsetEntry));
+
+  for (;;)
+  {
+    SubsetEntry entry;
+    size_t read_size = BufFileRead(partition, &entry, SUBSET_ENTRY_HEADER_SIZE);
+    if (read_size == 0)
+      break; /* EOF */
+
+    if (read_size != SUBSET_ENTRY_HEADER_SIZE)
+      FAILWITH("Could not read from LED partition file.");
+
+    entry.labels = palloc(entry.size);
+    if (BufFileRead(partition, entry.labels, entry.size) != entry.size)
+      FAILWITH("Could not read from LED partition file.");
+
+    if (num_entries == max_entries)
+    {
+      max_entries *= 2;
+      entries = repalloc_huge(entries, max_entries * sizeof(SubsetEntry));
+    }
+
+    entries[num_entries++] = entry;
+  }
+
+  SpilledSiblingsTracker_hash *tracker = SpilledSiblingsTracker_create(temp_context, num_entries, entries);
+
+  for (uint32 i = 0; i < num_entries; i++)
+  {
+    bool found;
+    SiblingsTrackerEntry *tracker_entry = SpilledSiblingsTracker_insert(tracker, i, &found);
+    if (!found)
+    {
+      tracker_entry->count = 1;
+    }
+    else if (tracker_entry->count < MAX_SIBLINGS)
+    {
+      if (tracker_entry->count == 1)
+        tracker_entry->second = i;
+      tracker_entry->count++;
+    }
+  }
+
+  for (uint32 i = 0; i < num_entries; i++)
+  {
+    if (!entries[i].low_count)
+      continue;
+
+    SiblingsTrackerEntry *tracker_entry = SpilledSiblingsTracker_lookup(tracker, i);
+    Assert(tracker_entry != NULL);
+
+    uint32 target;
+    if (tracker_entry->count == 1)
+    {
+      target = UNKNOWN_COLUMN;
+    }
+    else if (tracker_entry->count == 2)
+    {
+      uint32 sibling = tracker_entry->key == i ? tracker_entry->second : tracker_entry->key;
+      if (entries[sibling].low_count)
+        continue;
+      target = entries[sibling].bucket_id;
+    }
     else
-      len++;
+    {
+      continue; /* Multiple siblings have no special meaning. */
+    }
+
+    uint64 fact = ((uint64)entries[i].bucket_id << 32) | target;
+    tuplesort_putdatum(facts, Int64GetDatum((int64)fact), false);
   }
 
-  return len;
+  MemoryContextSwitchTo(old_context);
+  MemoryContextReset(temp_context);
 }
 
-void led_hook(List *buckets, BucketDescriptor *bucket_desc)
+/*
+ * For the given column, partitions the spilled buckets by the hash of their labels EXCLUDING that column,
+ * so that siblings end up in the same partition, which is small enough to be grouped in memory.
+ */
+static void find_spilled_facts(BucketStore *buckets, BucketDescriptor *bucket_desc, int column_idx,
+                               int num_partitions, Tuplesortstate *facts, MemoryContext temp_context)
 {
-  int num_buckets = list_length(buckets);
+  BufFile **partitions = palloc(num_partitions * sizeof(BufFile *));
+  for (int i = 0; i < num_partitions; i++)
+    partitions[i] = BufFileCreateTemp(false);
+
+  StringInfoData labels;
+  initStringInfo(&labels);
+  StringInfoData subset;
+  initStringInfo(&subset);
+  int *label_ends = palloc(bucket_desc->num_labels * sizeof(int));
+
+  bucket_store_rewind(buckets);
+
+  uint32 bucket_id = 0;
+  Bucket *bucket;
+  while ((bucket = bucket_store_next(buckets)) != NULL)
+  {
+    CHECK_FOR_INTERRUPTS();
+
+    serialize_labels(bucket, bucket_desc, &labels, label_ends);
+
+    int skipped_start = column_idx > 0 ? label_ends[column_idx - 1] : 0;
+    int skipped_end = label_ends[column_idx];
+    resetStringInfo(&subset);
+    appendBinaryStringInfo(&subset, labels.data, skipped_start);
+    appendBinaryStringInfo(&subset, labels.data + skipped_end, labels.len - skipped_end);
+
+    SubsetEntry entry = {
+        .hash = hash_bytes((unsigned char *)subset.data, subset.len),
+        .bucket_id = bucket_id++,
+        .size = subset.len,
+        .low_count = bucket->low_count,
+    };
+
+    /* Low bits of the hash place entries in the hash table of a partition, so partitions take the high bits. */
+    BufFile *partition = partitions[((uint64)entry.hash * num_partitions) >> 32];
+    BufFileWrite(partition, &entry, SUBSET_ENTRY_HEADER_SIZE);
+    BufFileWrite(partition, subset.data, subset.len);
+  }
+
+  for (int i = 0; i < num_partitions; i++)
+  {
+    find_partition_facts(partitions[i], facts, temp_context);
+    BufFileClose(partitions[i]);
+  }
+
+  pfree(partitions);
+  pfree(labels.data);
+  pfree(subset.data);
+  pfree(label_ends);
+}
+
+static bool read_spilled_merge(BufFile *merges, SpilledMerge *merge)
+{
+  size_t read_size = BufFileRead(merges, merge, sizeof(SpilledMerge));
+  if (read_size == 0)
+    return false; /* EOF */
+
+  if (read_size != sizeof(SpilledMerge))
+    FAILWITH("Could not read from LED merges file.");
+
+  return true;
+}
+
+/*
+ * Fetches the next delta, which is a copy of source states for a merge target,
+ * in `delta_context` and releases the previous one.
+ */
+static bool next_delta(Tuplesortstate *deltas, MemoryContext delta_context, bytea **delta, uint32 *target)
+{
+  MemoryContextReset(delta_context);
+  MemoryContext old_context = MemoryContextSwitchTo(delta_context);
+
+  Datum value;
+  bool is_null;
+  bool found = tuplesort_getdatum(deltas, true, &value, &is_null, NULL);
+
+  MemoryContextSwitchTo(old_context);
+
+  if (!found)
+    return false;
+
+  *delta = DatumGetByteaPP(value);
+
+  uint32 network_target;
+  memcpy(&network_target, VARDATA_ANY(*delta), sizeof(uint32));
+  *target = pg_ntoh32(network_target);
+  return true;
+}
+
+/*
+ * Applies the merges listed in `merges`, ordered by source. States of the sources are collected in one pass
+ * and sorted by target, so that a second pass can merge them while rewriting the spill file.
+ */
+static void apply_spilled_merges(BucketStore *buckets, BucketDescriptor *bucket_desc, BufFile *merges,
+                                 MemoryContext temp_context)
+{
+  int num_atts = bucket_num_atts(bucket_desc);
+
+  /*
+   * Deltas start with the target and source in network byte order,
+   * which makes the byte-wise order of bytea sort them by target, then by source.
+   */
+  TypeCacheEntry *bytea_type = lookup_type_cache(BYTEAOID, TYPECACHE_LT_OPR);
+  Tuplesortstate *deltas = tuplesort_begin_datum(BYTEAOID, bytea_type->lt_opr, InvalidOid, false,
+                                                 work_mem, NULL, false);
+
+  StringInfoData states;
+  initStringInfo(&states);
+
+  if (BufFileSeek(merges, 0, 0, SEEK_SET) != 0)
+    FAILWITH("Could not seek in LED merges file.");
+
+  SpilledMerge merge;
+  bool has_merge = read_spilled_merge(merges, &merge);
+
+  bucket_store_rewind(buckets);
+
+  uint32 bucket_id = 0;
+  Bucket *bucket;
+  while (has_merge && (bucket = bucket_store_next(buckets)) != NULL)
+  {
+    CHECK_FOR_INTERRUPTS();
+
+    if (merge.source == bucket_id)
+    {
+      bucket_store_load_states(buckets, bucket);
+      resetStringInfo(&states);
+      serialize_bucket_states(bucket, bucket_desc, &states);
+
+      for (; has_merge && merge.source == bucket_id; has_merge = read_spilled_merge(merges, &merge))
+      {
+        uint32 network_ids[2] = {pg_hton32(merge.target), pg_hton32(merge.source)};
+        Size delta_size = VARHDRSZ + sizeof(network_ids) + states.len;
+        bytea *delta = MemoryContextAlloc(temp_context, delta_size);
+        SET_VARSIZE(delta, delta_size);
+        memcpy(VARDATA(delta), network_ids, sizeof(network_ids));
+        memcpy(VARDATA(delta) + sizeof(network_ids), states.data, states.len);
+
+        tuplesort_putdatum(deltas, PointerGetDatum(delta), false);
+        MemoryContextReset(temp_context);
+      }
+    }
+
+    bucket_id++;
+  }
+
+  tuplesort_performsort(deltas);
+
+  MemoryContext delta_context = AllocSetContextCreate(CurrentMemoryContext, "led_hook delta context", ALLOCSET_DEFAULT_SIZES);
+  bytea *delta = NULL;
+  uint32 delta_target = 0;
+  bool has_delta = next_delta(deltas, delta_context, &delta, &delta_target);
+
+  /* Holds the states of a delta while they are merged. */
+  Bucket delta_bucket = {
+      .values = palloc0(num_atts * sizeof(Datum)),
+      .is_null = palloc0(num_atts * sizeof(bool)),
+  };
+
+  if (BufFileSeek(merges, 0, 0, SEEK_SET) != 0)
+    FAILWITH("Could not seek in LED merges file.");
+
+  has_merge = read_spilled_merge(merges, &merge);
+
+  bucket_store_begin_rewrite(buckets);
+
+  bucket_id = 0;
+  while ((bucket = bucket_store_next(buckets)) != NULL)
+  {
+    CHECK_FOR_INTERRUPTS();
+
+    bucket_store_load_states(buckets, bucket);
+
+    for (; has_merge && merge.source == bucket_id; has_merge = read_spilled_merge(merges, &merge))
+      bucket->merged = true;
+
+    if (has_delta && delta_target == bucket_id)
+    {
+      MemoryContext old_context = MemoryContextSwitchTo(temp_context);
+
+      for (; has_delta && delta_target == bucket_id; has_delta = next_delta(deltas, delta_context, &delta, &delta_target))
+      {
+        StringInfoData delta_buf = {
+            .data = VARDATA_ANY(delta) + 2 * sizeof(uint32),
+            .len = VARSIZE_ANY_EXHDR(delta) - 2 * sizeof(uint32),
+            .maxlen = VARSIZE_ANY_EXHDR(delta) - 2 * sizeof(uint32),
+            .cursor = 0,
+        };
+        deserialize_bucket_states(&delta_bucket, bucket_desc, &delta_buf, temp_context);
+        merge_bucket(bucket, &delta_bucket, bucket_desc);
+      }
+
+      /* Recompute low count for merge targets. */
+      bucket->low_count = eval_low_count(bucket, bucket_desc);
+
+      MemoryContextSwitchTo(old_context);
+    }
+
+    bucket_store_rewrite(buckets, bucket);
+    MemoryContextReset(temp_context);
+    bucket_id++;
+  }
+
+  bucket_store_end_rewrite(buckets);
+
+  tuplesort_end(deltas);
+  MemoryContextDelete(delta_context);
+  pfree(states.data);
+}
+
+/*
+ * Same as the in-memory LED, for buckets which were spilled to disk. Buckets are only ever read sequentially.
+ * Siblings are found per column by partitioning buckets by label hash, which yields facts about low count buckets.
+ * Facts are sorted by bucket to decide merges, which are then applied by rewriting the spill file.
+ */
+static LedResult led_spilled_buckets(BucketStore *buckets, BucketDescriptor *bucket_desc, MemoryContext temp_context)
+{
+  LedResult result = {0};
+  int num_labels = bucket_desc->num_labels;
+
+  /* A partition should fit in `work_mem` together with its hash table. */
+  Size subsets_size = buckets->label_size + (Size)bucket_store_size(buckets) * sizeof(SubsetEntry);
+  int num_partitions = (int)Min(2 * subsets_size / (work_mem * 1024L) + 1, MAX_PARTITIONS);
+
+  TypeCacheEntry *int8_type = lookup_type_cache(INT8OID, TYPECACHE_LT_OPR);
+  Tuplesortstate *facts = tuplesort_begin_datum(INT8OID, int8_type->lt_opr, InvalidOid, false,
+                                                work_mem, NULL, false);
+
+  for (int column_idx = 0; column_idx < num_labels; column_idx++)
+    find_spilled_facts(buckets, bucket_desc, column_idx, num_partitions, facts, temp_context);
+
+  tuplesort_performsort(facts);
+
+  /* Merges are produced in the order of their sources. */
+  BufFile *merges = BufFileCreateTemp(false);
+  uint32 *current_merge_targets = palloc(num_labels * sizeof(uint32));
+  uint32 current_bucket = 0;
+  bool has_unknown_column = false;
+  int isolating_columns = 0;
+
+  for (;;)
+  {
+    Datum value;
+    bool is_null;
+    bool has_fact = tuplesort_getdatum(facts, true, &value, &is_null, NULL);
+    uint64 fact = has_fact ? (uint64)DatumGetInt64(value) : 0;
+
+    /* All facts of a bucket are adjacent, merges are decided once they are all seen. */
+    if (!has_fact || (uint32)(fact >> 32) != current_bucket)
+    {
+      /* We need both for merge conditions. */
+      if (has_unknown_column && isolating_columns > 0)
+      {
+        for (int i = 0; i < isolating_columns; i++)
+        {
+          SpilledMerge merge = {.source = current_bucket, .target = current_merge_targets[i]};
+          BufFileWrite(merges, &merge, sizeof(SpilledMerge));
+        }
+
+        result.buckets_merged++;
+        result.total_merges += isolating_columns;
+      }
+
+      has_unknown_column = false;
+      isolating_columns = 0;
+    }
+
+    if (!has_fact)
+      break;
+
+    current_bucket = (uint32)(fact >> 32);
+    uint32 target = (uint32)fact;
+    if (target == UNKNOWN_COLUMN)
+      has_unknown_column = true;
+    else
+      current_merge_targets[isolating_columns++] = target;
+  }
+
+  tuplesort_end(facts);
+
+  if (result.buckets_merged > 0)
+    apply_spilled_merges(buckets, bucket_desc, merges, temp_context);
+
+  BufFileClose(merges);
+
+  return result;
+}
+
+LedResult led_hook(BucketStore *buckets, BucketDescriptor *bucket_desc)
+{
+  int num_buckets = bucket_store_size(buckets);
   int num_labels = bucket_desc->num_labels;
+  LedResult result = {0};
 
   /*
    * LED requires at least 2 columns - an isolating column and an unknown column.
@@ -136,103 +771,107 @@ void led_hook(List *buckets, BucketDescriptor *bucket_desc)
    * they would have to isolate victims against the whole dataset.
    */
   if (num_labels <= 2)
-    return;
+    return result;
 
   MemoryContext led_context = AllocSetContextCreate(bucket_desc->bucket_context, "led_hook context", ALLOCSET_DEFAULT_SIZES);
   MemoryContext temp_context = AllocSetContextCreate(led_context, "led_hook temporary context", ALLOCSET_DEFAULT_SIZES);
 
-  MemoryContext old_context = MemoryContextSwitchTo(temp_context);
+  MemoryContext old_context = MemoryContextSwitchTo(led_context);
 
-  /*
-   * For each column, we build a cache where we group buckets by their labels EXCLUDING that column.
-   * This means that every cache will associate siblings where the respective column is different.
-   */
-  SiblingsTracker_hash **trackers_per_column = palloc(num_labels * sizeof(SiblingsTracker_hash *));
-  SiblingsTrackerData *data = palloc(num_labels * sizeof(SiblingsTrackerData));
+  if (bucket_store_spilled(buckets))
+  {
+    result = led_spilled_buckets(buckets, bucket_desc, temp_context);
+    DEBUG_LOG("[LED] Spilled buckets merged: %i; Total merges: %i", result.buckets_merged, result.total_merges);
 
-  for (int i = 0; i < num_labels; i++)
+    MemoryContextSwitchTo(old_context);
+    MemoryContextDelete(led_context);
+    return result;
+  }
+
+  /* Only low count buckets can be merged, so we need to know siblings only for them. */
+  int *low_count_buckets = MemoryContextAllocHuge(led_context, num_buckets * sizeof(int));
+  int num_low_count = 0;
+  for (int bucket_idx = 0; bucket_idx < num_buckets; bucket_idx++)
   {
-    data[i].bucket_desc = bucket_desc;
-    data[i].skipped_column = i;
-    trackers_per_column[i] = SiblingsTracker_create(temp_context, num_buckets, &data[i]);
+    if (bucket_store_get(buckets, bucket_idx)->low_count)
+      low_count_buckets[num_low_count++] = bucket_idx;
+  }
+
+  if (num_low_count == 0)
+  {
+    MemoryContextSwitchTo(old_context);
+    MemoryContextDelete(led_context);
+    return result;
   }
 
   /*
-   * Per bucket, per column pointers to siblings. For example,
-   * if we have 3 columns (c), then for each bucket (b) we have:
+   * Per low count bucket, per column sibling. For example,
+   * if we have 3 columns (c), then for each low count bucket (b) we have:
    * [ b0c0, b0c1, b0c2, b1c0, b1c1, b1c2, b2c0 ... ]
+   * Hash tables are built one column at a time, so each participant holds only one of them.
    */
-  BucketSiblings **bucket_siblings = MemoryContextAllocZero(
-      led_context,
-      num_buckets * num_labels * sizeof(BucketSiblings *));
+  int32 *siblings = MemoryContextAllocHuge(led_context, (Size)num_low_count * num_labels * sizeof(int32));
 
-  /* Fill hash table & associate siblings. Skip star bucket (bucket #0). */
-  for (int bucket_idx = 1; bucket_idx < num_buckets; bucket_idx++)
+  /* We don't nest parallel operations, e.g. if the query itself runs in a parallel worker. */
+  int num_workers = Min(g_config.led_parallel_workers, num_labels - 1);
+  if (num_workers > 0 && num_buckets >= g_config.led_parallel_min_buckets && !IsInParallelMode())
+  {
+    find_siblings_parallel(buckets, num_labels, low_count_buckets, num_low_count, siblings, num_workers, temp_context);
+  }
+  else
   {
-    BucketRef bucket = (BucketRef)list_nth(buckets, bucket_idx);
+    Size num_values = (Size)num_buckets * num_labels;
+    SiblingsTrackerData data = {
+        .num_labels = num_labels,
+        .values = MemoryContextAllocHuge(led_context, num_values * sizeof(Datum)),
+        .is_null = MemoryContextAllocHuge(led_context, num_values * sizeof(bool)),
+        .label_hashes = MemoryContextAllocHuge(led_context, num_values * sizeof(uint32)),
+        .bucket_hashes = MemoryContextAllocHuge(led_context, num_buckets * sizeof(uint32)),
+    };
+    hash_labels(&data, buckets);
+
     for (int column_idx = 0; column_idx < num_labels; column_idx++)
     {
-      bool found;
-      SiblingsTrackerEntry *entry = SiblingsTracker_insert(trackers_per_column[column_idx], bucket, &found);
-      if (!found)
-        entry->siblings = MemoryContextAllocZero(led_context, sizeof(BucketSiblings));
-
-      add_sibling(entry->siblings, bucket);
-      bucket_siblings[bucket_idx * num_labels + column_idx] = entry->siblings;
+      data.skipped_column = column_idx;
+      find_siblings(&data, num_buckets, low_count_buckets, num_low_count, siblings, temp_context);
     }
   }
 
-  /* Free hash table. */
-  MemoryContextReset(temp_context);
-
   /* Temp storage to stage buckets for merging. */
-  BucketRef *current_merge_targets = MemoryContextAlloc(led_context, num_labels * sizeof(BucketRef));
+  int *current_merge_targets = palloc(num_labels * sizeof(int));
 
-  /* Tracks all target buckets. We recompute their low count state after the loop. */
-  List *all_merge_targets = NIL;
+  /* Flags all target buckets. We recompute their low count state after the loop. */
+  bool *is_merge_target = MemoryContextAllocHuge(led_context, num_buckets * sizeof(bool));
+  memset(is_merge_target, 0, num_buckets * sizeof(bool));
 
-  int buckets_merged = 0;
-  int total_merges = 0;
+  MemoryContextSwitchTo(temp_context);
 
   /* LED bucket loop */
-  for (int bucket_idx = 1; bucket_idx < num_buckets; bucket_idx++)
+  for (int i = 0; i < num_low_count; i++)
   {
-    BucketRef bucket = (BucketRef)list_nth(buckets, bucket_idx);
-
-    if (!bucket->low_count)
-      continue;
+    BucketRef bucket = bucket_store_get(buckets, low_count_buckets[i]);
 
     bool has_unknown_column = false;
     int isolating_columns = 0;
 
     for (int column_idx = 0; column_idx < num_labels; column_idx++)
     {
-      BucketSiblings *siblings = bucket_siblings[bucket_idx * num_labels + column_idx];
-      int num_siblings = siblings_length(siblings);
-      if (num_siblings == 1)
+      int32 sibling = siblings[(Size)i * num_labels + column_idx];
+      if (sibling == NO_SIBLINGS)
       {
-        /*
-         * No siblings for this column (num_siblings=1 means itself).
-         * A column without siblings is an unknown column.
-         */
-        Assert(siblings->values[0] == bucket);
+        /* A column without siblings is an unknown column. */
         has_unknown_column = true;
       }
-      else if (num_siblings == 2)
+      else if (sibling >= 0)
       {
-        /*
-         * Single sibling (self+other). Find it and check if it's high count.
-         * A column with a single high-count sibling is an isolating column.
-         */
-        BucketRef other_bucket = (siblings->values[0] == bucket)
-                                     ? (siblings->values[1])
-                                     : (siblings->values[0]);
+        /* A column with a single high-count sibling is an isolating column. */
+        BucketRef other_bucket = bucket_store_get(buckets, sibling);
         if (!other_bucket->low_count)
-          current_merge_targets[isolating_columns++] = other_bucket;
+          current_merge_targets[isolating_columns++] = sibling;
       }
       else
       {
-        /* num_siblings=3 means there are multiple siblings and has no special meaning. */
+        /* Multiple siblings have no special meaning. */
       }
     }
 
@@ -240,17 +879,15 @@ void led_hook(List *buckets, BucketDescriptor *bucket_desc)
     if (!has_unknown_column || isolating_columns == 0)
       continue;
 
-    for (int i = 0; i < isolating_columns; i++)
+    for (int j = 0; j < isolating_columns; j++)
     {
-      merge_bucket(current_merge_targets[i], bucket, bucket_desc);
-
-      MemoryContextSwitchTo(led_context);
-      all_merge_targets = list_append_unique(all_merge_targets, current_merge_targets[i]);
-      MemoryContextSwitchTo(temp_context);
+      BucketRef target = bucket_store_get(buckets, current_merge_targets[j]);
+      merge_bucket(target, bucket, bucket_desc);
+      is_merge_target[current_merge_targets[j]] = true;
     }
 
-    buckets_merged++;
-    total_merges += isolating_columns;
+    result.buckets_merged++;
+    result.total_merges += isolating_columns;
     bucket->merged = true;
 
     /* Free any garbage from merging. */
@@ -258,16 +895,21 @@ void led_hook(List *buckets, BucketDescriptor *bucket_desc)
   }
 
   /* Recompute low count for merge targets. */
-  ListCell *cell;
-  foreach (cell, all_merge_targets)
+  for (int bucket_idx = 0; bucket_idx < num_buckets; bucket_idx++)
   {
-    BucketRef bucket = (BucketRef)lfirst(cell);
+    if (!is_merge_target[bucket_idx])
+      continue;
+
+    BucketRef bucket = bucket_store_get(buckets, bucket_idx);
     bucket->low_count = eval_low_count(bucket, bucket_desc);
+    MemoryContextReset(temp_context);
   }
 
-  DEBUG_LOG("[LED] Buckets merged: %i; Total merges: %i", buckets_merged, total_merges);
+  DEBUG_LOG("[LED] Buckets merged: %i; Total merges: %i", result.buckets_merged, result.total_merges);
 
   MemoryContextSwitchTo(old_context);
 
   MemoryContextDelete(led_context); /* Also removes temp_context. */
+
+  return result;
 }
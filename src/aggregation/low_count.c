@@ -106,6 +106,20 @@ static void agg_merge(AnonAggState *dst_base_state, const AnonAggState *src_base
   }
 }
 
+static void agg_serialize(const AnonAggState *base_state, StringInfo buf)
+{
+  const LowCountState *state = (const LowCountState *)base_state;
+  for (int i = 0; i < state->trackers_count; i++)
+    aid_tracker_serialize(state->trackers[i], buf);
+}
+
+static void agg_deserialize(AnonAggState *base_state, StringInfo buf)
+{
+  LowCountState *state = (LowCountState *)base_state;
+  for (int i = 0; i < state->trackers_count; i++)
+    aid_tracker_deserialize(state->trackers[i], buf);
+}
+
 static const char *agg_explain(const AnonAggState *base_state)
 {
   return "diffix.lcf";
@@ -117,5 +131,7 @@ const AnonAggFuncs g_low_count_funcs = {
     .transition = agg_transition,
     .finalize = agg_finalize,
     .merge = agg_merge,
+    .serialize = agg_serialize,
+    .deserialize = agg_deserialize,
     .explain = agg_explain,
 };
@@ -0,0 +1,337 @@
+#include "postgres.h"
+
+#include "executor/executor.h"
+#include "executor/nodeSubplan.h"
+#include "lib/ilist.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+#include "pg_diffix/aggregation/rescan_cache.h"
+#include "pg_diffix/utils.h"
+
+typedef enum CacheMode
+{
+  CACHE_IDLE,      /* No scan is in progress */
+  CACHE_RECORDING, /* Results of the current scan are being recorded */
+  CACHE_REPLAYING, /* Results of the current scan are replayed from the cache */
+  CACHE_BYPASS,    /* Results of the current scan are too large to be cached */
+} CacheMode;
+
+typedef struct CacheEntry
+{
+  dlist_node lru_node;  /* Position in LRU list, least recently used entries come first */
+  Datum *values;        /* Parameter values */
+  bool *is_null;        /* Parameter null flags */
+  MinimalTuple *tuples; /* Result tuples */
+  int num_tuples;       /* Number of result tuples */
+  int max_tuples;       /* Capacity of `tuples` array */
+  Size size;            /* Memory used by entry */
+} CacheEntry;
+
+typedef struct CacheTableEntry
+{
+  CacheEntry *key; /* Entry with parameter values */
+  uint32 hash;     /* Memorized hash */
+  char status;     /* Required for hash table */
+} CacheTableEntry;
+
+static bool cache_entry_equals(RescanCache *cache, const CacheEntry *a, const CacheEntry *b);
+static uint32 cache_entry_hash(RescanCache *cache, const CacheEntry *entry);
+
+/*
+ * Declarations for HashTable<CacheEntry *, CacheTableEntry>
+ */
+#define SH_PREFIX CacheTable
+#define SH_ELEMENT_TYPE CacheTableEntry
+#define SH_KEY key
+#define SH_KEY_TYPE CacheEntry *
+#define SH_EQUAL(tb, a, b) cache_entry_equals((RescanCache *)tb->private_data, a, b)
+#define SH_HASH_KEY(tb, key) cache_entry_hash((RescanCache *)tb->private_data, key)
+#define SH_STORE_HASH
+#define SH_GET_HASH(tb, entry) entry->hash
+#define SH_SCOPE static inline
+#define SH_DECLARE
+#define SH_DEFINE
+#include "lib/simplehash.h"
+
+struct RescanCache
+{
+  MemoryContext memory_context; /* Where entries and result tuples live */
+  int num_params;               /* Number of key parameters */
+  int *param_ids;               /* PARAM_EXEC ids of key parameters */
+  int16 *typlens;               /* Type lengths of key parameters */
+  bool *typbyvals;              /* Type by-value flags of key parameters */
+  CacheTable_hash *entries;     /* Complete entries and the entry being recorded */
+  dlist_head lru_list;          /* Entries ordered by last use */
+  Size size;                    /* Memory used by all entries */
+  Size max_size;                /* Memory limit of all entries */
+  CacheEntry probe;             /* Parameter values of the scan being started */
+  CacheMode mode;               /* State of the current scan */
+  CacheEntry *current;          /* Entry of the current scan, if recording or replaying */
+  int next_tuple;               /* Index of the next tuple to replay */
+  TupleTableSlot *replay_slot;  /* Slot holding replayed tuples */
+};
+
+static bool cache_entry_equals(RescanCache *cache, const CacheEntry *a, const CacheEntry *b)
+{
+  for (int i = 0; i < cache->num_params; i++)
+  {
+    if (a->is_null[i] != b->is_null[i])
+      return false;
+
+    if (!a->is_null[i] && !datumIsEqual(a->values[i], b->values[i], cache->typbyvals[i], cache->typlens[i]))
+      return false;
+  }
+
+  return true;
+}
+
+static uint32 cache_entry_hash(RescanCache *cache, const CacheEntry *entry)
+{
+  hash_t hash = 0;
+  for (int i = 0; i < cache->num_params; i++)
+  {
+    hash_t value_hash = entry->is_null[i] ? 0 : hash_datum(entry->values[i], cache->typbyvals[i], cache->typlens[i]);
+    hash = hash * 31 + value_hash;
+  }
+
+  return (uint32)hash;
+}
+
+RescanCache *create_rescan_cache(EState *estate, Bitmapset *params, TupleDesc result_desc, Size max_size)
+{
+  MemoryContext memory_context = AllocSetContextCreate(estate->es_query_cxt,
+                                                       "BucketScan rescan cache",
+                                                       ALLOCSET_DEFAULT_SIZES);
+  MemoryContext old_context = MemoryContextSwitchTo(memory_context);
+
+  RescanCache *cache = palloc0(sizeof(RescanCache));
+  cache->memory_context = memory_context;
+  cache->num_params = bms_num_members(params);
+  cache->param_ids = palloc(cache->num_params * sizeof(int));
+  cache->typlens = palloc(cache->num_params * sizeof(int16));
+  cache->typbyvals = palloc(cache->num_params * sizeof(bool));
+
+  List *param_types = estate->es_plannedstmt->paramExecTypes;
+  int param_id = -1;
+  for (int i = 0; (param_id = bms_next_member(params, param_id)) >= 0; i++)
+  {
+    cache->param_ids[i] = param_id;
+    get_typlenbyval(list_nth_oid(param_types, param_id), &cache->typlens[i], &cache->typbyvals[i]);
+  }
+
+  cache->entries = CacheTable_create(memory_context, 64, cache);
+  dlist_init(&cache->lru_list);
+  cache->size = 0;
+  cache->max_size = max_size;
+  cache->probe.values = palloc(cache->num_params * sizeof(Datum));
+  cache->probe.is_null = palloc(cache->num_params * sizeof(bool));
+  cache->mode = CACHE_IDLE;
+  cache->current = NULL;
+  cache->next_tuple = 0;
+
+  MemoryContextSwitchTo(old_context);
+
+  cache->replay_slot = ExecInitExtraTupleSlot(estate, result_desc, &TTSOpsMinimalTuple);
+
+  return cache;
+}
+
+static void add_entry_size(RescanCache *cache, CacheEntry *entry, Size size)
+{
+  entry->size += size;
+  cache->size += size;
+}
+
+static void remove_entry(RescanCache *cache, CacheEntry *entry)
+{
+  CacheTable_delete(cache->entries, entry);
+  dlist_delete(&entry->lru_node);
+  cache->size -= entry->size;
+
+  for (int i = 0; i < entry->num_tuples; i++)
+    pfree(entry->tuples[i]);
+
+  for (int i = 0; i < cache->num_params; i++)
+  {
+    if (!entry->is_null[i] && !cache->typbyvals[i])
+      pfree(DatumGetPointer(entry->values[i]));
+  }
+
+  if (entry->tuples != NULL)
+    pfree(entry->tuples);
+  pfree(entry->values);
+  pfree(entry->is_null);
+  pfree(entry);
+}
+
+/* Evicts least recently used entries until the cache fits in its memory limit. */
+static void evict_entries(RescanCache *cache)
+{
+  while (cache->size > cache->max_size && !dlist_is_empty(&cache->lru_list))
+  {
+    CacheEntry *entry = dlist_head_element(CacheEntry, lru_node, &cache->lru_list);
+    if (entry == cache->current)
+      break;
+
+    remove_entry(cache, entry);
+  }
+}
+
+static CacheEntry *create_entry(RescanCache *cache)
+{
+  MemoryContext old_context = MemoryContextSwitchTo(cache->memory_context);
+
+  CacheEntry *entry = palloc0(sizeof(CacheEntry));
+  entry->values = palloc(cache->num_params * sizeof(Datum));
+  entry->is_null = palloc(cache->num_params * sizeof(bool));
+  add_entry_size(cache, entry, GetMemoryChunkSpace(entry));
+  add_entry_size(cache, entry, GetMemoryChunkSpace(entry->values));
+  add_entry_size(cache, entry, GetMemoryChunkSpace(entry->is_null));
+
+  for (int i = 0; i < cache->num_params; i++)
+  {
+    entry->is_null[i] = cache->probe.is_null[i];
+    if (entry->is_null[i])
+    {
+      entry->values[i] = (Datum)0;
+    }
+    else
+    {
+      entry->values[i] = datumCopy(cache->probe.values[i], cache->typbyvals[i], cache->typlens[i]);
+      if (!cache->typbyvals[i])
+        add_entry_size(cache, entry, GetMemoryChunkSpace(DatumGetPointer(entry->values[i])));
+    }
+  }
+
+  MemoryContextSwitchTo(old_context);
+
+  return entry;
+}
+
+void rescan_cache_reset(RescanCache *cache)
+{
+  /* Results of incomplete scans can't be replayed. */
+  if (cache->mode == CACHE_RECORDING)
+    remove_entry(cache, cache->current);
+
+  cache->mode = CACHE_IDLE;
+  cache->current = NULL;
+  cache->next_tuple = 0;
+}
+
+bool rescan_cache_started(RescanCache *cache)
+{
+  return cache->mode != CACHE_IDLE;
+}
+
+bool rescan_cache_begin(RescanCache *cache, ExprContext *econtext)
+{
+  Assert(cache->mode == CACHE_IDLE);
+
+  for (int i = 0; i < cache->num_params; i++)
+  {
+    ParamExecData *param = &econtext->ecxt_param_exec_vals[cache->param_ids[i]];
+
+    /* Parameters computed by initplans are evaluated lazily. */
+    if (param->execPlan != NULL)
+      ExecSetParamPlan(param->execPlan, econtext);
+
+    cache->probe.values[i] = param->value;
+    cache->probe.is_null[i] = param->isnull;
+  }
+
+  bool found;
+  CacheTableEntry *table_entry = CacheTable_insert(cache->entries, &cache->probe, &found);
+
+  if (found)
+  {
+    CacheEntry *entry = table_entry->key;
+    dlist_move_tail(&cache->lru_list, &entry->lru_node);
+    cache->mode = CACHE_REPLAYING;
+    cache->current = entry;
+    cache->next_tuple = 0;
+    return true;
+  }
+
+  /* Table entry points to the probe until we make a copy. */
+  CacheEntry *entry = create_entry(cache);
+  table_entry->key = entry;
+  dlist_push_tail(&cache->lru_list, &entry->lru_node);
+  cache->mode = CACHE_RECORDING;
+  cache->current = entry;
+  cache->next_tuple = 0;
+  evict_entries(cache);
+  return false;
+}
+
+bool rescan_cache_replaying(RescanCache *cache)
+{
+  return cache->mode == CACHE_REPLAYING;
+}
+
+TupleTableSlot *rescan_cache_next(RescanCache *cache)
+{
+  Assert(cache->mode == CACHE_REPLAYING);
+
+  CacheEntry *entry = cache->current;
+  if (cache->next_tuple >= entry->num_tuples)
+    return ExecClearTuple(cache->replay_slot);
+
+  return ExecStoreMinimalTuple(entry->tuples[cache->next_tuple++], cache->replay_slot, false);
+}
+
+void rescan_cache_record(RescanCache *cache, TupleTableSlot *slot)
+{
+  if (cache->mode != CACHE_RECORDING)
+    return;
+
+  CacheEntry *entry = cache->current;
+  MemoryContext old_context = MemoryContextSwitchTo(cache->memory_context);
+
+  if (entry->num_tuples == entry->max_tuples)
+  {
+    if (entry->tuples != NULL)
+    {
+      Size old_size = GetMemoryChunkSpace(entry->tuples);
+      entry->size -= old_size;
+      cache->size -= old_size;
+      entry->max_tuples *= 2;
+      entry->tuples = repalloc(entry->tuples, entry->max_tuples * sizeof(MinimalTuple));
+    }
+    else
+    {
+      entry->max_tuples = 16;
+      entry->tuples = palloc(entry->max_tuples * sizeof(MinimalTuple));
+    }
+    add_entry_size(cache, entry, GetMemoryChunkSpace(entry->tuples));
+  }
+
+  MinimalTuple tuple = ExecCopySlotMinimalTuple(slot);
+  entry->tuples[entry->num_tuples++] = tuple;
+  add_entry_size(cache, entry, GetMemoryChunkSpace(tuple));
+
+  MemoryContextSwitchTo(old_context);
+
+  if (entry->size > cache->max_size)
+  {
+    /* Results would evict everything else and still not fit, give up on caching them. */
+    remove_entry(cache, entry);
+    cache->mode = CACHE_BYPASS;
+    cache->current = NULL;
+  }
+  else
+  {
+    evict_entries(cache);
+  }
+}
+
+void rescan_cache_complete(RescanCache *cache)
+{
+  if (cache->mode != CACHE_RECORDING)
+    return;
+
+  /* Further calls return EOF until the next scan starts. */
+  cache->mode = CACHE_REPLAYING;
+  cache->next_tuple = cache->current->num_tuples;
+}
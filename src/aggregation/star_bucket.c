@@ -9,6 +9,9 @@
 #include "pg_diffix/config.h"
 #include "pg_diffix/oid_cache.h"
 
+/* Declared in bucket_scan.c. Depends on global state and should not be public API. */
+extern MemoryContext get_current_bucket_agg_context(const AnonAggFuncs *agg_funcs);
+
 static void set_text_label(Bucket *star_bucket, int att_idx, Oid type, MemoryContext context)
 {
   switch (type)
@@ -30,57 +33,119 @@ static void set_text_label(Bucket *star_bucket, int att_idx, Oid type, MemoryCon
   }
 }
 
-Bucket *star_bucket_hook(List *buckets, BucketDescriptor *bucket_desc)
+static inline bool is_star_bucket_source(Bucket *bucket)
+{
+  return bucket->low_count && !bucket->merged;
+}
+
+static AnonAggState *create_star_bucket_state(BucketDescriptor *bucket_desc, int index)
+{
+  BucketAttribute *att = &bucket_desc->attrs[index];
+
+  /* States are accounted with the stored states of the same aggregator. */
+  MemoryContext agg_context = get_current_bucket_agg_context(att->agg.funcs);
+  if (agg_context == NULL)
+    agg_context = bucket_desc->bucket_context;
+
+  return create_anon_agg_state(att->agg.funcs, agg_context, att->agg.args_desc);
+}
+
+/*
+ * Merges the states of all source buckets into the star bucket.
+ * If `low_count_only` is set, only the low count state is merged, otherwise all other states.
+ */
+static void merge_sources(Bucket *star_bucket, BucketStore *buckets, BucketDescriptor *bucket_desc,
+                          MemoryContext temp_context, bool low_count_only)
 {
+  int num_atts = bucket_num_atts(bucket_desc);
+  bucket_store_rewind(buckets);
+
+  Bucket *bucket;
+  while ((bucket = bucket_store_next(buckets)) != NULL)
+  {
+    if (!is_star_bucket_source(bucket))
+      continue;
+
+    bucket_store_load_states(buckets, bucket);
+
+    for (int j = bucket_desc->num_labels; j < num_atts; j++)
+    {
+      BucketAttribute *att = &bucket_desc->attrs[j];
+      if (att->tag != BUCKET_ANON_AGG || j != att->agg.redirect_to)
+        continue; /* Shared states need to be merged only once. */
+
+      if ((j == bucket_desc->low_count_index) == low_count_only)
+        att->agg.funcs->merge((AnonAggState *)DatumGetPointer(star_bucket->values[j]),
+                              (AnonAggState *)DatumGetPointer(bucket->values[j]));
+    }
+
+    MemoryContextReset(temp_context);
+  }
+}
+
+Bucket *star_bucket_hook(BucketStore *buckets, BucketDescriptor *bucket_desc, int *buckets_merged)
+{
+  *buckets_merged = 0;
+
+  bucket_store_rewind(buckets);
+
+  Bucket *bucket;
+  while ((bucket = bucket_store_next(buckets)) != NULL)
+  {
+    if (is_star_bucket_source(bucket))
+      (*buckets_merged)++;
+  }
+
+  /* A star bucket made of a single bucket would reveal that bucket. */
+  if (*buckets_merged < 2)
+    return NULL;
+
   MemoryContext bucket_context = bucket_desc->bucket_context;
   MemoryContext temp_context = AllocSetContextCreate(bucket_context, "star_bucket_hook temporary context", ALLOCSET_DEFAULT_SIZES);
 
   MemoryContext old_context = MemoryContextSwitchTo(temp_context);
 
   int num_atts = bucket_num_atts(bucket_desc);
+  int low_count_index = bucket_desc->low_count_index;
 
   Bucket *star_bucket = MemoryContextAllocZero(bucket_context, sizeof(Bucket));
   star_bucket->values = MemoryContextAllocZero(bucket_context, num_atts * sizeof(Datum));
   star_bucket->is_null = MemoryContextAllocZero(bucket_context, num_atts * sizeof(bool));
 
-  for (int i = 0; i < num_atts; i++)
-  {
-    BucketAttribute *att = &bucket_desc->attrs[i];
-    if (att->tag == BUCKET_ANON_AGG)
-      /* Create an empty anon agg state and merge buckets into it. */
-      star_bucket->values[i] = PointerGetDatum(i != att->agg.redirect_to
-                                                   ? AGG_STATE_REDIRECTED
-                                                   : create_anon_agg_state(att->agg.funcs, bucket_context, att->agg.args_desc));
-    else if (att->tag == BUCKET_LABEL)
-      set_text_label(star_bucket, i, att->final_type, bucket_context);
-    else if (att->agg.aggref->aggfnoid == g_oid_cache.is_suppress_bin)
-      star_bucket->values[i] = BoolGetDatum(true);
-    else
-      star_bucket->is_null[i] = true;
-  }
-
-  int buckets_merged = 0;
+  /*
+   * Most star buckets end up being low count themselves. We decide that by merging the low count states
+   * first and merge the other, usually more expensive, states only if the star bucket will be emitted.
+   */
+  star_bucket->values[low_count_index] = PointerGetDatum(create_star_bucket_state(bucket_desc, low_count_index));
+  merge_sources(star_bucket, buckets, bucket_desc, temp_context, true);
+  star_bucket->low_count = eval_low_count(star_bucket, bucket_desc);
 
-  int num_buckets = list_length(buckets);
-  for (int i = 1; i < num_buckets; i++)
+  if (!star_bucket->low_count)
   {
-    Bucket *bucket = (Bucket *)list_nth(buckets, i);
-    if (bucket->low_count && !bucket->merged)
+    for (int i = 0; i < num_atts; i++)
     {
-      buckets_merged++;
-      merge_bucket(star_bucket, bucket, bucket_desc);
-      MemoryContextReset(temp_context);
+      BucketAttribute *att = &bucket_desc->attrs[i];
+      if (i == low_count_index)
+        continue;
+      else if (att->tag == BUCKET_ANON_AGG)
+        /* Create an empty anon agg state and merge buckets into it. */
+        star_bucket->values[i] = PointerGetDatum(i != att->agg.redirect_to
+                                                     ? AGG_STATE_REDIRECTED
+                                                     : create_star_bucket_state(bucket_desc, i));
+      else if (att->tag == BUCKET_LABEL)
+        set_text_label(star_bucket, i, att->final_type, bucket_context);
+      else if (att->agg.aggref->aggfnoid == g_oid_cache.is_suppress_bin)
+        star_bucket->values[i] = BoolGetDatum(true);
+      else
+        star_bucket->is_null[i] = true;
     }
-  }
 
-  star_bucket->low_count = eval_low_count(star_bucket, bucket_desc);
+    merge_sources(star_bucket, buckets, bucket_desc, temp_context, false);
+  }
 
   MemoryContextSwitchTo(old_context);
 
   MemoryContextDelete(temp_context);
 
-  if (star_bucket->low_count || buckets_merged < 2)
-    return NULL;
-  else
-    return star_bucket;
+  return star_bucket->low_count ? NULL : star_bucket;
 }
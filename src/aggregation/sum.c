@@ -22,6 +22,13 @@ static double finalize_sum_result(const SummableResultAccumulator *accumulator)
 
 typedef ContributionTrackerState *SumLeg;
 
+typedef struct SumResult
+{
+  bool not_enough_aid_values;
+  SummableResultAccumulator positive;
+  SummableResultAccumulator negative;
+} SumResult;
+
 typedef struct SumState
 {
   AnonAggState base;
@@ -29,6 +36,8 @@ typedef struct SumState
   Oid summand_type;
   SumLeg *positive;
   SumLeg *negative;
+  bool has_final_result;  /* Is `final_result` valid? Cleared when the state changes */
+  SumResult final_result; /* Memoized result, shared by sum and its noise */
 } SumState;
 
 static void sum_final_type(const ArgsDescriptor *args_desc, Oid *type, int32 *typmod, Oid *collid)
@@ -100,16 +109,8 @@ static AnonAggState *sum_create_state(MemoryContext memory_context, ArgsDescript
   return &state->base;
 }
 
-typedef struct SumResult
-{
-  bool not_enough_aid_values;
-  SummableResultAccumulator positive;
-  SummableResultAccumulator negative;
-} SumResult;
-
-static SumResult sum_calculate_final(AnonAggState *base_state, Bucket *bucket, BucketDescriptor *bucket_desc)
+static SumResult compute_sum_result(SumState *state, Bucket *bucket, BucketDescriptor *bucket_desc)
 {
-  SumState *state = (SumState *)base_state;
   SummableResultAccumulator positive_result_accumulator = {0};
   SummableResultAccumulator negative_result_accumulator = {0};
   seed_t bucket_seed = compute_bucket_seed(bucket, bucket_desc);
@@ -133,6 +134,17 @@ static SumResult sum_calculate_final(AnonAggState *base_state, Bucket *bucket, B
   return (SumResult){.positive = positive_result_accumulator, .negative = negative_result_accumulator};
 }
 
+static SumResult sum_calculate_final(AnonAggState *base_state, Bucket *bucket, BucketDescriptor *bucket_desc)
+{
+  SumState *state = (SumState *)base_state;
+  if (!state->has_final_result)
+  {
+    state->final_result = compute_sum_result(state, bucket, bucket_desc);
+    state->has_final_result = true;
+  }
+  return state->final_result;
+}
+
 static Datum sum_finalize(AnonAggState *base_state, Bucket *bucket, BucketDescriptor *bucket_desc, bool *is_null)
 {
   SumState *state = (SumState *)base_state;
@@ -187,10 +199,32 @@ static void sum_merge(AnonAggState *dst_base_state, const AnonAggState *src_base
   const SumState *src_state = (const SumState *)src_base_state;
 
   Assert(dst_state->summand_type == src_state->summand_type);
+  dst_state->has_final_result = false;
   merge_trackers(dst_state->trackers_count, src_state->trackers_count, dst_state->positive, src_state->positive);
   merge_trackers(dst_state->trackers_count, src_state->trackers_count, dst_state->negative, src_state->negative);
 }
 
+static void sum_serialize(const AnonAggState *base_state, StringInfo buf)
+{
+  const SumState *state = (const SumState *)base_state;
+  for (int i = 0; i < state->trackers_count; i++)
+  {
+    contribution_tracker_serialize(state->positive[i], buf);
+    contribution_tracker_serialize(state->negative[i], buf);
+  }
+}
+
+static void sum_deserialize(AnonAggState *base_state, StringInfo buf)
+{
+  SumState *state = (SumState *)base_state;
+  state->has_final_result = false;
+  for (int i = 0; i < state->trackers_count; i++)
+  {
+    contribution_tracker_deserialize(state->positive[i], buf);
+    contribution_tracker_deserialize(state->negative[i], buf);
+  }
+}
+
 static contribution_t summand_to_contribution(Datum arg, Oid summand_type)
 {
   switch (summand_type)
@@ -216,6 +250,7 @@ static contribution_t summand_to_contribution(Datum arg, Oid summand_type)
 static void sum_transition(AnonAggState *base_state, int num_args, NullableDatum *args)
 {
   SumState *state = (SumState *)base_state;
+  state->has_final_result = false;
 
   if (all_aids_null(args, SUM_AIDS_OFFSET, state->trackers_count))
     return;
@@ -263,6 +298,8 @@ const AnonAggFuncs g_sum_funcs = {
     .transition = sum_transition,
     .finalize = sum_finalize,
     .merge = sum_merge,
+    .serialize = sum_serialize,
+    .deserialize = sum_deserialize,
     .explain = sum_explain,
 };
 
@@ -300,5 +337,7 @@ const AnonAggFuncs g_sum_noise_funcs = {
     .transition = sum_transition,
     .finalize = sum_noise_finalize,
     .merge = sum_merge,
+    .serialize = sum_serialize,
+    .deserialize = sum_deserialize,
     .explain = sum_noise_explain,
 };
@@ -1,17 +1,26 @@
 #include "postgres.h"
 
+#include "access/genam.h"
+#include "access/htup_details.h"
+#include "access/table.h"
 #include "catalog/pg_inherits.h"
 #include "catalog/pg_namespace.h"
 #include "catalog/pg_type.h"
+#include "common/hashfn.h"
 #include "fmgr.h"
 #include "miscadmin.h"
 #include "utils/acl.h"
 #include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
 
 /* Security labels type definitions */
 #include "catalog/pg_authid.h"
 #include "catalog/pg_class.h"
+#include "catalog/pg_seclabel.h"
 #include "commands/seclabel.h"
 
 #include "pg_diffix/auth.h"
@@ -21,10 +30,14 @@
 static const char *PROVIDER_TAG = "pg_diffix";
 
 static void object_relabel(const ObjectAddress *object, const char *seclabel);
+static void invalidate_relation_labels(Datum arg, Oid relation_oid);
+static void invalidate_user_label(Datum arg, int cache_id, uint32 hash_value);
 
 void auth_init(void)
 {
   register_label_provider(PROVIDER_TAG, object_relabel);
+  CacheRegisterRelcacheCallback(invalidate_relation_labels, (Datum)0);
+  CacheRegisterSyscacheCallback(AUTHOID, invalidate_user_label, (Datum)0);
 }
 
 static inline bool is_personal_label(const char *seclabel)
@@ -65,12 +78,59 @@ static inline bool is_direct_label(const char *seclabel)
 #define FAIL_ON_INVALID_LABEL(seclabel) \
   FAILWITH_CODE(ERRCODE_INVALID_NAME, "'%s' is not a valid anonymization label", seclabel);
 
-AccessLevel get_user_access_level(void)
+/*
+ * Label of the session user is needed for every statement, so it is cached.
+ * `pg_shseclabel` has no syscache. Relabeling a role goes through `object_relabel`,
+ * which invalidates the role's `pg_authid` entry instead.
+ */
+static Oid g_user_label_user_id = InvalidOid;
+static char *g_user_label = NULL;
+static bool g_user_label_valid = false;
+static uint64 g_user_label_invalidations = 0;
+
+static void invalidate_user_label(Datum arg, int cache_id, uint32 hash_value)
+{
+  g_user_label_invalidations++;
+  g_user_label_valid = false;
+}
+
+static const char *get_user_label(Oid user_id)
 {
-  Oid user_id = GetSessionUserId();
+  if (g_user_label_valid && g_user_label_user_id == user_id)
+    return g_user_label;
+
+  /* Invalidations processed during the lookup leave the result uncached. */
+  uint64 invalidations = g_user_label_invalidations;
   ObjectAddress user_object = {.classId = AuthIdRelationId, .objectId = user_id, .objectSubId = 0};
   const char *seclabel = GetSecurityLabel(&user_object, PROVIDER_TAG);
 
+  if (g_user_label != NULL)
+    pfree(g_user_label);
+  g_user_label = seclabel != NULL ? MemoryContextStrdup(TopMemoryContext, seclabel) : NULL;
+  g_user_label_user_id = user_id;
+  g_user_label_valid = invalidations == g_user_label_invalidations;
+
+  return g_user_label;
+}
+
+/* Makes other sessions drop their cached label of the role once the change is committed. */
+static void invalidate_role(Oid role_oid)
+{
+  HeapTuple tuple = SearchSysCache1(AUTHOID, ObjectIdGetDatum(role_oid));
+  if (!HeapTupleIsValid(tuple))
+    return;
+
+  Relation pg_authid = table_open(AuthIdRelationId, AccessShareLock);
+  CacheInvalidateHeapTuple(pg_authid, tuple, NULL);
+  table_close(pg_authid, AccessShareLock);
+
+  ReleaseSysCache(tuple);
+}
+
+AccessLevel get_user_access_level(void)
+{
+  const char *seclabel = get_user_label(GetSessionUserId());
+
   if (seclabel == NULL)
     return (AccessLevel)g_config.default_access_level;
   else if (is_direct_label(seclabel))
@@ -98,6 +158,193 @@ AccessLevel get_session_access_level(void)
   return (AccessLevel)g_config.session_access_level;
 }
 
+/*-------------------------------------------------------------------------
+ * Relation labels cache
+ *-------------------------------------------------------------------------
+ */
+
+typedef enum RelationLabel
+{
+  RELATION_UNLABELED,
+  RELATION_PERSONAL,
+  RELATION_PUBLIC,
+  RELATION_INVALID_LABEL,
+} RelationLabel;
+
+/*
+ * Anonymization labels of a relation and its columns.
+ * Entries are dropped when the relation is invalidated. Setting a label on a relation
+ * or on one of its columns goes through `object_relabel`, which invalidates the relation.
+ */
+typedef struct RelationLabelsEntry
+{
+  Oid relation_oid;                  /* Entry key */
+  RelationLabel label;               /* Label of the relation itself */
+  char *invalid_label;               /* Unrecognized label of the relation, if any */
+  Bitmapset *aid_attnums;            /* Columns labeled as AID */
+  Bitmapset *not_filterable_attnums; /* Columns labeled as not filterable */
+  char status;                       /* Required for hash table */
+} RelationLabelsEntry;
+
+/*
+ * Declarations for HashTable<Oid, RelationLabelsEntry>
+ */
+#define SH_PREFIX RelationLabels
+#define SH_ELEMENT_TYPE RelationLabelsEntry
+#define SH_KEY relation_oid
+#define SH_KEY_TYPE Oid
+#define SH_EQUAL(tb, a, b) (a == b)
+#define SH_HASH_KEY(tb, key) murmurhash32(key)
+#define SH_SCOPE static inline
+#define SH_DECLARE
+#define SH_DEFINE
+#include "lib/simplehash.h"
+
+static MemoryContext g_labels_context = NULL;
+static RelationLabels_hash *g_relation_labels = NULL;
+static uint64 g_labels_invalidations = 0; /* Bumped on every invalidation, detects concurrent invalidations */
+
+static void free_relation_labels(RelationLabelsEntry *entry)
+{
+  if (entry->invalid_label != NULL)
+    pfree(entry->invalid_label);
+  bms_free(entry->aid_attnums);
+  bms_free(entry->not_filterable_attnums);
+}
+
+static void invalidate_relation_labels(Datum arg, Oid relation_oid)
+{
+  g_labels_invalidations++;
+
+  if (g_relation_labels == NULL)
+    return;
+
+  if (OidIsValid(relation_oid))
+  {
+    RelationLabelsEntry *entry = RelationLabels_lookup(g_relation_labels, relation_oid);
+    if (entry != NULL)
+    {
+      free_relation_labels(entry);
+      RelationLabels_delete(g_relation_labels, relation_oid);
+    }
+  }
+  else
+  {
+    /* All relations are invalidated. */
+    MemoryContextReset(g_labels_context);
+    g_relation_labels = NULL;
+  }
+}
+
+static RelationLabel parse_relation_label(const char *seclabel)
+{
+  if (is_personal_label(seclabel))
+    return RELATION_PERSONAL;
+  else if (is_public_label(seclabel))
+    return RELATION_PUBLIC;
+  else
+    return RELATION_INVALID_LABEL;
+}
+
+/*
+ * Reads labels of the relation and all of its columns with a single scan of `pg_seclabel`.
+ * Data is allocated in the current memory context.
+ */
+static void read_relation_labels(Oid relation_oid, RelationLabelsEntry *labels)
+{
+  labels->label = RELATION_UNLABELED;
+  labels->invalid_label = NULL;
+  labels->aid_attnums = NULL;
+  labels->not_filterable_attnums = NULL;
+
+  ScanKeyData keys[2];
+  ScanKeyInit(&keys[0], Anum_pg_seclabel_objoid, BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(relation_oid));
+  ScanKeyInit(&keys[1], Anum_pg_seclabel_classoid, BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(RelationRelationId));
+
+  Relation pg_seclabel = table_open(SecLabelRelationId, AccessShareLock);
+  SysScanDesc scan = systable_beginscan(pg_seclabel, SecLabelObjectIndexId, true, NULL, 2, keys);
+
+  HeapTuple tuple;
+  while (HeapTupleIsValid(tuple = systable_getnext(scan)))
+  {
+    bool is_null;
+    Datum provider = heap_getattr(tuple, Anum_pg_seclabel_provider, RelationGetDescr(pg_seclabel), &is_null);
+    if (is_null || strcmp(TextDatumGetCString(provider), PROVIDER_TAG) != 0)
+      continue;
+
+    Datum label_datum = heap_getattr(tuple, Anum_pg_seclabel_label, RelationGetDescr(pg_seclabel), &is_null);
+    if (is_null)
+      continue;
+
+    char *seclabel = TextDatumGetCString(label_datum);
+    int32 attnum = ((Form_pg_seclabel)GETSTRUCT(tuple))->objsubid;
+
+    if (attnum == 0)
+    {
+      labels->label = parse_relation_label(seclabel);
+      if (labels->label == RELATION_INVALID_LABEL)
+        labels->invalid_label = pstrdup(seclabel);
+    }
+    else if (attnum > 0 && is_aid_label(seclabel))
+    {
+      labels->aid_attnums = bms_add_member(labels->aid_attnums, attnum);
+    }
+    else if (attnum > 0 && is_not_filterable_label(seclabel))
+    {
+      labels->not_filterable_attnums = bms_add_member(labels->not_filterable_attnums, attnum);
+    }
+
+    pfree(seclabel);
+  }
+
+  systable_endscan(scan);
+  table_close(pg_seclabel, AccessShareLock);
+}
+
+static RelationLabelsEntry *get_relation_labels(Oid relation_oid)
+{
+  if (g_labels_context == NULL)
+    g_labels_context = AllocSetContextCreate(CacheMemoryContext, "pg_diffix relation labels", ALLOCSET_SMALL_SIZES);
+
+  if (g_relation_labels == NULL)
+    g_relation_labels = RelationLabels_create(g_labels_context, 16, NULL);
+
+  RelationLabelsEntry *entry = RelationLabels_lookup(g_relation_labels, relation_oid);
+  if (entry != NULL)
+    return entry;
+
+  /* Labels are read into temporary memory, as invalidations may reset the cache while reading. */
+  RelationLabelsEntry labels;
+  for (;;)
+  {
+    /* Opening the catalog processes pending invalidations, which may include this relation. */
+    uint64 invalidations = g_labels_invalidations;
+    read_relation_labels(relation_oid, &labels);
+    if (invalidations == g_labels_invalidations)
+      break;
+
+    free_relation_labels(&labels);
+  }
+
+  if (g_relation_labels == NULL)
+    g_relation_labels = RelationLabels_create(g_labels_context, 16, NULL);
+
+  MemoryContext old_context = MemoryContextSwitchTo(g_labels_context);
+
+  bool found;
+  entry = RelationLabels_insert(g_relation_labels, relation_oid, &found);
+  Assert(!found);
+  entry->label = labels.label;
+  entry->invalid_label = labels.invalid_label != NULL ? pstrdup(labels.invalid_label) : NULL;
+  entry->aid_attnums = bms_copy(labels.aid_attnums);
+  entry->not_filterable_attnums = bms_copy(labels.not_filterable_attnums);
+
+  MemoryContextSwitchTo(old_context);
+
+  free_relation_labels(&labels);
+  return entry;
+}
+
 static bool is_metadata_relation(Oid relation_oid)
 {
   Oid namespace_oid = get_rel_namespace(relation_oid);
@@ -114,35 +361,35 @@ static bool is_metadata_relation(Oid relation_oid)
 
 bool is_personal_relation(Oid relation_oid)
 {
-  ObjectAddress relation_object = {.classId = RelationRelationId, .objectId = relation_oid, .objectSubId = 0};
-  const char *seclabel = GetSecurityLabel(&relation_object, PROVIDER_TAG);
+  RelationLabelsEntry *labels = get_relation_labels(relation_oid);
 
-  if (seclabel == NULL)
+  if (labels->label == RELATION_UNLABELED)
     if (g_config.treat_unmarked_tables_as_public || is_metadata_relation(relation_oid))
       return false;
     else
       FAILWITH_CODE(ERRCODE_INSUFFICIENT_PRIVILEGE,
                     "Tables without an anonymization label can't be accessed in anonymized mode.");
-  else if (is_personal_label(seclabel))
+  else if (labels->label == RELATION_PERSONAL)
     return true;
-  else if (is_public_label(seclabel))
+  else if (labels->label == RELATION_PUBLIC)
     return false;
   else
-    FAIL_ON_INVALID_LABEL(seclabel);
+    FAIL_ON_INVALID_LABEL(labels->invalid_label);
 }
 
 bool is_aid_column(Oid relation_oid, AttrNumber attnum)
 {
-  ObjectAddress object = {.classId = RelationRelationId, .objectId = relation_oid, .objectSubId = attnum};
-  const char *seclabel = GetSecurityLabel(&object, PROVIDER_TAG);
-  return seclabel != NULL && is_aid_label(seclabel);
+  return attnum > 0 && bms_is_member(attnum, get_relation_labels(relation_oid)->aid_attnums);
+}
+
+Bitmapset *get_aid_columns(Oid relation_oid)
+{
+  return bms_copy(get_relation_labels(relation_oid)->aid_attnums);
 }
 
 bool is_not_filterable_column(Oid relation_oid, AttrNumber attnum)
 {
-  ObjectAddress object = {.classId = RelationRelationId, .objectId = relation_oid, .objectSubId = attnum};
-  const char *seclabel = GetSecurityLabel(&object, PROVIDER_TAG);
-  return seclabel != NULL && is_not_filterable_label(seclabel);
+  return attnum > 0 && bms_is_member(attnum, get_relation_labels(relation_oid)->not_filterable_attnums);
 }
 
 #define FAIL_ON_INVALID_OBJECT_TYPE(seclabel, object)                   \
@@ -176,6 +423,12 @@ static void object_relabel(const ObjectAddress *object, const char *seclabel)
   if (!superuser())
     FAILWITH_CODE(ERRCODE_INSUFFICIENT_PRIVILEGE, "Only a superuser can set anonymization labels");
 
+  /* Cached labels of the object are dropped in all backends once the change is committed. */
+  if (object->classId == RelationRelationId)
+    CacheInvalidateRelcacheByRelid(object->objectId);
+  else if (object->classId == AuthIdRelationId)
+    invalidate_role(object->objectId);
+
   if (seclabel == NULL)
     return;
 
@@ -5,6 +5,8 @@
 #include "lib/stringinfo.h"
 #include "miscadmin.h"
 #include "utils/guc.h"
+#include "utils/inval.h"
+#include "utils/syscache.h"
 
 #include "pg_diffix/auth.h"
 #include "pg_diffix/config.h"
@@ -13,6 +15,7 @@
 DiffixConfig g_config; /* Gets initialized by config_init. */
 
 static const int MAX_NUMERIC_CONFIG = 1000;
+static const int MAX_PARALLEL_WORKERS_CONFIG = 1024;
 
 static const struct config_enum_entry access_level_options[] = {
     {"direct", ACCESS_DIRECT, false},
@@ -51,6 +54,8 @@ static char *config_to_string(DiffixConfig *config)
 
 static bool g_initializing = false; /* Set to true during config initialization. */
 
+static void invalidate_extension_active(Datum arg, int cache_id, uint32 hash_value);
+
 /*
  * Because initialization can be done in order out of our control, we can fully validate only single
  * parameters using GUC hooks. Cross-dependent parameters such as intervals are only soft-validated
@@ -204,6 +209,8 @@ void config_init(void)
 {
   g_initializing = true;
 
+  CacheRegisterSyscacheCallback(PROCOID, invalidate_extension_active, (Datum)0);
+
   DefineCustomEnumVariable(
       "pg_diffix.session_access_level",    /* name */
       "Access level for current session.", /* short_desc */
@@ -404,6 +411,34 @@ and the mean of the low count filter threshold.", /* short_desc */
       NULL,                                                                       /* assign_hook */
       NULL);                                                                      /* show_hook */
 
+  DefineCustomIntVariable(
+      "pg_diffix.led_parallel_workers",                                 /* name */
+      "Maximum number of parallel workers searching for LED siblings.", /* short_desc */
+      "Finalizing and merging buckets run in the backend.",             /* long_desc */
+      &g_config.led_parallel_workers,                                   /* valueAddr */
+      0,                                                                /* bootValue */
+      0,                                                                /* minValue */
+      MAX_PARALLEL_WORKERS_CONFIG,                                      /* maxValue */
+      PGC_USERSET,                                                      /* context */
+      0,                                                                /* flags */
+      NULL,                                                             /* check_hook */
+      NULL,                                                             /* assign_hook */
+      NULL);                                                            /* show_hook */
+
+  DefineCustomIntVariable(
+      "pg_diffix.led_parallel_min_buckets",                                         /* name */
+      "Minimum number of buckets for which low effect detection runs in parallel.", /* short_desc */
+      NULL,                                                                         /* long_desc */
+      &g_config.led_parallel_min_buckets,                                           /* valueAddr */
+      65536,                                                                        /* bootValue */
+      0,                                                                            /* minValue */
+      INT_MAX,                                                                      /* maxValue */
+      PGC_USERSET,                                                                  /* context */
+      0,                                                                            /* flags */
+      NULL,                                                                         /* check_hook */
+      NULL,                                                                         /* assign_hook */
+      NULL);                                                                        /* show_hook */
+
   char *config_str = config_to_string(&g_config);
   DEBUG_LOG("Config %s", config_str);
   pfree(config_str);
@@ -423,7 +458,29 @@ void config_validate(void)
     FAILWITH("pg_diffix is misconfigured: outlier_count_max - outlier_count_min < %d.", MIN_STRICT_INTERVAL_SIZE);
 }
 
+/*
+ * Whether the extension exists in the current database is checked for every statement, so it is cached.
+ * `pg_extension` has no syscache, but creating or dropping the extension always changes `pg_proc`.
+ */
+static bool g_extension_active = false;
+static bool g_extension_active_valid = false;
+static uint64 g_extension_invalidations = 0;
+
+static void invalidate_extension_active(Datum arg, int cache_id, uint32 hash_value)
+{
+  g_extension_invalidations++;
+  g_extension_active_valid = false;
+}
+
 bool is_pg_diffix_active(void)
 {
-  return OidIsValid(get_extension_oid("pg_diffix", true));
+  if (!g_extension_active_valid)
+  {
+    /* Invalidations processed during the lookup leave the result uncached. */
+    uint64 invalidations = g_extension_invalidations;
+    g_extension_active = OidIsValid(get_extension_oid("pg_diffix", true));
+    g_extension_active_valid = invalidations == g_extension_invalidations;
+  }
+
+  return g_extension_active;
 }
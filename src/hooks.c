@@ -1,25 +1,28 @@
 #include "postgres.h"
 
+#include "access/htup_details.h"
 #include "executor/executor.h"
+#include "funcapi.h"
 #include "miscadmin.h"
 #include "nodes/value.h"
 #include "optimizer/planner.h"
 #include "parser/analyze.h"
+#include "portability/instr_time.h"
 #include "tcop/utility.h"
 #include "utils/acl.h"
 
 #include "pg_diffix/auth.h"
-#include "pg_diffix/config.h"
 #include "pg_diffix/hooks.h"
-#include "pg_diffix/oid_cache.h"
 #include "pg_diffix/query/allowed_objects.h"
 #include "pg_diffix/query/anonymization.h"
+#include "pg_diffix/query/costs.h"
 #include "pg_diffix/query/relation.h"
 #include "pg_diffix/query/validation.h"
 #include "pg_diffix/utils.h"
 
 post_parse_analyze_hook_type prev_post_parse_analyze_hook = NULL;
 planner_hook_type prev_planner_hook = NULL;
+create_upper_paths_hook_type prev_create_upper_paths_hook = NULL;
 ProcessUtility_hook_type prev_ProcessUtility_hook = NULL;
 ExecutorCheckPerms_hook_type prev_ExecutorCheckPerms_hook = NULL;
 ExecutorStart_hook_type prev_ExecutorStart_hook = NULL;
@@ -47,32 +50,27 @@ static void pg_diffix_post_parse_analyze(ParseState *pstate, Query *query, Jumbl
 }
 #endif
 
-static AnonQueryLinks *prepare_query(Query *query, ParamListInfo bound_params)
+/* Planning costs of anonymizing statements in this backend. */
+typedef struct PlanningStats
+{
+  uint64 statements;       /* Number of planned anonymizing statements */
+  instr_time compile_time; /* Total time spent compiling anonymizing queries */
+  instr_time rewrite_time; /* Total time spent rewriting plans of anonymizing queries */
+} PlanningStats;
+
+static PlanningStats g_planning_stats;
+
+static AnonQueryLinks *prepare_query(Query *query)
 {
   /* Do nothing for sessions with direct access. */
   if (get_session_access_level() == ACCESS_DIRECT)
     return NULL;
 
-  List *personal_relations = gather_personal_relations(query);
-  /* A query requires anonymization if it targets personal relations. */
-  if (personal_relations == NIL)
-    return NULL;
-
-  /* At this point we have an anonymizing query. */
-  DEBUG_LOG("Anonymizing query (User ID=%u) %s", GetSessionUserId(), nodeToString(query));
-
-  /* We load OIDs lazily because experimentation shows that UDFs may return INVALIDOID (0) during _PG_init. */
-  oid_cache_init();
+  /* Plans must not depend on parameter values, so that cached generic plans can be reused. */
+  AnonQueryLinks *links = compile_query(query);
 
-  /*
-   * Since we cannot easily validate cross-dependent parameters using GUC,
-   * we verify those here and fail if they are misconfigured.
-   */
-  config_validate();
-
-  AnonQueryLinks *links = compile_query(query, personal_relations, bound_params);
-
-  DEBUG_LOG("Compiled query (User ID=%u) %s", GetSessionUserId(), nodeToString(query));
+  if (links != NULL)
+    DEBUG_LOG("Compiled query (User ID=%u) %s", GetSessionUserId(), nodeToString(query));
 
   return links;
 }
@@ -85,17 +83,76 @@ static PlannedStmt *pg_diffix_planner(
 {
   DEBUG_LOG("Statement (User ID=%u): %s", GetSessionUserId(), query_string);
 
-  AnonQueryLinks *links = prepare_query(query, boundParams);
+  instr_time start_time, compiled_time, rewritten_time;
+  INSTR_TIME_SET_CURRENT(start_time);
+
+  AnonQueryLinks *links = prepare_query(query);
+
+  INSTR_TIME_SET_CURRENT(compiled_time);
 
   planner_hook_type planner = (prev_planner_hook ? prev_planner_hook : standard_planner);
   PlannedStmt *plan = planner(query, query_string, cursorOptions, boundParams);
 
-  plan->planTree = rewrite_plan(plan->planTree, links);
-  rewrite_plan_list(plan->subplans, links);
+  /* Plans of queries which need no anonymization are left as they are. */
+  if (links != NULL)
+  {
+    instr_time rewrite_start_time;
+    INSTR_TIME_SET_CURRENT(rewrite_start_time);
+
+    plan->planTree = rewrite_plan(plan->planTree, links);
+    rewrite_plan_list(plan->subplans, links);
+
+    INSTR_TIME_SET_CURRENT(rewritten_time);
+    g_planning_stats.statements++;
+    INSTR_TIME_ACCUM_DIFF(g_planning_stats.compile_time, compiled_time, start_time);
+    INSTR_TIME_ACCUM_DIFF(g_planning_stats.rewrite_time, rewritten_time, rewrite_start_time);
+
+#ifdef DEBUG
+    INSTR_TIME_SUBTRACT(compiled_time, start_time);
+    INSTR_TIME_SUBTRACT(rewritten_time, rewrite_start_time);
+    DEBUG_LOG("Planning costs (User ID=%u): compile %.3f ms, rewrite %.3f ms",
+              GetSessionUserId(),
+              INSTR_TIME_GET_MILLISEC(compiled_time),
+              INSTR_TIME_GET_MILLISEC(rewritten_time));
+#endif
+  }
 
   return plan;
 }
 
+static void pg_diffix_create_upper_paths(
+    PlannerInfo *root,
+    UpperRelationKind stage,
+    RelOptInfo *input_rel,
+    RelOptInfo *output_rel,
+    void *extra)
+{
+  if (prev_create_upper_paths_hook)
+    prev_create_upper_paths_hook(root, stage, input_rel, output_rel, extra);
+
+  /* Partial grouping paths are costed before the paths which combine them are built. */
+  if (stage == UPPERREL_GROUP_AGG || stage == UPPERREL_PARTIAL_GROUP_AGG)
+    cost_anonymizing_aggregation(root, input_rel, output_rel);
+}
+
+PGDLLEXPORT PG_FUNCTION_INFO_V1(planning_stats);
+
+Datum planning_stats(PG_FUNCTION_ARGS)
+{
+  TupleDesc tuple_desc;
+  if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+    FAILWITH("Function returning record called in context that cannot accept type record.");
+
+  Datum values[3];
+  bool is_null[3] = {false, false, false};
+  values[0] = Int64GetDatum((int64)g_planning_stats.statements);
+  values[1] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(g_planning_stats.compile_time));
+  values[2] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(g_planning_stats.rewrite_time));
+
+  HeapTuple tuple = heap_form_tuple(BlessTupleDesc(tuple_desc), values, is_null);
+  PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
+}
+
 static DefElem *make_bool_option(char *name, bool value)
 {
   Value *bool_string_value = value ? makeString("true") : makeString("false");
@@ -219,6 +276,9 @@ void hooks_init(void)
   prev_planner_hook = planner_hook;
   planner_hook = pg_diffix_planner;
 
+  prev_create_upper_paths_hook = create_upper_paths_hook;
+  create_upper_paths_hook = pg_diffix_create_upper_paths;
+
   prev_ProcessUtility_hook = ProcessUtility_hook;
   ProcessUtility_hook = pg_diffix_ProcessUtility;
 
@@ -242,6 +302,7 @@ void hooks_cleanup(void)
 {
   post_parse_analyze_hook = prev_post_parse_analyze_hook;
   planner_hook = prev_planner_hook;
+  create_upper_paths_hook = prev_create_upper_paths_hook;
   ProcessUtility_hook = prev_ProcessUtility_hook;
   ExecutorCheckPerms_hook = prev_ExecutorCheckPerms_hook;
   ExecutorStart_hook = prev_ExecutorStart_hook;
@@ -93,6 +93,9 @@ Expr *make_const_int64(int64 value)
 
 static ParamExternData *get_param_data(ParamListInfo bound_params, int one_based_paramid)
 {
+  if (bound_params == NULL || one_based_paramid > bound_params->numParams)
+    FAILWITH("No value found for parameter $%d.", one_based_paramid);
+
   if (bound_params->paramFetch != NULL)
     return bound_params->paramFetch(bound_params, one_based_paramid - 1, true, NULL);
   else
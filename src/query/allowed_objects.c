@@ -2,6 +2,7 @@
 
 #include "access/sysattr.h"
 #include "catalog/pg_type.h"
+#include "common/hashfn.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
 #include "utils/lsyscache.h"
@@ -177,8 +178,6 @@ typedef struct
   PGFunction func;      /* pointer to compiled function */
 } FmgrBuiltin;
 
-#define InvalidOidBuiltinMapping PG_UINT16_MAX
-
 #ifdef WIN32
 /* On Windows, FMGR exports have to be linked dynamically. */
 #define FMGRIMPORTTYPE PGDLLIMPORT
@@ -192,21 +191,6 @@ typedef struct
  */
 extern FMGRIMPORTTYPE const FmgrBuiltin fmgr_builtins[];
 extern FMGRIMPORTTYPE const int fmgr_nbuiltins;
-extern FMGRIMPORTTYPE const Oid fmgr_last_builtin_oid;
-extern FMGRIMPORTTYPE const uint16 fmgr_builtin_oid_index[];
-
-/* Taken from fmgr.c. */
-static const FmgrBuiltin *fmgr_isbuiltin(Oid id)
-{
-  if (id > fmgr_last_builtin_oid)
-    return NULL;
-
-  uint16 index = fmgr_builtin_oid_index[id];
-  if (index == InvalidOidBuiltinMapping)
-    return NULL;
-
-  return &fmgr_builtins[index];
-}
 
 static bool is_member_of(const char *s, const char *const array[], int length)
 {
@@ -218,118 +202,179 @@ static bool is_member_of(const char *s, const char *const array[], int length)
   return false;
 }
 
-static bool is_func_member_of(Oid funcoid, const FunctionByName func_array[], int length)
+/*-------------------------------------------------------------------------
+ * Allowed functions lookup
+ *-------------------------------------------------------------------------
+ */
+
+typedef enum FunctionFlags
+{
+  FUNCTION_ALLOWED = 1 << 0,                      /* Allowed in defining buckets */
+  FUNCTION_CAST = 1 << 1,                         /* Allowed cast */
+  FUNCTION_DECIMAL_INTEGER_CAST = 1 << 2,         /* Rounding cast, allowed as a cast of extracted values */
+  FUNCTION_EXTRACT = 1 << 3,                      /* Extracts a field of a date or time */
+  FUNCTION_SUBSTRING = 1 << 4,                    /* Built-in substring */
+  FUNCTION_IMPLICIT_RANGE_UNTRUSTED = 1 << 5,     /* Built-in implicit_range allowed for untrusted access */
+  FUNCTION_IMPLICIT_RANGE_UDF_UNTRUSTED = 1 << 6, /* UDF implicit_range allowed for untrusted access */
+} FunctionFlags;
+
+typedef struct FunctionEntry
+{
+  Oid funcid;       /* Entry key */
+  uint8 flags;      /* Combination of `FunctionFlags` */
+  int8 primary_arg; /* Index of the primary argument of allowed functions, -1 otherwise */
+  char status;      /* Required for hash table */
+} FunctionEntry;
+
+/*
+ * Declarations for HashTable<Oid, FunctionEntry>
+ */
+#define SH_PREFIX FunctionTable
+#define SH_ELEMENT_TYPE FunctionEntry
+#define SH_KEY funcid
+#define SH_KEY_TYPE Oid
+#define SH_EQUAL(tb, a, b) (a == b)
+#define SH_HASH_KEY(tb, key) murmurhash32(key)
+#define SH_SCOPE static inline
+#define SH_DECLARE
+#define SH_DEFINE
+#include "lib/simplehash.h"
+
+/*
+ * Functions with any special meaning, keyed by OID. Built-ins are listed by their C names above,
+ * which are resolved by a single scan of the built-ins table when the lookup table is built.
+ */
+static FunctionTable_hash *g_function_table = NULL;
+
+static void add_function(FunctionTable_hash *table, Oid funcid, uint8 flags, int primary_arg)
 {
-  const FmgrBuiltin *fmgr_builtin = fmgr_isbuiltin(funcoid);
-  if (fmgr_builtin != NULL)
+  bool found;
+  FunctionEntry *entry = FunctionTable_insert(table, funcid, &found);
+  if (!found)
   {
-    for (int i = 0; i < length; i++)
-    {
-      if (strcmp(func_array[i].name, fmgr_builtin->funcName) == 0)
-        return true;
-    }
+    entry->flags = 0;
+    entry->primary_arg = -1;
   }
 
-  return false;
+  entry->flags |= flags;
+  if (primary_arg >= 0)
+    entry->primary_arg = primary_arg;
 }
 
-static bool is_funcname_member_of(Oid funcoid, const char *const name_array[], int length)
+static void add_builtin(FunctionTable_hash *table, const FmgrBuiltin *builtin)
 {
-  const FmgrBuiltin *fmgr_builtin = fmgr_isbuiltin(funcoid);
-  if (fmgr_builtin != NULL)
-    return is_member_of(fmgr_builtin->funcName, name_array, length);
+  const char *name = builtin->funcName;
 
-  return false;
+  for (int i = 0; i < ARRAY_LENGTH(g_allowed_builtins); i++)
+  {
+    if (strcmp(g_allowed_builtins[i].name, name) == 0)
+      add_function(table, builtin->foid, FUNCTION_ALLOWED, g_allowed_builtins[i].primary_arg);
+  }
+
+  if (is_member_of(name, g_allowed_casts, ARRAY_LENGTH(g_allowed_casts)))
+    add_function(table, builtin->foid, FUNCTION_CAST, -1);
+  if (is_member_of(name, g_decimal_integer_casts, ARRAY_LENGTH(g_decimal_integer_casts)))
+    add_function(table, builtin->foid, FUNCTION_DECIMAL_INTEGER_CAST, -1);
+  if (is_member_of(name, g_extract_functions, ARRAY_LENGTH(g_extract_functions)))
+    add_function(table, builtin->foid, FUNCTION_EXTRACT, -1);
+  if (is_member_of(name, g_substring_builtins, ARRAY_LENGTH(g_substring_builtins)))
+    add_function(table, builtin->foid, FUNCTION_SUBSTRING, -1);
+  if (is_member_of(name, g_implicit_range_builtins_untrusted, ARRAY_LENGTH(g_implicit_range_builtins_untrusted)))
+    add_function(table, builtin->foid, FUNCTION_IMPLICIT_RANGE_UNTRUSTED, -1);
 }
 
-int primary_arg_index(Oid funcoid)
+static FunctionTable_hash *build_function_table(void)
 {
-  for (int i = 0; i < ARRAY_LENGTH(g_implicit_range_udfs); i++)
-  {
-    /* We ensured that our UDFs have the primary arg first. */
-    if (*g_implicit_range_udfs[i] == funcoid)
-      return 0;
-  }
+  /* OIDs of our UDFs are needed, which are loaded lazily. */
+  oid_cache_init();
 
-  const FmgrBuiltin *fmgr_builtin = fmgr_isbuiltin(funcoid);
-  if (fmgr_builtin != NULL)
-  {
-    for (int i = 0; i < ARRAY_LENGTH(g_allowed_builtins); i++)
-    {
-      if (strcmp(g_allowed_builtins[i].name, fmgr_builtin->funcName) == 0)
-        return g_allowed_builtins[i].primary_arg;
-    }
-  }
+  FunctionTable_hash *table = FunctionTable_create(TopMemoryContext, 128, NULL);
+
+  /* Several built-ins may share the same C function, so all of them are checked. */
+  for (int i = 0; i < fmgr_nbuiltins; i++)
+    add_builtin(table, &fmgr_builtins[i]);
 
   for (int i = 0; i < ARRAY_LENGTH(g_allowed_builtins_extra); i++)
-  {
-    if (g_allowed_builtins_extra[i].funcid == funcoid)
-      return g_allowed_builtins_extra[i].primary_arg;
-  }
+    add_function(table, g_allowed_builtins_extra[i].funcid, FUNCTION_ALLOWED, g_allowed_builtins_extra[i].primary_arg);
+
+  /* `date_part` for `date` is not in the built-ins table, see above. */
+  add_function(table, F_DATE_PART_TEXT_DATE, FUNCTION_EXTRACT, -1);
+
+  /* We ensured that our UDFs have the primary arg first. */
+  for (int i = 0; i < ARRAY_LENGTH(g_implicit_range_udfs); i++)
+    add_function(table, *g_implicit_range_udfs[i], FUNCTION_ALLOWED, 0);
+
+  for (int i = 0; i < ARRAY_LENGTH(g_implicit_range_udfs_untrusted); i++)
+    add_function(table, *g_implicit_range_udfs_untrusted[i], FUNCTION_IMPLICIT_RANGE_UDF_UNTRUSTED, -1);
+
+  return table;
+}
+
+static inline FunctionEntry *lookup_function(Oid funcoid)
+{
+  if (unlikely(g_function_table == NULL))
+    g_function_table = build_function_table();
+
+  return FunctionTable_lookup(g_function_table, funcoid);
+}
+
+static inline bool has_function_flags(Oid funcoid, uint8 flags)
+{
+  FunctionEntry *entry = lookup_function(funcoid);
+  return entry != NULL && (entry->flags & flags) != 0;
+}
+
+int primary_arg_index(Oid funcoid)
+{
+  FunctionEntry *entry = lookup_function(funcoid);
+  if (entry != NULL && entry->primary_arg >= 0)
+    return entry->primary_arg;
 
   FAILWITH("Cannot identify the primary argument position for funcid %u.", funcoid);
 }
 
 bool is_allowed_cast(const FuncExpr *func_expr)
 {
-  if (is_funcname_member_of(func_expr->funcid, g_allowed_casts, ARRAY_LENGTH(g_allowed_casts)))
+  FunctionEntry *entry = lookup_function(func_expr->funcid);
+  if (entry == NULL)
+    return false;
+
+  if (entry->flags & FUNCTION_CAST)
   {
     return true;
   }
-  else if (is_funcname_member_of(func_expr->funcid, g_decimal_integer_casts, ARRAY_LENGTH(g_decimal_integer_casts)))
+  else if (entry->flags & FUNCTION_DECIMAL_INTEGER_CAST)
   {
     /* Handle cases like `cast(extract(minute from ...) as integer)`. */
     Node *cast_arg = linitial(func_expr->args);
     if (IsA(cast_arg, FuncExpr))
-    {
-      FuncExpr *cast_arg_expr = (FuncExpr *)cast_arg;
-      if (is_funcname_member_of(cast_arg_expr->funcid, g_extract_functions, ARRAY_LENGTH(g_extract_functions)) ||
-          cast_arg_expr->funcid == F_DATE_PART_TEXT_DATE)
-        return true;
-    }
+      return has_function_flags(((FuncExpr *)cast_arg)->funcid, FUNCTION_EXTRACT);
   }
   return false;
 }
 
 bool is_implicit_range_udf_untrusted(Oid funcoid)
 {
-  for (int i = 0; i < ARRAY_LENGTH(g_implicit_range_udfs_untrusted); i++)
-  {
-    if (*g_implicit_range_udfs_untrusted[i] == funcoid)
-      return true;
-  }
-  return false;
+  return has_function_flags(funcoid, FUNCTION_IMPLICIT_RANGE_UDF_UNTRUSTED);
 }
 
 bool is_allowed_function(Oid funcoid)
 {
-  for (int i = 0; i < ARRAY_LENGTH(g_implicit_range_udfs); i++)
-  {
-    if (*g_implicit_range_udfs[i] == funcoid)
-      return true;
-  }
-
-  if (is_func_member_of(funcoid, g_allowed_builtins, ARRAY_LENGTH(g_allowed_builtins)))
+  if (has_function_flags(funcoid, FUNCTION_ALLOWED))
     return true;
 
-  for (int i = 0; i < ARRAY_LENGTH(g_allowed_builtins_extra); i++)
-  {
-    if (g_allowed_builtins_extra[i].funcid == funcoid)
-      return true;
-  }
-
   DEBUG_LOG("Rejecting usage of function %u.", funcoid);
   return false;
 }
 
 bool is_substring_builtin(Oid funcoid)
 {
-  return is_funcname_member_of(funcoid, g_substring_builtins, ARRAY_LENGTH(g_substring_builtins));
+  return has_function_flags(funcoid, FUNCTION_SUBSTRING);
 }
 
 bool is_implicit_range_builtin_untrusted(Oid funcoid)
 {
-  return is_funcname_member_of(funcoid, g_implicit_range_builtins_untrusted, ARRAY_LENGTH(g_implicit_range_builtins_untrusted));
+  return has_function_flags(funcoid, FUNCTION_IMPLICIT_RANGE_UNTRUSTED);
 }
 
 bool is_allowed_pg_catalog_rte(Oid relation_oid, const Bitmapset *selected_cols)
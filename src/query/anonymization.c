@@ -4,10 +4,13 @@
 #include "catalog/pg_class.h"
 #include "catalog/pg_type.h"
 #include "common/shortest_dec.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
 #include "optimizer/optimizer.h"
 #include "optimizer/tlist.h"
+#include "parser/parse_agg.h"
 #include "parser/parse_coerce.h"
 #include "parser/parse_oper.h"
 #include "parser/parsetree.h"
@@ -20,6 +23,7 @@
 #include "pg_diffix/aggregation/bucket_scan.h"
 #include "pg_diffix/aggregation/common.h"
 #include "pg_diffix/auth.h"
+#include "pg_diffix/config.h"
 #include "pg_diffix/node_funcs.h"
 #include "pg_diffix/oid_cache.h"
 #include "pg_diffix/query/allowed_objects.h"
@@ -409,19 +413,6 @@ static TargetEntry *make_aid_target(AidRef *aid_ref, AttrNumber resno, bool resj
   return te;
 }
 
-static PersonalRelation *find_relation(Oid rel_oid, List *relations)
-{
-  ListCell *cell;
-  foreach (cell, relations)
-  {
-    PersonalRelation *relation = (PersonalRelation *)lfirst(cell);
-    if (relation->oid == rel_oid)
-      return relation;
-  }
-
-  return NULL;
-}
-
 /*
  * Adds references targeting AIDs of relation to `aid_refs`.
  */
@@ -451,7 +442,7 @@ static void gather_relation_aids(
 }
 
 /* Collects and prepares AIDs for use in the current query's scope. */
-static List *gather_aid_refs(Query *query, List *relations)
+static List *gather_aid_refs(Query *query, List **relations)
 {
   List *aid_refs = NIL;
 
@@ -463,7 +454,7 @@ static List *gather_aid_refs(Query *query, List *relations)
 
     if (rte->rtekind == RTE_RELATION)
     {
-      PersonalRelation *relation = find_relation(rte->relid, relations);
+      PersonalRelation *relation = find_personal_relation(rte->relid, relations);
       if (relation != NULL)
         gather_relation_aids(relation, rte_index, rte, &aid_refs);
     }
@@ -472,10 +463,8 @@ static List *gather_aid_refs(Query *query, List *relations)
   return aid_refs;
 }
 
-static void reject_aid_grouping(Query *query)
+static void reject_aid_grouping(Query *query, List *grouping_exprs)
 {
-  List *grouping_exprs = get_sortgrouplist_exprs(query->groupClause, query->targetList);
-
   ListCell *cell;
   foreach (cell, grouping_exprs)
   {
@@ -517,25 +506,26 @@ static void append_aid_args(Aggref *aggref, List *aid_refs)
  *-------------------------------------------------------------------------
  */
 
-#define MAX_SEED_MATERIAL_SIZE 1024 /* Fixed max size, to avoid dynamic allocation. */
+#define MAX_SEED_MATERIAL_SIZE 1024 /* Longer materials are rejected. */
 
-static void append_seed_material(
-    char *existing_material, const char *new_material, char separator)
+static void append_seed_material(StringInfo material, const char *new_material, char separator)
 {
-  size_t existing_material_length = strlen(existing_material);
-  size_t new_material_length = strlen(new_material);
+  int new_material_length = strlen(new_material);
 
-  if (existing_material_length + new_material_length + 2 > MAX_SEED_MATERIAL_SIZE)
+  if (material->len + new_material_length + 2 > MAX_SEED_MATERIAL_SIZE)
     FAILWITH_CODE(ERRCODE_NAME_TOO_LONG, "Bucket seed material too long!");
 
-  if (existing_material_length > 0)
-    existing_material[existing_material_length++] = separator;
+  if (material->len > 0)
+    appendStringInfoChar(material, separator);
 
-  strcpy(existing_material + existing_material_length, new_material);
+  appendBinaryStringInfo(material, new_material, new_material_length);
 }
 
 static char *datum_seed_material(Oid type, Datum value, bool is_null)
 {
+  /* Values of domains are seeded like values of their base types. */
+  type = getBaseType(type);
+
   if (is_null)
   {
     char *value_as_string = palloc(sizeof(char) * (4 + 1));
@@ -567,13 +557,26 @@ static char *datum_seed_material(Oid type, Datum value, bool is_null)
   return OidOutputFunctionCall(type_output_funcid, value);
 }
 
+/*
+ * Seed material of an expression is built by appending pieces with separators.
+ * Values of parameters are known only at execution, so they are left out of the material.
+ * The material is split where they belong, and kept as a list of material runs (strings)
+ * interleaved with the parameters (`Param` nodes). Material without parameters is a single run.
+ */
 typedef struct CollectMaterialContext
 {
-  Query *query;
-  ParamListInfo bound_params;
-  char material[MAX_SEED_MATERIAL_SIZE];
+  Query *query;            /* Query of the expression */
+  StringInfoData material; /* Material collected so far, without parameter values */
+  int run_start;           /* Offset of the material following the last parameter */
+  List *pieces;            /* Runs and parameters preceding `run_start` */
 } CollectMaterialContext;
 
+static void split_material_run(CollectMaterialContext *context)
+{
+  context->pieces = lappend(context->pieces, makeString(pstrdup(context->material.data + context->run_start)));
+  context->run_start = context->material.len;
+}
+
 static void normalize_function_name(char *func_name)
 {
   if (strcmp(func_name, "date_part") == 0)
@@ -597,7 +600,7 @@ static bool collect_seed_material(Node *node, CollectMaterialContext *context)
       if (func_name)
       {
         normalize_function_name(func_name);
-        append_seed_material(context->material, func_name, ',');
+        append_seed_material(&context->material, func_name, ',');
         pfree(func_name);
       }
     }
@@ -612,23 +615,30 @@ static bool collect_seed_material(Node *node, CollectMaterialContext *context)
     /* TODO: Remove this check once anonymization over non-ordinary relations is rejected. */
     if (relation_name)
     {
-      append_seed_material(context->material, relation_name, ',');
+      append_seed_material(&context->material, relation_name, ',');
       pfree(relation_name);
     }
 
     char *attribute_name = get_rte_attribute_name(rte, var_expr->varattno);
-    append_seed_material(context->material, attribute_name, '.');
+    append_seed_material(&context->material, attribute_name, '.');
   }
 
-  if (is_stable_expression(node))
+  if (IsA(node, Param) && is_stable_expression(node))
+  {
+    /* Generalizations never start with a parameter, so its value always follows a separator. */
+    append_seed_material(&context->material, "", ',');
+    split_material_run(context);
+    context->pieces = lappend(context->pieces, copyObject(node));
+  }
+  else if (IsA(node, Const))
   {
     Oid type;
     Datum value;
     bool isnull;
-    get_stable_expression_value(node, context->bound_params, &type, &value, &isnull);
+    get_stable_expression_value(node, NULL, &type, &value, &isnull);
 
     char *value_as_string = datum_seed_material(type, value, isnull);
-    append_seed_material(context->material, value_as_string, ',');
+    append_seed_material(&context->material, value_as_string, ',');
     pfree(value_as_string);
   }
 
@@ -636,66 +646,228 @@ static bool collect_seed_material(Node *node, CollectMaterialContext *context)
   return expression_tree_walker(node, collect_seed_material, context);
 }
 
-static void collect_seed_material_hashes(Query *query, List *exprs, List **seed_material_hash_set, ParamListInfo bound_params)
+/* Appends the seed material of each expression to `seed_materials`. Returns true if any references parameters. */
+static bool collect_seed_materials(Query *query, List *exprs, List **seed_materials)
 {
+  bool has_params = false;
+
   ListCell *cell = NULL;
   foreach (cell, exprs)
   {
-    Node *expr = lfirst(cell);
+    CollectMaterialContext collect_context = {.query = query, .run_start = 0, .pieces = NIL};
+    initStringInfo(&collect_context.material);
+    collect_seed_material(lfirst(cell), &collect_context);
+    split_material_run(&collect_context);
+    pfree(collect_context.material.data);
+
+    *seed_materials = lappend(*seed_materials, collect_context.pieces);
+    has_params |= list_length(collect_context.pieces) > 1;
+  }
+
+  return has_params;
+}
+
+static hash_t hash_seed_material(List *pieces, ParamListInfo bound_params)
+{
+  if (list_length(pieces) == 1)
+    return hash_string(strVal(linitial(pieces)));
 
-    /* Start from empty string and append material pieces for each non-cast expression. */
-    CollectMaterialContext collect_context = {.query = query, .bound_params = bound_params, .material = ""};
-    collect_seed_material(expr, &collect_context);
+  /* Runs already hold the separators, parameter values are inserted between them. */
+  StringInfoData material;
+  initStringInfo(&material);
 
-    /* Keep materials with unique hashes to avoid them cancelling each other. */
-    hash_t seed_material_hash = hash_string(collect_context.material);
-    *seed_material_hash_set = hash_set_add(*seed_material_hash_set, seed_material_hash);
+  ListCell *cell = NULL;
+  foreach (cell, pieces)
+  {
+    Node *piece = lfirst(cell);
+    if (IsA(piece, Param))
+    {
+      Oid type;
+      Datum value;
+      bool isnull;
+      get_stable_expression_value(piece, bound_params, &type, &value, &isnull);
+
+      char *value_as_string = datum_seed_material(type, value, isnull);
+      appendStringInfoString(&material, value_as_string);
+      pfree(value_as_string);
+    }
+    else
+    {
+      appendStringInfoString(&material, strVal(piece));
+    }
   }
+
+  if (material.len + 1 > MAX_SEED_MATERIAL_SIZE)
+    FAILWITH_CODE(ERRCODE_NAME_TOO_LONG, "Bucket seed material too long!");
+
+  hash_t hash = hash_bytes(material.data, material.len);
+  pfree(material.data);
+  return hash;
 }
 
+/*
+ * Hashes the seed material of a label. Common types are hashed without going through
+ * `datum_seed_material`, avoiding catalog lookups and allocations, but the material is identical.
+ */
 static hash_t hash_label(Oid type, Datum value, bool is_null)
 {
-  char *value_as_string = datum_seed_material(type, value, is_null);
-  hash_t hash = hash_string(value_as_string);
-  pfree(value_as_string);
-  return hash;
+  if (is_null)
+    return hash_string("NULL");
+
+  switch (type)
+  {
+  case INT2OID:
+  case INT4OID:
+  case INT8OID:
+  case FLOAT4OID:
+  case FLOAT8OID:
+  {
+    char material[DOUBLE_SHORTEST_DECIMAL_LEN];
+    double_to_shortest_decimal_buf(numeric_value_to_double(type, value), material);
+    return hash_string(material);
+  }
+  case DATEOID:
+  case TIMEOID:
+  case TIMETZOID:
+  case TIMESTAMPOID:
+  case TIMESTAMPTZOID:
+  {
+    char material[MAXDATELEN + 1];
+    const int tzp = 0;
+    JsonEncodeDateTime(material, value, type, &tzp);
+    return hash_string(material);
+  }
+  case TEXTOID:
+  case VARCHAROID:
+  case BPCHAROID:
+  {
+    /* The output functions of these types return the text as is. */
+    text *text_value = DatumGetTextPP(value);
+    hash_t hash = hash_bytes(VARDATA_ANY(text_value), VARSIZE_ANY_EXHDR(text_value));
+    if ((Pointer)text_value != DatumGetPointer(value))
+      pfree(text_value);
+    return hash;
+  }
+  default:
+  {
+    char *value_as_string = datum_seed_material(type, value, is_null);
+    hash_t hash = hash_string(value_as_string);
+    pfree(value_as_string);
+    return hash;
+  }
+  }
 }
 
 /*
- * Computes the SQL part of the bucket seed by combining the unique bucket expressions' seed material hashes.
- * Extracts base labels from filtering equalities and stores the hashes for later consumption.
- * Grouping clause (if any) must be made explicit before calling this.
+ * Computes the SQL part of bucket seeds by combining the unique bucket expressions' seed material hashes.
  */
-static void prepare_bucket_seeds(Query *query, AnonymizationContext *anon_context, ParamListInfo bound_params)
+static void compute_sql_seeds(AnonymizationContext *anon_context, ParamListInfo bound_params)
 {
-  List *grouping_exprs = get_sortgrouplist_exprs(query->groupClause, query->targetList);
-  List *filtering_exprs = NIL, *filtering_consts = NIL;
-  collect_equalities_from_filters(query->jointree->quals, &filtering_exprs, &filtering_consts);
+  int num_grouping_cols = anon_context->grouping_cols_count;
+  int num_materials = list_length(anon_context->seed_materials);
+  hash_t *material_hashes = palloc(num_materials * sizeof(hash_t));
 
+  /* Keep materials with unique hashes to avoid them cancelling each other. */
   List *seed_material_hash_set = NIL;
-  collect_seed_material_hashes(query, grouping_exprs, &seed_material_hash_set, bound_params);
-  collect_seed_material_hashes(query, filtering_exprs, &seed_material_hash_set, bound_params);
+  ListCell *cell = NULL;
+  foreach (cell, anon_context->seed_materials)
+  {
+    int index = foreach_current_index(cell);
+    material_hashes[index] = hash_seed_material((List *)lfirst(cell), bound_params);
+    seed_material_hash_set = hash_set_add(seed_material_hash_set, material_hashes[index]);
+  }
   anon_context->sql_seed = hash_set_to_seed(seed_material_hash_set);
 
+  /* Each grouping set is seeded as if the query grouped only by the set's columns. */
+  for (int i = 0; i < anon_context->num_grouping_sets; i++)
+  {
+    List *set_seed_material_hash_set = NIL;
+    for (int j = 0; j < num_materials; j++)
+    {
+      /* Grouping columns come first, followed by filtering expressions. */
+      if (j >= num_grouping_cols || is_grouped_column(anon_context->grouping_set_ids[i], j, num_grouping_cols))
+        set_seed_material_hash_set = hash_set_add(set_seed_material_hash_set, material_hashes[j]);
+    }
+    anon_context->grouping_set_seeds[i] = hash_set_to_seed(set_seed_material_hash_set);
+    list_free(set_seed_material_hash_set);
+  }
+
+  list_free(seed_material_hash_set);
+  pfree(material_hashes);
+}
+
+/*
+ * Computes the SQL part of the bucket seed and extracts base labels from filtering equalities.
+ * Parts which depend on parameter values are left for `bind_anonymization_params`.
+ * Grouping clause (if any) must be made explicit before collecting the bucket expressions.
+ */
+static void prepare_bucket_seeds(Query *query, BucketExpressions *bucket_exprs, AnonymizationContext *anon_context)
+{
+  List *seed_materials = NIL;
+  bool has_params = collect_seed_materials(query, bucket_exprs->grouping_exprs, &seed_materials);
+  has_params |= collect_seed_materials(query, bucket_exprs->filtering_exprs, &seed_materials);
+
+  anon_context->seed_materials = seed_materials;
+  if (!has_params)
+  {
+    /* Seeds are the same for all executions. */
+    compute_sql_seeds(anon_context, NULL);
+    anon_context->seed_materials = NIL;
+  }
+
   ListCell *cell = NULL;
-  foreach (cell, filtering_consts)
+  foreach (cell, bucket_exprs->filtering_values)
   {
+    Node *value_node = unwrap_cast(lfirst(cell));
+    if (IsA(value_node, Param))
+    {
+      anon_context->param_labels = lappend(anon_context->param_labels, value_node);
+      continue;
+    }
+
     Oid type;
     Datum value;
     bool isnull;
-    get_stable_expression_value(unwrap_cast(lfirst(cell)), bound_params, &type, &value, &isnull);
+    get_stable_expression_value(value_node, NULL, &type, &value, &isnull);
 
     anon_context->base_labels_hash_set = hash_set_add(anon_context->base_labels_hash_set, hash_label(type, value, isnull));
   }
+}
 
-  list_free(seed_material_hash_set);
-  list_free(filtering_consts);
-  list_free(filtering_exprs);
-  list_free(grouping_exprs);
+void bind_anonymization_params(AnonymizationContext *anon_context, ParamListInfo bound_params)
+{
+  verify_param_bucket_expressions(anon_context->param_bucket_exprs, bound_params);
+
+  if (anon_context->seed_materials != NIL)
+  {
+    /* Seeds of the plan are shared by all its executions. */
+    anon_context->grouping_set_seeds = palloc(anon_context->num_grouping_sets * sizeof(seed_t));
+    compute_sql_seeds(anon_context, bound_params);
+  }
+
+  if (anon_context->param_labels != NIL)
+  {
+    anon_context->base_labels_hash_set = list_copy(anon_context->base_labels_hash_set);
+
+    ListCell *cell = NULL;
+    foreach (cell, anon_context->param_labels)
+    {
+      Oid type;
+      Datum value;
+      bool isnull;
+      get_stable_expression_value(lfirst(cell), bound_params, &type, &value, &isnull);
+
+      anon_context->base_labels_hash_set = hash_set_add(anon_context->base_labels_hash_set, hash_label(type, value, isnull));
+    }
+  }
 }
 
-seed_t compute_bucket_seed(const Bucket *bucket, const BucketDescriptor *bucket_desc)
+seed_t compute_bucket_seed(Bucket *bucket, const BucketDescriptor *bucket_desc)
 {
+  /* Labels never change, so the seed is computed once and shared by all aggregates of the bucket. */
+  if (bucket->has_seed)
+    return bucket->seed;
+
   List *label_hash_set = NIL;
   for (int i = 0; i < bucket_desc->num_labels; i++)
   {
@@ -708,6 +880,8 @@ seed_t compute_bucket_seed(const Bucket *bucket, const BucketDescriptor *bucket_
 
   list_free(label_hash_set);
 
+  bucket->seed = bucket_seed;
+  bucket->has_seed = true;
   return bucket_seed;
 }
 
@@ -716,7 +890,72 @@ seed_t compute_bucket_seed(const Bucket *bucket, const BucketDescriptor *bucket_
  *-------------------------------------------------------------------------
  */
 
-static AnonymizationContext *make_query_anonymizing(Query *query, List *personal_relations)
+/* GROUPING() accepts at most 31 arguments. */
+#define MAX_GROUPING_SET_COLUMNS 31
+
+/*
+ * Buckets of each grouping set are anonymized separately, as if they came from a query grouping by
+ * only the columns of that set. To tell the sets apart, the GROUPING() of all grouping columns
+ * is appended as a junk target entry.
+ */
+static void prepare_grouping_sets(Query *query, AnonymizationContext *anon_context)
+{
+  int num_columns = anon_context->grouping_cols_count;
+  if (num_columns > MAX_GROUPING_SET_COLUMNS)
+    FAILWITH_CODE(ERRCODE_FEATURE_NOT_SUPPORTED,
+                  "GROUPING SETS in anonymizing queries support at most %d grouping columns.", MAX_GROUPING_SET_COLUMNS);
+
+#if PG_VERSION_NUM >= 140000
+  List *grouping_sets = expand_grouping_sets(query->groupingSets, query->groupDistinct, -1);
+#else
+  List *grouping_sets = expand_grouping_sets(query->groupingSets, -1);
+#endif
+
+  anon_context->num_grouping_sets = list_length(grouping_sets);
+  anon_context->grouping_set_ids = palloc(anon_context->num_grouping_sets * sizeof(int));
+  anon_context->grouping_set_seeds = palloc0(anon_context->num_grouping_sets * sizeof(seed_t));
+
+  ListCell *set_cell = NULL;
+  foreach (set_cell, grouping_sets)
+  {
+    List *set_refs = (List *)lfirst(set_cell);
+    int set_index = foreach_current_index(set_cell);
+
+    int grouping_set_id = 0;
+    ListCell *clause_cell = NULL;
+    foreach (clause_cell, query->groupClause)
+    {
+      SortGroupClause *clause = lfirst_node(SortGroupClause, clause_cell);
+      if (!list_member_int(set_refs, clause->tleSortGroupRef))
+        grouping_set_id |= 1 << (num_columns - 1 - foreach_current_index(clause_cell));
+    }
+
+    /* Buckets of duplicate sets would be indistinguishable. */
+    for (int i = 0; i < set_index; i++)
+    {
+      if (anon_context->grouping_set_ids[i] == grouping_set_id)
+        FAILWITH_CODE(ERRCODE_FEATURE_NOT_SUPPORTED, "Duplicate grouping sets in anonymizing queries are not supported.");
+    }
+
+    anon_context->grouping_set_ids[set_index] = grouping_set_id;
+  }
+
+  GroupingFunc *grouping_func = makeNode(GroupingFunc);
+  ListCell *cell = NULL;
+  foreach (cell, query->groupClause)
+  {
+    SortGroupClause *clause = lfirst_node(SortGroupClause, cell);
+    TargetEntry *tle = get_sortgroupclause_tle(clause, query->targetList);
+    grouping_func->args = lappend(grouping_func->args, copyObject(tle->expr));
+    grouping_func->refs = lappend_int(grouping_func->refs, clause->tleSortGroupRef);
+  }
+  grouping_func->agglevelsup = 0;
+  grouping_func->location = -1; /* Unknown location. */
+
+  anon_context->grouping_id_col = add_junk_tle(query, (Expr *)grouping_func, "grouping_id")->resno;
+}
+
+static AnonymizationContext *make_query_anonymizing(Query *query, List **personal_relations)
 {
   List *aid_refs = gather_aid_refs(query, personal_relations);
   if (aid_refs == NIL)
@@ -753,6 +992,10 @@ static AnonymizationContext *make_query_anonymizing(Query *query, List *personal
   anon_context->grouping_cols = extract_grouping_cols(query->groupClause, query->targetList);
   anon_context->grouping_cols_count = list_length(query->groupClause);
 
+  /* Grouping sets made of only empty sets are repeated global aggregates. */
+  if (query->groupingSets != NIL && query->groupClause != NIL)
+    prepare_grouping_sets(query, anon_context);
+
   return anon_context;
 }
 
@@ -844,17 +1087,22 @@ static void wrap_having_qual(Query *query)
       COERCE_EXPLICIT_CALL);
 }
 
-static void compile_anonymizing_query(Query *query, List *personal_relations, AnonQueryLinks *anon_links, ParamListInfo bound_params)
+static void compile_anonymizing_query(Query *query, List **personal_relations, AnonQueryLinks *anon_links)
 {
-  verify_anonymization_requirements(query);
+  BucketExpressions bucket_exprs = {NIL};
+
+  verify_anonymization_requirements(query, &bucket_exprs);
 
   AnonymizationContext *anon_context = make_query_anonymizing(query, personal_relations);
 
-  reject_aid_grouping(query);
+  /* Implicit grouping is part of the grouping clause from now on. */
+  bucket_exprs.grouping_exprs = get_sortgrouplist_exprs(query->groupClause, query->targetList);
 
-  verify_bucket_expressions(query, bound_params);
+  reject_aid_grouping(query, bucket_exprs.grouping_exprs);
 
-  prepare_bucket_seeds(query, anon_context, bound_params);
+  anon_context->param_bucket_exprs = verify_bucket_expressions(&bucket_exprs);
+
+  prepare_bucket_seeds(query, &bucket_exprs, anon_context);
 
   link_anon_context(query, anon_links, anon_context);
 
@@ -878,21 +1126,15 @@ static bool are_qualifiers_always_false(Node *quals)
   return result->constisnull || DatumGetBool(result->constvalue) == false;
 }
 
-static bool is_anonymizing_query(Query *query, List *personal_relations)
+static bool is_anonymizing_query(Query *query, List **personal_relations)
 {
-  if (are_qualifiers_always_false(query->jointree->quals))
-    return false; /* No need for anonymization if no rows will be processed. */
-
   ListCell *cell;
   foreach (cell, query->rtable)
   {
     RangeTblEntry *rte = (RangeTblEntry *)lfirst(cell);
-    if (rte->rtekind == RTE_RELATION)
-    {
-      PersonalRelation *relation = find_relation(rte->relid, personal_relations);
-      if (relation != NULL)
-        return true;
-    }
+    if (rte->rtekind == RTE_RELATION && find_personal_relation(rte->relid, personal_relations) != NULL)
+      /* No need for anonymization if no rows will be processed. */
+      return !are_qualifiers_always_false(query->jointree->quals);
   }
 
   return false;
@@ -900,9 +1142,9 @@ static bool is_anonymizing_query(Query *query, List *personal_relations)
 
 typedef struct QueryCompileContext
 {
-  List *personal_relations;
-  AnonQueryLinks *anon_links;
-  ParamListInfo bound_params;
+  List *personal_relations;   /* Personal relations found so far */
+  List *anonymizing_queries;  /* Compiled anonymizing queries */
+  AnonQueryLinks *anon_links; /* Links of compiled queries */
 } QueryCompileContext;
 
 static bool compile_query_walker(Node *node, QueryCompileContext *context)
@@ -922,7 +1164,7 @@ static bool compile_query_walker(Node *node, QueryCompileContext *context)
      */
     RangeTblEntry *rte = (RangeTblEntry *)node;
 
-    if (rte->rtekind == RTE_SUBQUERY && is_anonymizing_query(rte->subquery, context->personal_relations))
+    if (rte->rtekind == RTE_SUBQUERY && list_member_ptr(context->anonymizing_queries, rte->subquery))
     {
       rte->security_barrier = true;
 
@@ -937,25 +1179,51 @@ static bool compile_query_walker(Node *node, QueryCompileContext *context)
   if (IsA(node, Query))
   {
     Query *query = (Query *)node;
-    if (is_anonymizing_query(query, context->personal_relations))
-      compile_anonymizing_query(query, context->personal_relations, context->anon_links, context->bound_params);
+    if (is_anonymizing_query(query, &context->personal_relations))
+    {
+      if (context->anonymizing_queries == NIL)
+      {
+        /* We load OIDs lazily because experimentation shows that UDFs may return INVALIDOID (0) during _PG_init. */
+        oid_cache_init();
+
+        /*
+         * Since we cannot easily validate cross-dependent parameters using GUC,
+         * we verify those here and fail if they are misconfigured.
+         */
+        config_validate();
+      }
+
+      DEBUG_LOG("Anonymizing query (User ID=%u) %s", GetSessionUserId(), nodeToString(query));
+
+      compile_anonymizing_query(query, &context->personal_relations, context->anon_links);
+      context->anonymizing_queries = lappend(context->anonymizing_queries, query);
+    }
     else
+    {
       query_tree_walker(query, compile_query_walker, context, QTW_EXAMINE_RTES_AFTER);
+    }
   }
 
   return expression_tree_walker(node, compile_query_walker, context);
 }
 
-AnonQueryLinks *compile_query(Query *query, List *personal_relations, ParamListInfo bound_params)
+AnonQueryLinks *compile_query(Query *query)
 {
   QueryCompileContext context = {
-      .personal_relations = personal_relations,
+      .personal_relations = NIL,
+      .anonymizing_queries = NIL,
       .anon_links = palloc0(sizeof(AnonQueryLinks)),
-      .bound_params = bound_params,
   };
 
   compile_query_walker((Node *)query, &context);
 
+  if (context.anonymizing_queries == NIL)
+  {
+    pfree(context.anon_links);
+    return NULL;
+  }
+
+  list_free(context.anonymizing_queries);
   return context.anon_links;
 }
 
@@ -1061,7 +1329,8 @@ Plan *rewrite_plan(Plan *plan, AnonQueryLinks *links)
     break;
   }
 
-  if (IsA(plan, Agg))
+  /* Partial states are combined by a Finalize Agg, which is where the BucketScan goes. */
+  if (IsA(plan, Agg) && !DO_AGGSPLIT_SKIPFINAL(((Agg *)plan)->aggsplit))
   {
     AnonymizationContext *anon_context = extract_anon_context(plan, links);
     if (anon_context != NULL)
@@ -0,0 +1,216 @@
+#include "postgres.h"
+
+#include "nodes/nodeFuncs.h"
+#include "optimizer/cost.h"
+#include "optimizer/pathnode.h"
+#include "utils/selfuncs.h"
+
+#include "pg_diffix/aggregation/common.h"
+#include "pg_diffix/query/costs.h"
+
+/*-------------------------------------------------------------------------
+ *
+ * Anonymizing aggregates track the contributions of every AID instance per bucket and count distinct
+ * keeps, in addition, the AIDs of every distinct value. Their transition functions are declared with
+ * a flat per-call cost in SQL. The work which grows with the number of AIDs and distinct values
+ * is added here to the grouping paths, where the planner compares hashed and sorted aggregation.
+ *
+ * Costs are charged in multiples of `cpu_operator_cost`:
+ *   - Each AID instance (and each counted value) of each aggregated row is hashed into the state.
+ *   - Each entry of a state is touched once when the state is serialized, merged, copied or finalized.
+ *
+ * A state holds one entry per distinct AID value of its bucket, for each AID instance.
+ * A count distinct state holds one entry per distinct counted value, for each AID instance.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+/* Cost inputs of an anonymizing aggregate. */
+typedef struct AnonAggCost
+{
+  int num_aids;           /* Number of AID instances */
+  double *aid_ndistinct;  /* Estimated number of distinct values of each AID instance */
+  bool is_count_distinct; /* Does the aggregate count distinct values? */
+  double value_ndistinct; /* Estimated number of distinct counted values, if counting distinct values */
+} AnonAggCost;
+
+static bool collect_anon_aggrefs_walker(Node *node, List **aggrefs)
+{
+  if (node == NULL)
+    return false;
+
+  /* Subqueries are planned separately. */
+  if (IsA(node, Query))
+    return false;
+
+  if (IsA(node, Aggref))
+  {
+    Aggref *aggref = (Aggref *)node;
+    if (aggref->agglevelsup == 0 && is_anonymizing_agg(aggref->aggfnoid))
+      *aggrefs = list_append_unique(*aggrefs, aggref);
+
+    return false;
+  }
+
+  return expression_tree_walker(node, collect_anon_aggrefs_walker, aggrefs);
+}
+
+/* Anonymizing aggregates take their own arguments first, followed by the AID instances. */
+static int num_value_args(const AnonAggFuncs *agg_funcs)
+{
+  if (agg_funcs == &g_count_histogram_funcs)
+    return 2; /* Counted AID index and bin size. */
+  else if (agg_funcs == &g_count_star_funcs || agg_funcs == &g_count_star_noise_funcs || agg_funcs == &g_low_count_funcs)
+    return 0;
+  else
+    return 1;
+}
+
+/* Uses `pg_statistic` if the expression is a column with statistics, otherwise a default estimate. */
+static double estimate_num_distinct(PlannerInfo *root, Expr *expr)
+{
+  VariableStatData vardata;
+  bool is_default;
+
+  examine_variable(root, (Node *)expr, 0, &vardata);
+  double num_distinct = get_variable_numdistinct(&vardata, &is_default);
+  ReleaseVariableStats(vardata);
+
+  return num_distinct;
+}
+
+static AnonAggCost *make_anon_agg_cost(PlannerInfo *root, Aggref *aggref)
+{
+  const AnonAggFuncs *agg_funcs = find_agg_funcs(aggref->aggfnoid);
+  int aids_offset = num_value_args(agg_funcs);
+
+  AnonAggCost *agg_cost = palloc0(sizeof(AnonAggCost));
+  agg_cost->num_aids = list_length(aggref->args) - aids_offset;
+  agg_cost->aid_ndistinct = palloc(agg_cost->num_aids * sizeof(double));
+  for (int i = 0; i < agg_cost->num_aids; i++)
+  {
+    Expr *aid_expr = list_nth_node(TargetEntry, aggref->args, aids_offset + i)->expr;
+    agg_cost->aid_ndistinct[i] = estimate_num_distinct(root, aid_expr);
+  }
+
+  agg_cost->is_count_distinct = agg_funcs == &g_count_distinct_funcs || agg_funcs == &g_count_distinct_noise_funcs;
+  if (agg_cost->is_count_distinct)
+    agg_cost->value_ndistinct = estimate_num_distinct(root, linitial_node(TargetEntry, aggref->args)->expr);
+
+  return agg_cost;
+}
+
+/* Estimates the number of entries of a state which aggregated the given number of rows. */
+static double state_entries(AnonAggCost *agg_cost, double rows)
+{
+  double entries = 0;
+  for (int i = 0; i < agg_cost->num_aids; i++)
+  {
+    double ndistinct = agg_cost->is_count_distinct ? agg_cost->value_ndistinct : agg_cost->aid_ndistinct[i];
+    entries += Min(ndistinct, rows);
+  }
+
+  return entries;
+}
+
+/*
+ * Returns the cost of the anonymizing aggregates of a path which groups `input_rows` rows into `num_groups` groups.
+ * When combining partial states, the input rows are states, which aggregated `aggregated_rows` rows in total.
+ */
+static Cost anon_aggs_cost(List *agg_costs, AggStrategy strategy, AggSplit aggsplit,
+                           double input_rows, double num_groups, double aggregated_rows)
+{
+  bool combine = DO_AGGSPLIT_COMBINE(aggsplit);
+  double group_rows = clamp_row_est((combine ? aggregated_rows : input_rows) / num_groups);
+  double cost = 0;
+
+  ListCell *cell;
+  foreach (cell, agg_costs)
+  {
+    AnonAggCost *agg_cost = (AnonAggCost *)lfirst(cell);
+    double group_entries = state_entries(agg_cost, group_rows);
+
+    if (combine)
+      cost += input_rows * state_entries(agg_cost, clamp_row_est(aggregated_rows / input_rows));
+    else
+      cost += input_rows * (agg_cost->num_aids + (agg_cost->is_count_distinct ? 1 : 0));
+
+    if (DO_AGGSPLIT_SERIALIZE(aggsplit))
+      cost += num_groups * group_entries; /* Partial states are passed on to the combining Agg. */
+    else if (strategy == AGG_HASHED || strategy == AGG_MIXED)
+      cost += 2 * num_groups * group_entries; /* BucketScan copies states out of the Agg's memory, then finalizes them. */
+    else
+      cost += num_groups * group_entries; /* BucketScan finalizes states. */
+  }
+
+  return cost * cpu_operator_cost;
+}
+
+static void add_anon_aggs_cost(Path *path, List *agg_costs, double aggregated_rows)
+{
+  Path *subpath;
+  AggStrategy strategy;
+  AggSplit aggsplit;
+
+  if (IsA(path, AggPath))
+  {
+    AggPath *agg_path = (AggPath *)path;
+    subpath = agg_path->subpath;
+    strategy = agg_path->aggstrategy;
+    aggsplit = agg_path->aggsplit;
+  }
+  else if (IsA(path, GroupingSetsPath))
+  {
+    GroupingSetsPath *grouping_sets_path = (GroupingSetsPath *)path;
+    subpath = grouping_sets_path->subpath;
+    strategy = grouping_sets_path->aggstrategy;
+    aggsplit = AGGSPLIT_SIMPLE;
+  }
+  else
+  {
+    return; /* Not an aggregation. */
+  }
+
+  Cost cost = anon_aggs_cost(agg_costs, strategy, aggsplit,
+                             clamp_row_est(subpath->rows), clamp_row_est(path->rows), aggregated_rows);
+
+  /* Hashed aggregation emits groups only after it consumed all of its input. */
+  if (strategy == AGG_HASHED || strategy == AGG_MIXED)
+    path->startup_cost += cost;
+  path->total_cost += cost;
+}
+
+static int compare_total_costs(const ListCell *a, const ListCell *b)
+{
+  return compare_path_costs((Path *)lfirst(a), (Path *)lfirst(b), TOTAL_COST);
+}
+
+void cost_anonymizing_aggregation(PlannerInfo *root, RelOptInfo *input_rel, RelOptInfo *grouped_rel)
+{
+  if (!root->parse->hasAggs)
+    return;
+
+  List *aggrefs = NIL;
+  collect_anon_aggrefs_walker((Node *)root->parse->targetList, &aggrefs);
+  collect_anon_aggrefs_walker(root->parse->havingQual, &aggrefs);
+
+  if (aggrefs == NIL)
+    return;
+
+  List *agg_costs = NIL;
+  ListCell *cell;
+  foreach (cell, aggrefs)
+    agg_costs = lappend(agg_costs, make_anon_agg_cost(root, (Aggref *)lfirst(cell)));
+
+  double aggregated_rows = clamp_row_est(input_rel->rows);
+
+  foreach (cell, grouped_rel->pathlist)
+    add_anon_aggs_cost((Path *)lfirst(cell), agg_costs, aggregated_rows);
+
+  foreach (cell, grouped_rel->partial_pathlist)
+    add_anon_aggs_cost((Path *)lfirst(cell), agg_costs, aggregated_rows);
+
+  /* Path lists are kept ordered by total cost, the cheapest partial path is taken from the front. */
+  list_sort(grouped_rel->pathlist, compare_total_costs);
+  list_sort(grouped_rel->partial_pathlist, compare_total_costs);
+}
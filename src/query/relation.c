@@ -1,11 +1,9 @@
 #include "postgres.h"
 
-#include "access/table.h"
 #include "catalog/namespace.h"
 #include "nodes/nodeFuncs.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
-#include "utils/rel.h"
 
 #include "pg_diffix/auth.h"
 #include "pg_diffix/query/relation.h"
@@ -18,44 +16,42 @@ static PersonalRelation *create_personal_relation(Oid rel_oid, Oid namespace_oid
   personal_rel->oid = rel_oid;
   personal_rel->aid_columns = NIL;
 
-  Relation rel = table_open(rel_oid, AccessShareLock);
-  TupleDesc rel_desc = RelationGetDescr(rel);
-
-  for (int i = 0; i < RelationGetNumberOfAttributes(rel); i++)
+  /* AID labels are cached, only the AID columns themselves are looked up. */
+  Bitmapset *aid_attnums = get_aid_columns(rel_oid);
+  int attnum = -1;
+  while ((attnum = bms_next_member(aid_attnums, attnum)) >= 0)
   {
-    Form_pg_attribute att = TupleDescAttr(rel_desc, i);
-
-    if (is_aid_column(rel_oid, att->attnum))
-    {
-      AidColumn *aid_col = palloc(sizeof(AidColumn));
-      aid_col->attnum = att->attnum;
-      aid_col->atttype = att->atttypid;
-      aid_col->typmod = att->atttypmod;
-      aid_col->collid = att->attcollation;
+    AidColumn *aid_col = palloc(sizeof(AidColumn));
+    aid_col->attnum = attnum;
+    get_atttypetypmodcoll(rel_oid, attnum, &aid_col->atttype, &aid_col->typmod, &aid_col->collid);
 
-      personal_rel->aid_columns = lappend(personal_rel->aid_columns, aid_col);
-    }
+    personal_rel->aid_columns = lappend(personal_rel->aid_columns, aid_col);
   }
 
-  table_close(rel, AccessShareLock);
+  bms_free(aid_attnums);
 
   return personal_rel;
 }
 
-static bool has_relation(List *relations, Oid rel_oid)
+PersonalRelation *find_personal_relation(Oid rel_oid, List **relations)
 {
   ListCell *cell;
-  foreach (cell, relations)
+  foreach (cell, *relations)
   {
-    PersonalRelation *rel = (PersonalRelation *)lfirst(cell);
-    if (rel->oid == rel_oid)
-      return true;
+    PersonalRelation *relation = (PersonalRelation *)lfirst(cell);
+    if (relation->oid == rel_oid)
+      return relation;
   }
 
-  return false;
+  if (!OidIsValid(rel_oid) || !is_personal_relation(rel_oid))
+    return NULL;
+
+  PersonalRelation *relation = create_personal_relation(rel_oid, get_rel_namespace(rel_oid));
+  *relations = lappend(*relations, relation);
+  return relation;
 }
 
-static bool gather_personal_relations_walker(Node *node, List **relations)
+static bool involves_personal_relations_walker(Node *node, void *context)
 {
   if (node == NULL)
     return false;
@@ -63,30 +59,19 @@ static bool gather_personal_relations_walker(Node *node, List **relations)
   if (IsA(node, RangeTblEntry))
   {
     RangeTblEntry *rte = (RangeTblEntry *)node;
-    if (!OidIsValid(rte->relid) || has_relation(*relations, rte->relid))
-      return false;
-
-    Oid namespace_oid = get_rel_namespace(rte->relid);
-    if (is_personal_relation(rte->relid))
-    {
-      PersonalRelation *rel_data = create_personal_relation(rte->relid, namespace_oid);
-      *relations = lappend(*relations, rel_data);
-    }
-    return false;
+    return OidIsValid(rte->relid) && is_personal_relation(rte->relid);
   }
   else if (IsA(node, Query))
   {
-    return query_tree_walker((Query *)node, gather_personal_relations_walker, relations, QTW_EXAMINE_RTES_BEFORE);
+    return query_tree_walker((Query *)node, involves_personal_relations_walker, context, QTW_EXAMINE_RTES_BEFORE);
   }
   else
   {
-    return expression_tree_walker(node, gather_personal_relations_walker, relations);
+    return expression_tree_walker(node, involves_personal_relations_walker, context);
   }
 }
 
-List *gather_personal_relations(Query *query)
+bool involves_personal_relations(Query *query)
 {
-  List *relations = NIL;
-  gather_personal_relations_walker((Node *)query, &relations);
-  return relations;
+  return involves_personal_relations_walker((Node *)query, NULL);
 }
@@ -7,7 +7,6 @@
 #include "miscadmin.h"
 #include "nodes/nodeFuncs.h"
 #include "optimizer/optimizer.h"
-#include "optimizer/tlist.h"
 #include "parser/parse_coerce.h"
 #include "parser/parsetree.h"
 #include "utils/builtins.h"
@@ -28,7 +27,7 @@
       FAILWITH("Feature '%s' is not currently supported.", (feature)); \
   } while (0)
 
-static void verify_where(Query *query);
+static void verify_where(Query *query, BucketExpressions *bucket_exprs);
 static void verify_select_targets(Query *query);
 static void verify_aggregators(Query *query);
 static void verify_non_system_column(Var *var);
@@ -73,7 +72,8 @@ void verify_explain_options(ExplainStmt *explain)
     DefElem *option = lfirst_node(DefElem, cell);
     if (option_matches(option, "costs", true))
       FAILWITH("COSTS option is not allowed for queries involving personal tables");
-    if (option_matches(option, "analyze", true))
+    /* Superusers can read the data directly, so the actual row counts reveal nothing new to them. */
+    if (option_matches(option, "analyze", true) && !superuser())
       FAILWITH("EXPLAIN ANALYZE is not allowed for queries involving personal tables");
   }
 }
@@ -92,19 +92,18 @@ bool verify_pg_catalog_access(List *range_tables)
   return true;
 }
 
-void verify_anonymization_requirements(Query *query)
+void verify_anonymization_requirements(Query *query, BucketExpressions *bucket_exprs)
 {
   NOT_SUPPORTED(query->commandType != CMD_SELECT, "non-select query");
   NOT_SUPPORTED(query->cteList, "WITH");
   NOT_SUPPORTED(query->hasForUpdate, "FOR [KEY] UPDATE/SHARE");
   NOT_SUPPORTED(query->hasSubLinks, "SubLinks");
   NOT_SUPPORTED(query->hasTargetSRFs, "SRF functions");
-  NOT_SUPPORTED(query->groupingSets, "GROUPING SETS");
   NOT_SUPPORTED(query->windowClause, "window functions");
   NOT_SUPPORTED(query->distinctClause, "DISTINCT");
   NOT_SUPPORTED(query->setOperations, "UNION/INTERSECT/EXCEPT");
 
-  verify_where(query);
+  verify_where(query, bucket_exprs);
   verify_aggregators(query);
   verify_select_targets(query);
 }
@@ -375,25 +374,47 @@ static void verify_untrusted_bucket_expression(Node *node, ParamListInfo bound_p
   }
 }
 
+static bool contain_extern_params_walker(Node *node, void *context)
+{
+  if (node == NULL)
+    return false;
+
+  if (IsA(node, Param) && ((Param *)node)->paramkind == PARAM_EXTERN)
+    return true;
+
+  return expression_tree_walker(node, contain_extern_params_walker, context);
+}
+
 /* Should be run on anonymizing queries only. */
-void verify_bucket_expressions(Query *query, ParamListInfo bound_params)
+List *verify_bucket_expressions(BucketExpressions *bucket_exprs)
 {
   AccessLevel access_level = get_session_access_level();
+  List *param_exprs = NIL;
 
-  List *exprs_list = NIL;
-  if (query->groupClause != NIL)
-    /* Buckets were either explicitly defined, or implicitly defined and rewritten. */
-    exprs_list = get_sortgrouplist_exprs(query->groupClause, query->targetList);
-  /* Else we have the global bucket, nothing to check. */
-
+  /* Buckets were either explicitly defined, or implicitly defined and rewritten. Global buckets have no expressions. */
   ListCell *cell;
-  foreach (cell, exprs_list)
+  foreach (cell, bucket_exprs->grouping_exprs)
   {
     Node *expr = (Node *)lfirst(cell);
     verify_bucket_expression(expr);
     if (access_level == ACCESS_ANONYMIZED_UNTRUSTED)
-      verify_untrusted_bucket_expression(expr, bound_params);
+    {
+      /* Plans are reused for different parameter values, which are known only at execution. */
+      if (contain_extern_params_walker(expr, NULL))
+        param_exprs = lappend(param_exprs, expr);
+      else
+        verify_untrusted_bucket_expression(expr, NULL);
+    }
   }
+
+  return param_exprs;
+}
+
+void verify_param_bucket_expressions(List *exprs, ParamListInfo bound_params)
+{
+  ListCell *cell;
+  foreach (cell, exprs)
+    verify_untrusted_bucket_expression((Node *)lfirst(cell), bound_params);
 }
 
 bool is_supported_numeric_type(Oid type)
@@ -491,7 +512,7 @@ static void verify_column_usage_in_filter(AccessLevel access_level, Node *bucket
                       "Column marked `not_filterable` can't be referenced by pre-anonymization filters in untrusted-mode.");
 }
 
-static void verify_where(Query *query)
+static void verify_where(Query *query, BucketExpressions *bucket_exprs)
 {
   AccessLevel access_level = get_session_access_level();
 
@@ -513,6 +534,6 @@ static void verify_where(Query *query)
     }
   }
 
-  list_free(subjects);
-  list_free(targets);
+  bucket_exprs->filtering_exprs = subjects;
+  bucket_exprs->filtering_values = targets;
 }
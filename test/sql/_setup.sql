@@ -53,3 +53,37 @@ GRANT SELECT ON ALL TABLES IN SCHEMA public TO diffix_test;
 
 -- Allow SELECT on future test-specific tables.
 ALTER DEFAULT PRIVILEGES IN SCHEMA public GRANT SELECT ON TABLES TO diffix_test;
+
+-- Returns the execution statistics of the BucketScan of a query, without the ones which vary between runs.
+-- EXPLAIN ANALYZE of anonymizing queries is allowed only for superusers.
+CREATE FUNCTION bucket_scan_stats(query text)
+RETURNS TABLE (name text, value jsonb)
+LANGUAGE plpgsql AS $$
+DECLARE
+  plan json;
+BEGIN
+  EXECUTE 'EXPLAIN (ANALYZE, TIMING false, SUMMARY false, FORMAT JSON) ' || query INTO plan;
+  RETURN QUERY
+    SELECT s.key, s.value
+    FROM jsonb_each(jsonb_path_query_first(plan::jsonb, '$.** ? (@."Custom Plan Provider" == "BucketScan")')) s
+    WHERE s.key IN ('Streaming', 'Grouping Sets', 'Buckets', 'Low Count Buckets', 'Cache Hits', 'Cache Misses',
+                    'LED Merged Buckets', 'LED Merges', 'Star Bucket Merged Buckets', 'Spilled Buckets', 'Shared States')
+    ORDER BY s.key COLLATE "C";
+END;
+$$;
+
+-- Returns the names of the peak memory usages reported by the BucketScan of a query, which vary between runs.
+CREATE FUNCTION bucket_scan_memory_stats(query text)
+RETURNS SETOF text
+LANGUAGE plpgsql AS $$
+DECLARE
+  plan json;
+BEGIN
+  EXECUTE 'EXPLAIN (ANALYZE, TIMING false, SUMMARY false, FORMAT JSON) ' || query INTO plan;
+  RETURN QUERY
+    SELECT s.key
+    FROM jsonb_object_keys(jsonb_path_query_first(plan::jsonb, '$.** ? (@."Custom Plan Provider" == "BucketScan")')) s(key)
+    WHERE s.key LIKE 'Peak Memory Usage%'
+    ORDER BY s.key COLLATE "C";
+END;
+$$;
@@ -23,6 +23,84 @@ SET pg_diffix.top_count_max = 4;
 -- Reject unsupported column types during AID labeling
 SECURITY LABEL FOR pg_diffix ON COLUMN test_customers.discount IS 'aid';
 
+-- Label changes apply to later queries in the same session
+CREATE TABLE test_relabel (id INTEGER, user_id INTEGER, city TEXT);
+INSERT INTO test_relabel SELECT i, i % 5, 'Berlin' FROM generate_series(1, 15) i;
+CALL diffix.mark_personal('public.test_relabel', 'id');
+CALL diffix.mark_not_filterable('public.test_relabel', 'city');
+
+SET pg_diffix.strict = false;
+SET pg_diffix.noise_layer_sd = 0;
+SET pg_diffix.low_count_layer_sd = 0;
+SET pg_diffix.outlier_count_min = 1;
+SET pg_diffix.outlier_count_max = 1;
+SET pg_diffix.top_count_min = 3;
+SET pg_diffix.top_count_max = 3;
+
+SET pg_diffix.session_access_level = 'anonymized_untrusted';
+SELECT COUNT(*) FROM test_relabel WHERE user_id = 1;
+SELECT COUNT(*) FROM test_relabel WHERE city = 'Berlin';
+
+-- Change AID and filterable columns
+SET pg_diffix.session_access_level = 'direct';
+CALL diffix.mark_personal('public.test_relabel', 'user_id');
+CALL diffix.mark_filterable('public.test_relabel', 'city');
+SET pg_diffix.session_access_level = 'anonymized_untrusted';
+SELECT COUNT(*) FROM test_relabel WHERE user_id = 1;
+SELECT COUNT(*) FROM test_relabel WHERE city = 'Berlin';
+
+-- Unmark the table
+SET pg_diffix.session_access_level = 'direct';
+CALL diffix.unmark_table('public.test_relabel');
+SET pg_diffix.session_access_level = 'anonymized_untrusted';
+SELECT COUNT(*) FROM test_relabel;
+
+-- Mark the table as public
+SET pg_diffix.session_access_level = 'direct';
+CALL diffix.mark_public('public.test_relabel');
+SET pg_diffix.session_access_level = 'anonymized_untrusted';
+SELECT COUNT(*) FROM test_relabel WHERE id = 1;
+
+RESET pg_diffix.session_access_level;
+DROP TABLE test_relabel;
+RESET pg_diffix.top_count_max;
+RESET pg_diffix.top_count_min;
+RESET pg_diffix.outlier_count_max;
+RESET pg_diffix.outlier_count_min;
+RESET pg_diffix.low_count_layer_sd;
+RESET pg_diffix.noise_layer_sd;
+RESET pg_diffix.strict;
+
+-- Role labels apply when switching to the role in the same backend
+SET SESSION AUTHORIZATION diffix_test;
+SELECT diffix.access_level();
+RESET SESSION AUTHORIZATION;
+RESET pg_diffix.session_access_level;
+CALL diffix.mark_role('diffix_test', 'anonymized_untrusted');
+SET SESSION AUTHORIZATION diffix_test;
+SELECT diffix.access_level();
+SET pg_diffix.session_access_level = 'anonymized_trusted';
+RESET SESSION AUTHORIZATION;
+RESET pg_diffix.session_access_level;
+CALL diffix.mark_role('diffix_test', 'anonymized_trusted');
+SET SESSION AUTHORIZATION diffix_test;
+SET pg_diffix.session_access_level = 'anonymized_trusted';
+SELECT diffix.access_level();
+RESET SESSION AUTHORIZATION;
+RESET pg_diffix.session_access_level;
+
+-- Extension presence is rechecked in the same backend
+DROP EXTENSION pg_diffix;
+SET pg_diffix.session_access_level = 'anonymized_trusted';
+CREATE EXTENSION pg_diffix;
+SET pg_diffix.session_access_level = 'anonymized_trusted';
+SELECT diffix.access_level();
+RESET pg_diffix.session_access_level;
+DO $$ BEGIN
+  -- Creating the extension generates a new salt, restore the fixed one.
+  EXECUTE 'ALTER DATABASE ' || current_database() || ' SET pg_diffix.salt TO ''diffix''';
+END $$ LANGUAGE plpgsql;
+
 -- Restriction on users with access level below `direct`
 SET ROLE diffix_test;
 SET pg_diffix.session_access_level = 'anonymized_trusted';
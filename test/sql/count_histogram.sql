@@ -27,6 +27,7 @@ EXECUTE add_rows(8, 6);   -- 1 user contributes 6 rows
 EXECUTE add_rows(9, 7);   -- 1 user contributes 7 rows
 EXECUTE add_rows(10, 13); -- 1 user contributes 13 rows
 
+ANALYZE count_histogram_test;
 CALL diffix.mark_personal('count_histogram_test', 'id');
 
 ----------------------------------------------------------------
@@ -36,6 +37,22 @@ CALL diffix.mark_personal('count_histogram_test', 'id');
 SELECT diffix.count_histogram(id) FROM count_histogram_test;
 SELECT diffix.count_histogram(id, 5) FROM count_histogram_test;
 
+-- Parallel aggregation gives identical results
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+
+EXPLAIN (COSTS off) SELECT diffix.count_histogram(id) FROM count_histogram_test;
+
+SELECT diffix.count_histogram(id) FROM count_histogram_test;
+SELECT diffix.count_histogram(id, 5) FROM count_histogram_test;
+
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
+
 ----------------------------------------------------------------
 -- Anonymizing count_histogram
 ----------------------------------------------------------------
@@ -58,12 +58,39 @@ CREATE TABLE led_with_star_bucket AS TABLE led_with_victim;
 INSERT INTO led_with_star_bucket VALUES
   (22, 'biol', 'f', 'asst'), (23, 'chem', 'm', 'asst'), (24, 'biol', 'f', 'prof');
 
+CREATE TABLE led_many_buckets AS SELECT i AS id, i % 2000 AS bucket FROM generate_series(1, 10000) i;
+
+CREATE TABLE led_spilled AS TABLE led_with_star_bucket;
+INSERT INTO led_spilled SELECT 100 + i, 'zz' || (i % 2000), 'x', 'y' FROM generate_series(0, 9999) i;
+
+CREATE TABLE led_one_sibling AS TABLE led_base WITH NO DATA;
+INSERT INTO led_one_sibling VALUES
+  (1, 'math', 'f', 'prof'), (2, 'math', 'f', 'prof'), (3, 'math', 'f', 'prof'), (4, 'math', 'f', 'prof'),
+  (5, 'cs', 'm', 'asst'), (6, 'cs', 'm', 'asst'), (7, 'cs', 'm', 'asst'), (8, 'cs', 'm', 'asst'),
+  (9, 'cs', 'f', 'prof');
+
+CREATE TABLE led_two_siblings AS TABLE led_one_sibling;
+INSERT INTO led_two_siblings VALUES
+  (10, 'history', 'f', 'prof'), (11, 'history', 'f', 'prof'), (12, 'history', 'f', 'prof'), (13, 'history', 'f', 'prof');
+
+CREATE TABLE led_siblings_in_columns AS TABLE led_base WITH NO DATA;
+INSERT INTO led_siblings_in_columns VALUES
+  (1, 'math', 'f', 'prof'), (2, 'math', 'f', 'prof'), (3, 'math', 'f', 'prof'), (4, 'math', 'f', 'prof'),
+  (5, 'cs', 'm', 'prof'), (6, 'cs', 'm', 'prof'), (7, 'cs', 'm', 'prof'), (8, 'cs', 'm', 'prof'),
+  (9, 'math', 'm', 'prof'), (10, 'math', 'm', 'prof'), (11, 'math', 'm', 'prof'), (12, 'math', 'm', 'prof'),
+  (13, 'cs', 'f', 'prof');
+
 CALL diffix.mark_personal('led_base', 'id');
 CALL diffix.mark_personal('led_with_victim', 'id');
 CALL diffix.mark_personal('led_with_two_victims', 'id');
 CALL diffix.mark_personal('led_with_three_cs_women', 'id');
 CALL diffix.mark_personal('led_with_different_titles', 'id');
 CALL diffix.mark_personal('led_with_star_bucket', 'id');
+CALL diffix.mark_personal('led_many_buckets', 'id');
+CALL diffix.mark_personal('led_spilled', 'id');
+CALL diffix.mark_personal('led_one_sibling', 'id');
+CALL diffix.mark_personal('led_two_siblings', 'id');
+CALL diffix.mark_personal('led_siblings_in_columns', 'id');
 
 SET ROLE diffix_test;
 SET pg_diffix.session_access_level = 'anonymized_trusted';
@@ -96,6 +123,21 @@ SELECT dept, gender, title, count(*)
 FROM led_with_star_bucket
 GROUP BY 1, 2, 3;
 
+----------------------------------------------------------------
+-- Siblings
+----------------------------------------------------------------
+
+-- A single sibling in a column isolates the victim, two siblings don't.
+SELECT * FROM (SELECT dept, gender, title, count(*) FROM led_one_sibling GROUP BY 1, 2, 3) x
+ORDER BY dept COLLATE "C", gender COLLATE "C", title COLLATE "C";
+
+SELECT * FROM (SELECT dept, gender, title, count(*) FROM led_two_siblings GROUP BY 1, 2, 3) x
+ORDER BY dept COLLATE "C", gender COLLATE "C", title COLLATE "C";
+
+-- The victim is merged into the single siblings of all isolating columns.
+SELECT * FROM (SELECT dept, gender, title, count(*) FROM led_siblings_in_columns GROUP BY 1, 2, 3) x
+ORDER BY dept COLLATE "C", gender COLLATE "C", title COLLATE "C";
+
 ----------------------------------------------------------------
 -- Other queries
 ----------------------------------------------------------------
@@ -109,3 +151,97 @@ FROM led_with_victim
 GROUP BY 1, 2, 3;
 
 SELECT count(*) FROM led_with_victim;
+
+----------------------------------------------------------------
+-- Grouping sets
+----------------------------------------------------------------
+
+-- Each set has its own LED and star bucket.
+SELECT * FROM (
+  SELECT GROUPING(dept, gender, title) AS g, dept, gender, title, count(*)
+  FROM led_with_star_bucket
+  GROUP BY ROLLUP (dept, gender, title)
+) x
+ORDER BY g, dept COLLATE "C", gender COLLATE "C", title COLLATE "C";
+
+-- Buckets of each set match the equivalent separate GROUP BY queries.
+SELECT dept, gender, title, count(*)
+FROM led_with_star_bucket
+GROUP BY ROLLUP (dept, gender, title)
+EXCEPT
+(
+  SELECT dept, gender, title, count(*) FROM led_with_star_bucket GROUP BY 1, 2, 3
+  UNION ALL
+  SELECT dept, gender, NULL, count FROM (SELECT dept, gender, count(*) FROM led_with_star_bucket GROUP BY 1, 2) x
+  UNION ALL
+  SELECT dept, NULL, NULL, count FROM (SELECT dept, count(*) FROM led_with_star_bucket GROUP BY 1) x
+  UNION ALL
+  SELECT NULL, NULL, NULL, count FROM (SELECT count(*) FROM led_with_star_bucket) x
+);
+
+----------------------------------------------------------------
+-- Spilled buckets
+----------------------------------------------------------------
+
+SET enable_hashagg = off;
+SET work_mem = '64kB';
+
+SELECT dept, gender, title, count(*)
+FROM led_with_star_bucket
+GROUP BY 1, 2, 3;
+
+-- LED and the star bucket read buckets back from disk.
+SELECT * FROM (SELECT dept, gender, title, count(*) FROM led_spilled GROUP BY 1, 2, 3) x
+ORDER BY dept COLLATE "C", gender COLLATE "C", title COLLATE "C"
+LIMIT 6;
+
+RESET enable_hashagg;
+
+-- States of hashed aggregation are spilled from the Agg's memory.
+SELECT * FROM (SELECT dept, gender, title, count(*) FROM led_spilled GROUP BY 1, 2, 3) x
+ORDER BY dept COLLATE "C", gender COLLATE "C", title COLLATE "C"
+LIMIT 6;
+
+RESET work_mem;
+
+----------------------------------------------------------------
+-- Parallel siblings search
+----------------------------------------------------------------
+
+SET pg_diffix.led_parallel_workers = 2;
+SET pg_diffix.led_parallel_min_buckets = 0;
+
+-- Workers find the same siblings as the backend alone.
+SELECT dept, gender, title, count(*)
+FROM led_with_victim
+GROUP BY 1, 2, 3;
+
+SELECT dept, gender, title, count(*)
+FROM led_with_star_bucket
+GROUP BY 1, 2, 3;
+
+RESET pg_diffix.led_parallel_workers;
+RESET pg_diffix.led_parallel_min_buckets;
+
+----------------------------------------------------------------
+-- Scan statistics
+----------------------------------------------------------------
+
+RESET ROLE;
+
+SELECT * FROM bucket_scan_stats('SELECT dept, gender, title, count(*), diffix.count_noise(*) FROM led_with_star_bucket GROUP BY 1, 2, 3');
+
+SELECT * FROM bucket_scan_stats('SELECT dept, gender, title, count(*) FROM led_with_star_bucket GROUP BY ROLLUP (dept, gender, title)');
+
+SELECT * FROM bucket_scan_memory_stats('SELECT dept, count(*), count(DISTINCT title) FROM led_with_star_bucket GROUP BY 1');
+
+SET enable_hashagg = off;
+SET work_mem = '64kB';
+
+SELECT * FROM bucket_scan_stats('SELECT bucket, count(*) FROM led_many_buckets GROUP BY 1') WHERE name <> 'Spilled Buckets';
+SELECT value::integer > 0 AS spilled FROM bucket_scan_stats('SELECT bucket, count(*) FROM led_many_buckets GROUP BY 1') WHERE name = 'Spilled Buckets';
+SELECT count(*), min(count), max(count) FROM (SELECT bucket, count(*) FROM led_many_buckets GROUP BY 1) x;
+SELECT * FROM bucket_scan_stats('SELECT dept, gender, title, count(*) FROM led_spilled GROUP BY 1, 2, 3') WHERE name <> 'Low Count Buckets' AND name <> 'Streaming';
+
+RESET enable_hashagg;
+RESET work_mem;
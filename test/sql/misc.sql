@@ -104,6 +104,12 @@ SELECT id FROM test_customers WHERE NULL = NULL;
 -- JOIN between personal tables produces multiple AIDs
 EXPLAIN VERBOSE SELECT COUNT(*) FROM test_customers c JOIN test_purchases pur ON c.id = cid;
 
+-- Planning costs of anonymizing statements are counted per backend
+SELECT statements AS planned_statements FROM diffix.planning_stats() \gset
+SELECT count > 0 AS counted FROM (SELECT COUNT(*) FROM test_customers) x;
+SELECT statements - :planned_statements AS statements, compile_time >= 0 AS compile_time, rewrite_time >= 0 AS rewrite_time
+FROM diffix.planning_stats();
+
 -- Tolerate `diffix.agg_noise` in direct access level
 SET pg_diffix.session_access_level = 'direct';
 SELECT diffix.sum_noise(discount), diffix.count_noise(*) FROM test_customers;
@@ -14,6 +14,27 @@ CREATE TABLE test_customers_mixed AS SELECT id, city, discount - 1.0 as discount
 CALL diffix.mark_personal('public.test_customers_negative', 'id');
 CALL diffix.mark_personal('public.test_customers_mixed', 'id');
 
+-- Tables with the same data for text and integer AIDs
+CREATE TABLE test_text_aids AS SELECT 'aid-' || (i % 40) AS aid, 'v' || (i % 6) AS value, i % 2 AS grp FROM generate_series(0, 479) i;
+CREATE TABLE test_int_aids AS SELECT i % 40 AS aid, 'v' || (i % 6) AS value, i % 2 AS grp FROM generate_series(0, 479) i;
+CALL diffix.mark_personal('public.test_text_aids', 'aid');
+CALL diffix.mark_personal('public.test_int_aids', 'aid');
+
+-- Table with many buckets for rescans
+CREATE TABLE test_rescans AS SELECT i AS id, i % 1000 AS bucket FROM generate_series(1, 5000) i;
+CALL diffix.mark_personal('public.test_rescans', 'id');
+
+-- Fixed statistics for the parallel plans
+ANALYZE test_customers;
+
+-- Table with a low count bucket merged by LED and a star bucket
+CREATE TABLE test_led AS
+SELECT row_number() OVER () AS id, dept, gender, title
+FROM (VALUES ('math', 'm', 'prof'), ('math', 'f', 'prof'), ('history', 'm', 'prof'), ('history', 'f', 'prof'), ('cs', 'm', 'prof')) v(dept, gender, title),
+  generate_series(1, 4);
+INSERT INTO test_led VALUES (21, 'cs', 'f', 'prof'), (22, 'biol', 'f', 'asst'), (23, 'chem', 'm', 'asst'), (24, 'biol', 'f', 'prof');
+CALL diffix.mark_personal('public.test_led', 'id');
+
 SET ROLE diffix_test;
 SET pg_diffix.session_access_level = 'anonymized_trusted';
 
@@ -85,6 +106,22 @@ SELECT city FROM test_patients GROUP BY 1;
 
 SELECT COUNT(*), COUNT(city), COUNT(DISTINCT city) FROM test_patients;
 
+----------------------------------------------------------------
+-- Text AIDs
+----------------------------------------------------------------
+
+SELECT COUNT(DISTINCT value) FROM test_text_aids;
+SELECT grp, COUNT(DISTINCT value) FROM test_text_aids GROUP BY 1 ORDER BY 1;
+
+-- Same results as with integer AIDs
+SELECT COUNT(*), COUNT(DISTINCT value) FROM test_text_aids
+EXCEPT
+SELECT COUNT(*), COUNT(DISTINCT value) FROM test_int_aids;
+
+SELECT grp, COUNT(*), COUNT(DISTINCT value) FROM test_text_aids GROUP BY 1
+EXCEPT
+SELECT grp, COUNT(*), COUNT(DISTINCT value) FROM test_int_aids GROUP BY 1;
+
 ----------------------------------------------------------------
 -- LCF & Filtering
 ----------------------------------------------------------------
@@ -93,6 +130,11 @@ SELECT city FROM test_customers;
 
 SELECT city FROM test_customers GROUP BY 1 HAVING length(city) <> 4;
 
+-- HAVING on anonymized aggregates, projected or not
+SELECT city, COUNT(*) FROM test_customers GROUP BY 1 HAVING COUNT(*) > 7;
+SELECT city, SUM(id) FROM test_customers GROUP BY 1 HAVING COUNT(*) BETWEEN 4 AND 7;
+SELECT city, COUNT(*), SUM(id) FROM test_customers GROUP BY 1 HAVING SUM(id) > 60;
+
 SELECT COUNT(*), COUNT(city), COUNT(DISTINCT city) FROM test_customers WHERE city = 'London';
 
 ----------------------------------------------------------------
@@ -112,9 +154,117 @@ SELECT COUNT(DISTINCT planet) FROM test_customers;
 SELECT city, COUNT(DISTINCT city) FROM test_customers GROUP BY 1;
 SELECT discount, COUNT(DISTINCT id) FROM test_customers GROUP BY 1;
 
+----------------------------------------------------------------
+-- Grouping sets
+----------------------------------------------------------------
+
+SELECT * FROM (
+  SELECT GROUPING(grp, value) AS g, grp, value, COUNT(*)
+  FROM test_text_aids
+  GROUP BY GROUPING SETS ((grp), (value), ())
+) x
+ORDER BY g, grp, value COLLATE "C";
+
+-- Buckets of each set match the equivalent separate GROUP BY queries
+SELECT grp, value, COUNT(*), COUNT(DISTINCT aid) FROM test_int_aids GROUP BY CUBE (grp, value)
+EXCEPT
+(
+  SELECT grp, value, COUNT(*), COUNT(DISTINCT aid) FROM test_int_aids GROUP BY 1, 2
+  UNION ALL
+  SELECT grp, NULL, count, count_distinct
+  FROM (SELECT grp, COUNT(*) AS count, COUNT(DISTINCT aid) AS count_distinct FROM test_int_aids GROUP BY 1) x
+  UNION ALL
+  SELECT NULL, value, count, count_distinct
+  FROM (SELECT value, COUNT(*) AS count, COUNT(DISTINCT aid) AS count_distinct FROM test_int_aids GROUP BY 1) x
+  UNION ALL
+  SELECT NULL, NULL, count, count_distinct
+  FROM (SELECT COUNT(*) AS count, COUNT(DISTINCT aid) AS count_distinct FROM test_int_aids) x
+);
+
+----------------------------------------------------------------
+-- Rescans
+----------------------------------------------------------------
+
+-- Scans with repeated parameter values are replayed from the cache
+SELECT x.n, x.p, count(*), sum(y.count)
+FROM (VALUES (1, 3), (2, 5), (3, 3), (4, 5), (5, 3)) x(n, p),
+  LATERAL (SELECT bucket, count(*) FROM test_rescans GROUP BY 1 HAVING bucket < x.p) y
+GROUP BY 1, 2
+ORDER BY 1;
+
+-- Same results as without the cache, which is not used by plans with volatile functions
+SELECT x.n, y.bucket, y.count
+FROM (VALUES (1, 3), (2, 5), (3, 3), (4, 5), (5, 3)) x(n, p),
+  LATERAL (SELECT bucket, count(*) FROM test_rescans GROUP BY 1 HAVING bucket < x.p) y
+EXCEPT
+SELECT x.n, y.bucket, y.count
+FROM (VALUES (1, 3), (2, 5), (3, 3), (4, 5), (5, 3)) x(n, p),
+  LATERAL (SELECT bucket, count(*) FROM test_rescans GROUP BY 1 HAVING bucket < x.p AND random() >= 0) y;
+
+RESET ROLE;
+
+SELECT * FROM bucket_scan_stats($$
+  SELECT x.n, y.bucket, y.count
+  FROM (VALUES (1, 3), (2, 5), (3, 3), (4, 5), (5, 3)) x(n, p),
+    LATERAL (SELECT bucket, count(*) FROM test_rescans GROUP BY 1 HAVING bucket < x.p) y
+$$) WHERE name IN ('Buckets', 'Cache Hits', 'Cache Misses');
+
+SELECT * FROM bucket_scan_stats($$
+  SELECT x.n, y.bucket, y.count
+  FROM (VALUES (1, 3), (2, 5), (3, 3), (4, 5), (5, 3)) x(n, p),
+    LATERAL (SELECT bucket, count(*) FROM test_rescans GROUP BY 1 HAVING bucket < x.p AND random() >= 0) y
+$$) WHERE name IN ('Buckets', 'Cache Hits', 'Cache Misses');
+
+SET work_mem = '64kB';
+
+-- Results of scans evict each other when both do not fit in the cache
+SELECT x.n, count(*), sum(y.count)
+FROM (VALUES (1, 1000), (2, 900), (3, 1000)) x(n, p),
+  LATERAL (SELECT bucket, count(*) FROM test_rescans GROUP BY 1 HAVING bucket < x.p) y
+GROUP BY 1
+ORDER BY 1;
+
+SELECT * FROM bucket_scan_stats($$
+  SELECT x.n, y.bucket, y.count
+  FROM (VALUES (1, 1000), (2, 900), (3, 1000)) x(n, p),
+    LATERAL (SELECT bucket, count(*) FROM test_rescans GROUP BY 1 HAVING bucket < x.p) y
+$$) WHERE name IN ('Cache Hits', 'Cache Misses');
+
+RESET work_mem;
+
+SET ROLE diffix_test;
+
 ----------------------------------------------------------------
 -- Prepared statements
 ----------------------------------------------------------------
 
 PREPARE prepared_floor_by(numeric) AS SELECT diffix.floor_by(discount, $1), count(*) FROM test_customers GROUP BY 1;
 EXECUTE prepared_floor_by(2.0);
+
+----------------------------------------------------------------
+-- Parallel aggregation
+----------------------------------------------------------------
+
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+
+-- Partial states are combined by the Finalize Aggregate
+EXPLAIN (COSTS off) SELECT COUNT(*) FROM test_customers;
+
+SELECT COUNT(*) FROM test_customers;
+SELECT COUNT(city), COUNT(DISTINCT city) FROM test_customers;
+SELECT SUM(id), diffix.sum_noise(id) FROM test_customers;
+
+-- Low count, LED and star buckets after combining partial states
+SELECT * FROM (SELECT city, COUNT(*) FROM test_customers GROUP BY 1) x
+ORDER BY city COLLATE "C";
+
+SELECT * FROM (SELECT dept, gender, title, COUNT(*) FROM test_led GROUP BY 1, 2, 3) x
+ORDER BY dept COLLATE "C", gender COLLATE "C", title COLLATE "C";
+
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
@@ -4,6 +4,28 @@ SET pg_diffix.noise_layer_sd = 7;
 SET pg_diffix.low_count_layer_sd = 2;
 SET pg_diffix.low_count_min_threshold = 2;
 
+-- Same labels as domains, which are seeded through their output functions or base types.
+CREATE DOMAIN int_label AS integer;
+CREATE DOMAIN float_label AS double precision;
+CREATE DOMAIN timestamp_label AS timestamp;
+CREATE DOMAIN text_label AS text;
+CREATE DOMAIN bpchar_label AS char(3);
+
+CREATE TABLE test_seeds AS
+SELECT
+  n AS id, n % 5 AS i, (n % 5) / 2.0::float8 AS f, '2020-01-01'::timestamp + (n % 5) * interval '1 hour' AS ts,
+  'v' || n % 5 AS t, ('c' || n % 5)::char(3) AS c
+FROM generate_series(1, 100) n;
+
+CREATE SCHEMA seed_domains;
+CREATE TABLE seed_domains.test_seeds AS
+SELECT id, i::int_label, f::float_label, ts::timestamp_label, t::text_label, c::bpchar_label FROM test_seeds;
+
+CALL diffix.mark_personal('public.test_seeds', 'id');
+CALL diffix.mark_personal('seed_domains.test_seeds', 'id');
+GRANT USAGE ON SCHEMA seed_domains TO diffix_test;
+GRANT SELECT ON seed_domains.test_seeds TO diffix_test;
+
 SET ROLE diffix_test;
 SET pg_diffix.session_access_level = 'anonymized_trusted';
 
@@ -119,3 +141,79 @@ UNION
 (SELECT COUNT(*) FROM test_customers AS c JOIN test_purchases ON c.id = cid WHERE city = 'Berlin')
 UNION
 (SELECT COUNT(*) FROM test_purchases JOIN test_customers AS c ON cid = c.id WHERE city = 'Berlin');
+
+----------------------------------------------------------------
+-- Grouping sets
+----------------------------------------------------------------
+
+-- Buckets of each set are seeded like those of the equivalent separate GROUP BY queries
+SELECT city, planet, COUNT(*) FROM test_customers GROUP BY CUBE (city, planet)
+EXCEPT
+(
+  SELECT city, planet, COUNT(*) FROM test_customers GROUP BY 1, 2
+  UNION ALL
+  SELECT city, NULL, count FROM (SELECT city, COUNT(*) FROM test_customers GROUP BY 1) x
+  UNION ALL
+  SELECT NULL, planet, count FROM (SELECT planet, COUNT(*) FROM test_customers GROUP BY 1) x
+  UNION ALL
+  SELECT NULL, NULL, count FROM (SELECT COUNT(*) FROM test_customers) x
+);
+
+----------------------------------------------------------------
+-- Label seeds
+----------------------------------------------------------------
+
+-- Labels are seeded the same, whether their types are hashed directly or not
+
+SELECT i, COUNT(*) FROM test_seeds GROUP BY 1
+EXCEPT
+SELECT i, COUNT(*) FROM seed_domains.test_seeds GROUP BY 1;
+
+SELECT f, COUNT(*) FROM test_seeds GROUP BY 1
+EXCEPT
+SELECT f, COUNT(*) FROM seed_domains.test_seeds GROUP BY 1;
+
+SELECT ts, COUNT(*) FROM test_seeds GROUP BY 1
+EXCEPT
+SELECT ts, COUNT(*) FROM seed_domains.test_seeds GROUP BY 1;
+
+SELECT t, COUNT(*) FROM test_seeds GROUP BY 1
+EXCEPT
+SELECT t, COUNT(*) FROM seed_domains.test_seeds GROUP BY 1;
+
+SELECT c, COUNT(*) FROM test_seeds GROUP BY 1
+EXCEPT
+SELECT c, COUNT(*) FROM seed_domains.test_seeds GROUP BY 1;
+
+----------------------------------------------------------------
+-- Prepared statements
+----------------------------------------------------------------
+
+-- Custom and generic plans produce the same noisy results
+PREPARE prepared_where(text) AS
+SELECT string_agg(x::text, ';' ORDER BY x::text) AS result
+FROM (SELECT COUNT(*), diffix.count_noise(*) FROM test_customers WHERE city = $1) x;
+
+PREPARE prepared_round_by(float8) AS
+SELECT string_agg(x::text, ';' ORDER BY x::text) AS result
+FROM (SELECT diffix.round_by(discount, $1), COUNT(*), diffix.count_noise(*) FROM test_customers GROUP BY 1) x;
+
+SET plan_cache_mode = force_custom_plan;
+EXECUTE prepared_where('Berlin') \gset custom_berlin_
+EXECUTE prepared_where('Rome') \gset custom_rome_
+EXECUTE prepared_round_by(1.0) \gset custom_round_1_
+EXECUTE prepared_round_by(2.0) \gset custom_round_2_
+
+SET plan_cache_mode = force_generic_plan;
+EXECUTE prepared_where('Berlin') \gset generic_berlin_
+EXECUTE prepared_where('Rome') \gset generic_rome_
+EXECUTE prepared_round_by(1.0) \gset generic_round_1_
+EXECUTE prepared_round_by(2.0) \gset generic_round_2_
+
+RESET plan_cache_mode;
+
+SELECT
+  :'custom_berlin_result' = :'generic_berlin_result' AS berlin,
+  :'custom_rome_result' = :'generic_rome_result' AS rome,
+  :'custom_round_1_result' = :'generic_round_1_result' AS round_1,
+  :'custom_round_2_result' = :'generic_round_2_result' AS round_2;
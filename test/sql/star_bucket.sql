@@ -102,6 +102,23 @@ SELECT dept, gender, title, count(*)
 FROM star_bucket_only
 GROUP BY 1, 2, 3;
 
+-- Other aggregators of the star bucket: no low count buckets, a single one, a low count star bucket and a star bucket
+SELECT dept, gender, title, count(*), count(DISTINCT id), count(title)
+FROM star_bucket_base
+GROUP BY 1, 2, 3;
+
+SELECT dept, gender, title, count(*), count(DISTINCT id), count(title)
+FROM star_bucket_suppressed_1
+GROUP BY 1, 2, 3;
+
+SELECT dept, gender, title, count(*), count(DISTINCT id), count(title)
+FROM star_bucket_suppressed_2
+GROUP BY 1, 2, 3;
+
+SELECT dept, gender, title, count(*), count(DISTINCT id), count(title)
+FROM star_bucket
+GROUP BY 1, 2, 3;
+
 ----------------------------------------------------------------
 -- Other queries
 ----------------------------------------------------------------
@@ -123,3 +140,79 @@ FROM star_bucket_only;
 
 SELECT 1
 FROM star_bucket_only;
+
+----------------------------------------------------------------
+-- Grouping sets
+----------------------------------------------------------------
+
+-- Each set has its own star bucket, which needs at least two low count buckets of the set.
+SELECT * FROM (
+  SELECT GROUPING(dept, gender, title) AS g, dept, gender, title, count(*)
+  FROM star_bucket
+  GROUP BY GROUPING SETS ((dept), (gender, title), ())
+) x
+ORDER BY g, dept COLLATE "C", gender COLLATE "C", title COLLATE "C";
+
+----------------------------------------------------------------
+-- Streaming
+----------------------------------------------------------------
+
+-- Without LED and the suppress bin, buckets are emitted as they are aggregated.
+SET pg_diffix.compute_suppress_bin = false;
+
+SELECT * FROM (SELECT dept, count(*) FROM star_bucket GROUP BY 1) x
+ORDER BY dept COLLATE "C";
+
+SELECT * FROM (SELECT dept, gender, count(*) FROM star_bucket GROUP BY 1, 2) x
+ORDER BY dept COLLATE "C", gender COLLATE "C";
+
+-- Rescans stream the buckets again.
+SELECT x.d, y.dept, y.count
+FROM (VALUES ('history'), ('math')) x(d),
+LATERAL (SELECT dept, count(*) FROM star_bucket GROUP BY 1 HAVING dept <> x.d) y
+ORDER BY 1, 2;
+
+-- Plans reused after enabling the suppress bin stop streaming.
+SET plan_cache_mode = force_generic_plan;
+
+PREPARE prepared_one_label AS
+SELECT * FROM (SELECT dept, count(*) FROM star_bucket GROUP BY 1) x
+ORDER BY dept COLLATE "C";
+PREPARE prepared_two_labels AS
+SELECT * FROM (SELECT dept, gender, count(*) FROM star_bucket GROUP BY 1, 2) x
+ORDER BY dept COLLATE "C", gender COLLATE "C";
+
+EXECUTE prepared_one_label;
+EXECUTE prepared_two_labels;
+
+SET pg_diffix.compute_suppress_bin = true;
+
+EXECUTE prepared_one_label;
+EXECUTE prepared_two_labels;
+
+RESET ROLE;
+
+SELECT * FROM bucket_scan_stats('EXECUTE prepared_one_label');
+
+SET pg_diffix.compute_suppress_bin = false;
+
+SELECT * FROM bucket_scan_stats('EXECUTE prepared_one_label');
+SELECT * FROM bucket_scan_stats('SELECT x.d, y.dept, y.count FROM (VALUES (''history''), (''math'')) x(d), LATERAL (SELECT dept, count(*) FROM star_bucket GROUP BY 1 HAVING dept <> x.d) y');
+
+SET ROLE diffix_test;
+
+RESET pg_diffix.compute_suppress_bin;
+RESET plan_cache_mode;
+
+----------------------------------------------------------------
+-- Scan statistics
+----------------------------------------------------------------
+
+RESET ROLE;
+
+-- Only emitted star buckets count their merged buckets.
+SELECT * FROM bucket_scan_stats('SELECT dept, gender, title, count(*), count(DISTINCT id) FROM star_bucket_suppressed_1 GROUP BY 1, 2, 3');
+SELECT * FROM bucket_scan_stats('SELECT dept, gender, title, count(*), count(DISTINCT id) FROM star_bucket_suppressed_2 GROUP BY 1, 2, 3');
+SELECT * FROM bucket_scan_stats('SELECT dept, gender, title, count(*), count(DISTINCT id) FROM star_bucket GROUP BY 1, 2, 3');
+
+SET ROLE diffix_test;
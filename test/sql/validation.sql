@@ -171,6 +171,11 @@ SELECT * FROM diffix.show_labels() WHERE objname LIKE 'public.empty_test_custome
 -- Allow prepared statements
 PREPARE prepared(float) AS SELECT discount, count(*) FROM empty_test_customers WHERE discount = $1 GROUP BY 1;
 EXECUTE prepared(1.0);
+SET plan_cache_mode = force_generic_plan;
+PREPARE prepared_generic(float) AS SELECT discount, count(*) FROM empty_test_customers WHERE discount = $1 GROUP BY 1;
+EXECUTE prepared_generic(1.0);
+EXECUTE prepared_generic(2.0);
+RESET plan_cache_mode;
 
 -- Allow anonymizing JOINs
 SELECT COUNT(*) FROM test_validation AS c
@@ -186,6 +191,9 @@ SELECT COUNT(c.city), COUNT(p.name) FROM test_validation AS c
 SELECT COUNT(*) FROM test_validation NATURAL JOIN test_patients;
 SELECT COUNT(*) FROM test_validation JOIN test_patients USING (name);
 
+-- Allow grouping sets
+SELECT city, COUNT(*) FROM test_validation GROUP BY ROLLUP (city);
+
 ----------------------------------------------------------------
 -- Unsupported queries
 ----------------------------------------------------------------
@@ -196,9 +204,8 @@ INSERT INTO test_validation VALUES (NULL, NULL,NULL);
 -- Get rejected because WITH is unsupported.
 WITH c AS (SELECT 1 FROM test_validation) SELECT 1 FROM test_validation;
 
--- Get rejected because GROUPING SETS are unsupported.
-SELECT city FROM test_validation GROUP BY GROUPING SETS ((city), ());
-SELECT city FROM test_validation GROUP BY CUBE ((city));
+-- Get rejected because duplicate grouping sets are unsupported.
+SELECT city FROM test_validation GROUP BY GROUPING SETS ((city), (city));
 
 -- Get rejected because SRF functions are unsupported.
 SELECT generate_series(1,4) FROM test_validation;
@@ -355,3 +362,8 @@ EXECUTE prepared_floor_by(2.1);
 PREPARE prepared_substring(int, int) AS SELECT substring(city, $1, $2) FROM test_validation GROUP BY 1;
 EXECUTE prepared_substring(1, 2);
 EXECUTE prepared_substring(2, 3);
+SET plan_cache_mode = force_generic_plan;
+PREPARE prepared_generic_floor_by(numeric) AS SELECT diffix.floor_by(discount, $1) FROM test_validation GROUP BY 1;
+EXECUTE prepared_generic_floor_by(2.0);
+EXECUTE prepared_generic_floor_by(2.1);
+RESET plan_cache_mode;